@@ -0,0 +1,288 @@
+// Asset pack builder for VulkanTutorial2.
+//
+// Writes shaders and textures into one file in the layout of VulkanTutorial2/AssetPack.h, which the app maps into
+// memory at startup and uses in place: SPIR-V as is, PNGs decoded with their whole mip chain, and KTX files
+// (e.g. from Tools/TextureCooker.cpp) with the levels they have. Texture levels are stored the way the app copies them
+// into an image, so they go from the mapping into the staging ring with a single memcpy.
+//
+// usage: AssetPackBuilder <output.pack> <input.spv|input.png|input.ktx>...
+//
+// Assets are found by their file name without the directory, e.g. fractal_tree.png or fractal_tree.bc7.ktx. The app
+// looks for assets.pack in its resources, e.g.
+// AssetPackBuilder VulkanTutorial2/assets.pack VulkanTutorial2/*.spv VulkanTutorial2/fractal_tree.png
+// PNGs are decoded and filtered by the app's own VulkanTutorial2/PNGImage.h. 8 bit PNGs are stored as RGBA8 and 16 bit
+// ones as RGBA16 UNORM, which the app turns into half floats where the device can't sample it.
+//
+// Outside of Xcode: c++ -O2 -std=gnu++14 -IVulkanTutorial2 Tools/AssetPackBuilder.cpp VulkanTutorial2/lodepng.cpp
+
+#include "AssetPack.h"
+#include "PNGImage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// the VkFormat values, so that the builder doesn't need the Vulkan headers
+enum : uint32_t
+{
+    VkFormatR8G8B8A8Unorm = 37,
+    VkFormatR16G16B16A16Unorm = 91,
+    VkFormatBC1RGBUnorm = 131,
+    VkFormatBC1RGBAUnorm = 133,
+    VkFormatBC3Unorm = 137,
+    VkFormatBC7Unorm = 145,
+    VkFormatASTC4x4Unorm = 157,
+};
+
+struct Asset
+{
+    std::string name;
+    AssetPackEntry entry = {};
+    std::vector<unsigned char> data;
+};
+
+static bool endsWith(const std::string& string, const char* suffix)
+{
+    const size_t length = std::strlen(suffix);
+    return string.size() >= length && string.compare(string.size() - length, length, suffix) == 0;
+}
+
+static bool readFile(const std::string& filename, std::vector<unsigned char>& out)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+    
+    out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+static bool loadSPIRV(const std::string& filename, Asset& asset)
+{
+    if (!readFile(filename, asset.data) || asset.data.size() < 4 || asset.data.size() % 4 != 0)
+        return false;
+    
+    uint32_t magic;
+    std::memcpy(&magic, asset.data.data(), sizeof(magic));
+    if (magic != 0x07230203)
+        return false;
+    
+    asset.entry.type = AssetPackEntryType::SPIRV;
+    return true;
+}
+
+// the same mip chain the app builds when it loads the PNG itself, 16 bit PNGs keep their precision
+static bool loadPNG(const std::string& filename, Asset& asset)
+{
+    try
+    {
+        // textures are colour, so their mips are averaged in linear light
+        PNGImage image(filename.c_str(), true, true, PNGImage::PixelFormat::RGBA16);
+        if (image.myMipLevels.size() > AssetPackMaxMipLevels)
+            return false;
+        
+        asset.entry.type = AssetPackEntryType::Texture2D;
+        asset.entry.format = image.myFormat == PNGImage::PixelFormat::RGBA16 ? VkFormatR16G16B16A16Unorm : VkFormatR8G8B8A8Unorm;
+        asset.entry.width = image.myWidth;
+        asset.entry.height = image.myHeight;
+        asset.entry.texelBlockSizeBytes = image.myPixelSizeBytes;
+        asset.entry.mipLevels = static_cast<uint32_t>(image.myMipLevels.size());
+        for (uint32_t level = 0; level < asset.entry.mipLevels; level++)
+            asset.entry.mipOffsets[level] = image.myMipLevels[level].offset;
+        
+        asset.data = std::move(image.myImage);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "decoder error: " << e.what() << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+// a single 2D image in one of the block compressed formats the app loads
+static bool loadKTX(const std::string& filename, Asset& asset)
+{
+    std::vector<unsigned char> file;
+    if (!readFile(filename, file))
+        return false;
+    
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    
+    // endianness, glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat, pixelWidth, pixelHeight,
+    // pixelDepth, numberOfArrayElements, numberOfFaces, numberOfMipmapLevels, bytesOfKeyValueData
+    uint32_t header[13];
+    if (file.size() < sizeof(identifier) + sizeof(header) || std::memcmp(file.data(), identifier, sizeof(identifier)) != 0)
+        return false;
+    
+    std::memcpy(header, file.data() + sizeof(identifier), sizeof(header));
+    if (header[0] != 0x04030201 || header[6] == 0 || header[7] == 0 || header[8] != 0 || header[9] != 0 || header[10] != 1)
+        return false;
+    
+    switch (header[4])
+    {
+        case 0x83F0: // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+            asset.entry.format = VkFormatBC1RGBUnorm;
+            asset.entry.texelBlockSizeBytes = 8;
+            break;
+        case 0x83F1: // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+            asset.entry.format = VkFormatBC1RGBAUnorm;
+            asset.entry.texelBlockSizeBytes = 8;
+            break;
+        case 0x83F3: // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+            asset.entry.format = VkFormatBC3Unorm;
+            asset.entry.texelBlockSizeBytes = 16;
+            break;
+        case 0x8E8C: // GL_COMPRESSED_RGBA_BPTC_UNORM
+            asset.entry.format = VkFormatBC7Unorm;
+            asset.entry.texelBlockSizeBytes = 16;
+            break;
+        case 0x93B0: // GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+            asset.entry.format = VkFormatASTC4x4Unorm;
+            asset.entry.texelBlockSizeBytes = 16;
+            break;
+        default:
+            return false;
+    }
+    
+    asset.entry.type = AssetPackEntryType::Texture2D;
+    asset.entry.width = header[6];
+    asset.entry.height = header[7];
+    asset.entry.mipLevels = std::max(header[11], 1u);
+    if (asset.entry.mipLevels > AssetPackMaxMipLevels)
+        return false;
+    
+    size_t offset = sizeof(identifier) + sizeof(header) + size_t(header[12]);
+    for (uint32_t level = 0; level < asset.entry.mipLevels; level++)
+    {
+        const size_t width = std::max(asset.entry.width >> level, 1u);
+        const size_t height = std::max(asset.entry.height >> level, 1u);
+        const size_t levelSize = ((width + 3) / 4) * ((height + 3) / 4) * asset.entry.texelBlockSizeBytes;
+        
+        uint32_t imageSize;
+        if (offset + sizeof(imageSize) > file.size())
+            return false;
+        
+        std::memcpy(&imageSize, file.data() + offset, sizeof(imageSize));
+        offset += sizeof(imageSize);
+        if (imageSize != levelSize || offset + imageSize > file.size())
+            return false;
+        
+        // whole blocks never need the padding to 4 bytes
+        asset.entry.mipOffsets[level] = asset.data.size();
+        asset.data.insert(asset.data.end(), file.begin() + offset, file.begin() + offset + imageSize);
+        offset += imageSize;
+    }
+    
+    return true;
+}
+
+static void writePadding(std::ofstream& file, uint64_t& offset, uint64_t alignment)
+{
+    static const char zeros[AssetPackAlignment] = {};
+    
+    const uint64_t padding = (alignment - offset % alignment) % alignment;
+    file.write(zeros, static_cast<std::streamsize>(padding));
+    offset += padding;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <output.pack> <input.spv|input.png|input.ktx>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    std::vector<Asset> assets;
+    for (int i = 2; i < argc; i++)
+    {
+        const std::string filename = argv[i];
+        
+        Asset asset;
+        asset.name = filename.substr(filename.find_last_of('/') + 1);
+        asset.entry.nameHash = hashAssetName(asset.name.c_str());
+        
+        bool loaded = false;
+        if (endsWith(filename, ".spv"))
+            loaded = loadSPIRV(filename, asset);
+        else if (endsWith(filename, ".png"))
+            loaded = loadPNG(filename, asset);
+        else if (endsWith(filename, ".ktx"))
+            loaded = loadKTX(filename, asset);
+        
+        if (!loaded)
+        {
+            std::cerr << "failed to load " << filename << ", it isn't SPIR-V, a PNG or a KTX file with a 2D BC1, BC3, BC7 or ASTC 4x4 texture" << std::endl;
+            return EXIT_FAILURE;
+        }
+        
+        asset.entry.size = asset.data.size();
+        assets.push_back(std::move(asset));
+    }
+    
+    // the app finds entries with a binary search over the hashes
+    std::sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b)
+    {
+        return a.entry.nameHash < b.entry.nameHash;
+    });
+    for (size_t i = 1; i < assets.size(); i++)
+    {
+        if (assets[i - 1].entry.nameHash == assets[i].entry.nameHash)
+        {
+            std::cerr << assets[i - 1].name << " and " << assets[i].name << (assets[i - 1].name == assets[i].name ? " are the same name" : " have the same hash") << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    AssetPackHeader header = {};
+    header.magic = AssetPackMagic;
+    header.version = AssetPackVersion;
+    header.entryCount = static_cast<uint32_t>(assets.size());
+    header.entrySizeBytes = sizeof(AssetPackEntry);
+    header.entriesOffset = sizeof(AssetPackHeader);
+    
+    uint64_t offset = header.entriesOffset + assets.size() * sizeof(AssetPackEntry);
+    for (Asset& asset : assets)
+    {
+        offset += (AssetPackAlignment - offset % AssetPackAlignment) % AssetPackAlignment;
+        asset.entry.offset = offset;
+        offset += asset.entry.size;
+    }
+    
+    std::ofstream file(argv[1], std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const Asset& asset : assets)
+        file.write(reinterpret_cast<const char*>(&asset.entry), sizeof(asset.entry));
+    
+    offset = header.entriesOffset + assets.size() * sizeof(AssetPackEntry);
+    for (const Asset& asset : assets)
+    {
+        writePadding(file, offset, AssetPackAlignment);
+        file.write(reinterpret_cast<const char*>(asset.data.data()), static_cast<std::streamsize>(asset.data.size()));
+        offset += asset.data.size();
+        
+        std::printf("%-24s %8llu bytes", asset.name.c_str(), static_cast<unsigned long long>(asset.entry.size));
+        if (asset.entry.type == AssetPackEntryType::Texture2D)
+            std::printf(", %ux%u, %u mip levels", asset.entry.width, asset.entry.height, asset.entry.mipLevels);
+        std::printf("\n");
+    }
+    
+    if (!file)
+    {
+        std::cerr << "failed to write " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    std::printf("%zu assets, %llu bytes\n", assets.size(), static_cast<unsigned long long>(offset));
+    
+    return EXIT_SUCCESS;
+}
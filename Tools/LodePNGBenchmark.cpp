@@ -0,0 +1,552 @@
+// Standalone lodepng throughput benchmark.
+//
+// Runs decode, encode (every filter strategy x compression preset), inflate, deflate, crc32 and convert over
+// a directory of PNGs and/or a set of generated images, and reports MB/s, per-image latency percentiles and
+// peak RSS. MB/s is always measured against the uncompressed size of the image in its own color type, so the
+// numbers of different operations on the same image set are comparable.
+//
+// usage: LodePNGBenchmark [--corpus <dir>] [--no-synthetic] [--size <pixels>] [--repeat <n>]
+//                         [--json <file>] [--baseline <file>] [--tolerance <fraction>]
+//
+// With --baseline, every operation that is more than tolerance (default 0.1) slower than in the baseline
+// JSON (as written by --json) is reported and the exit code is non-zero.
+//
+// Outside of Xcode: c++ -O2 -std=gnu++14 -IVulkanTutorial2 Tools/LodePNGBenchmark.cpp VulkanTutorial2/lodepng.cpp
+
+#include "lodepng.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+
+struct BenchmarkImage
+{
+    BenchmarkImage(const std::string& name)
+    : myName(name)
+    {
+        lodepng_color_mode_init(&myMode);
+    }
+    
+    BenchmarkImage(const BenchmarkImage& other)
+    : myName(other.myName)
+    , myPNG(other.myPNG)
+    , myRaw(other.myRaw)
+    , myWidth(other.myWidth)
+    , myHeight(other.myHeight)
+    , myInterlaced(other.myInterlaced)
+    {
+        lodepng_color_mode_init(&myMode);
+        lodepng_color_mode_copy(&myMode, &other.myMode);
+    }
+    
+    ~BenchmarkImage()
+    {
+        lodepng_color_mode_cleanup(&myMode);
+    }
+    
+    BenchmarkImage& operator=(const BenchmarkImage&) = delete;
+    
+    std::string myName;
+    std::vector<unsigned char> myPNG;
+    std::vector<unsigned char> myRaw; // in the PNG's own color type
+    LodePNGColorMode myMode;
+    unsigned myWidth = 0;
+    unsigned myHeight = 0;
+    unsigned myInterlaced = 0;
+};
+
+struct BenchmarkResult
+{
+    std::string myName;
+    std::vector<double> mySeconds; // one sample per image and repetition
+    double myTotalSeconds = 0;
+    double myTotalBytes = 0;
+    
+    double mbps() const
+    {
+        return myTotalSeconds > 0 ? myTotalBytes / myTotalSeconds / (1024.0 * 1024.0) : 0;
+    }
+    
+    double percentileMs(double p)
+    {
+        if (mySeconds.empty())
+            return 0;
+        
+        std::sort(mySeconds.begin(), mySeconds.end());
+        size_t rank = static_cast<size_t>(p * (mySeconds.size() - 1) + 0.5);
+        return mySeconds[rank] * 1000.0;
+    }
+};
+
+static uint32_t xorshift(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static bool encodeImage(BenchmarkImage& image)
+{
+    lodepng::State state;
+    state.encoder.auto_convert = 0;
+    state.info_png.interlace_method = image.myInterlaced;
+    lodepng_color_mode_copy(&state.info_raw, &image.myMode);
+    lodepng_color_mode_copy(&state.info_png.color, &image.myMode);
+    
+    unsigned error = lodepng::encode(image.myPNG, image.myRaw, image.myWidth, image.myHeight, state);
+    if (error)
+        std::cerr << image.myName << ": encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    
+    return !error;
+}
+
+static void addSyntheticImages(std::vector<BenchmarkImage>& images, unsigned size)
+{
+    uint32_t seed = 0x9e3779b9;
+    
+    {
+        BenchmarkImage image("synthetic/noise_rgba8");
+        image.myMode.colortype = LCT_RGBA;
+        image.myMode.bitdepth = 8;
+        image.myWidth = image.myHeight = size;
+        image.myRaw.resize(size_t(size) * size * 4);
+        for (auto& c : image.myRaw)
+            c = static_cast<unsigned char>(xorshift(seed));
+        images.push_back(image);
+    }
+    
+    for (unsigned interlaced = 0; interlaced < 2; interlaced++)
+    {
+        BenchmarkImage image(interlaced ? "synthetic/gradient_rgba8_adam7" : "synthetic/gradient_rgb8");
+        image.myMode.colortype = interlaced ? LCT_RGBA : LCT_RGB;
+        image.myMode.bitdepth = 8;
+        image.myWidth = image.myHeight = size;
+        image.myInterlaced = interlaced;
+        unsigned channels = interlaced ? 4 : 3;
+        image.myRaw.resize(size_t(size) * size * channels);
+        for (unsigned y = 0; y < size; y++)
+            for (unsigned x = 0; x < size; x++)
+            {
+                unsigned char* p = &image.myRaw[(size_t(y) * size + x) * channels];
+                p[0] = static_cast<unsigned char>(x * 255 / size);
+                p[1] = static_cast<unsigned char>(y * 255 / size);
+                p[2] = static_cast<unsigned char>((x + y) * 127 / size);
+                if (channels == 4)
+                    p[3] = 255;
+            }
+        images.push_back(image);
+    }
+    
+    {
+        BenchmarkImage image("synthetic/palette8");
+        image.myMode.colortype = LCT_PALETTE;
+        image.myMode.bitdepth = 8;
+        for (unsigned i = 0; i < 256; i++)
+            lodepng_palette_add(&image.myMode, static_cast<unsigned char>(i), static_cast<unsigned char>(255 - i), static_cast<unsigned char>(i * 7), 255);
+        image.myWidth = image.myHeight = size;
+        image.myRaw.resize(size_t(size) * size);
+        for (unsigned y = 0; y < size; y++)
+            for (unsigned x = 0; x < size; x++)
+                image.myRaw[size_t(y) * size + x] = static_cast<unsigned char>(((x / 16) ^ (y / 16)) + (xorshift(seed) & 3));
+        images.push_back(image);
+    }
+    
+    {
+        BenchmarkImage image("synthetic/gradient_noise_rgba16");
+        image.myMode.colortype = LCT_RGBA;
+        image.myMode.bitdepth = 16;
+        image.myWidth = image.myHeight = size;
+        image.myRaw.resize(size_t(size) * size * 8);
+        for (unsigned y = 0; y < size; y++)
+            for (unsigned x = 0; x < size; x++)
+            {
+                unsigned char* p = &image.myRaw[(size_t(y) * size + x) * 8];
+                unsigned values[4] = { x * 65535 / size, y * 65535 / size, (xorshift(seed) & 0xff) + 32768, 65535 };
+                for (unsigned c = 0; c < 4; c++)
+                {
+                    p[c * 2 + 0] = static_cast<unsigned char>(values[c] >> 8);
+                    p[c * 2 + 1] = static_cast<unsigned char>(values[c]);
+                }
+            }
+        images.push_back(image);
+    }
+}
+
+static void addCorpusImages(std::vector<BenchmarkImage>& images, const std::string& directory)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+    {
+        std::cerr << "failed to open corpus directory " << directory << std::endl;
+        return;
+    }
+    
+    std::vector<std::string> filenames;
+    while (dirent* entry = readdir(dir))
+    {
+        std::string filename = entry->d_name;
+        if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".png") == 0)
+            filenames.push_back(filename);
+    }
+    closedir(dir);
+    
+    // stable order, so that reports of different runs line up
+    std::sort(filenames.begin(), filenames.end());
+    
+    for (const auto& filename : filenames)
+    {
+        BenchmarkImage image(filename);
+        std::string path = directory + "/" + filename;
+        unsigned error = lodepng::load_file(image.myPNG, path);
+        
+        lodepng::State state;
+        state.decoder.color_convert = 0;
+        if (!error)
+            error = lodepng::decode(image.myRaw, image.myWidth, image.myHeight, state, image.myPNG);
+        
+        if (error)
+        {
+            std::cerr << path << ": decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+            continue;
+        }
+        
+        lodepng_color_mode_copy(&image.myMode, &state.info_png.color);
+        image.myInterlaced = state.info_png.interlace_method;
+        images.push_back(image);
+    }
+}
+
+static size_t peakRSSKiB()
+{
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss) / 1024; // bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss);
+#endif
+}
+
+class LodePNGBenchmark
+{
+public:
+    
+    LodePNGBenchmark(const std::vector<BenchmarkImage>& images, unsigned repeat)
+    : myImages(images)
+    , myRepeat(repeat)
+    {
+    }
+    
+    void run()
+    {
+        runDecode();
+        runEncode();
+        runZlib();
+        runCRC32();
+        runConvert();
+    }
+    
+    void print()
+    {
+        std::printf("%-40s %10s %10s %10s %10s\n", "operation", "MB/s", "p50 ms", "p90 ms", "p99 ms");
+        for (auto& result : myResults)
+            std::printf("%-40s %10.2f %10.3f %10.3f %10.3f\n", result.myName.c_str(), result.mbps(), result.percentileMs(0.5), result.percentileMs(0.9), result.percentileMs(0.99));
+        std::printf("peak RSS: %zu KiB\n", peakRSSKiB());
+    }
+    
+    // one result per line, which is also what readBaseline relies on
+    void writeJSON(std::ostream& out)
+    {
+        out << "{\n";
+        out << "  \"images\": " << myImages.size() << ",\n";
+        out << "  \"repeat\": " << myRepeat << ",\n";
+        out << "  \"peak_rss_kib\": " << peakRSSKiB() << ",\n";
+        out << "  \"results\": [\n";
+        for (size_t i = 0; i < myResults.size(); i++)
+        {
+            auto& result = myResults[i];
+            out << "    { \"name\": \"" << result.myName << "\", \"mbps\": " << result.mbps()
+                << ", \"p50_ms\": " << result.percentileMs(0.5) << ", \"p90_ms\": " << result.percentileMs(0.9)
+                << ", \"p99_ms\": " << result.percentileMs(0.99) << ", \"samples\": " << result.mySeconds.size() << " }"
+                << (i + 1 < myResults.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+    
+    unsigned compareToBaseline(const std::string& filename, double tolerance)
+    {
+        std::ifstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "failed to open baseline " << filename << std::endl;
+            return 1;
+        }
+        
+        std::map<std::string, double> baseline;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            size_t name = line.find("\"name\": \"");
+            size_t mbps = line.find("\"mbps\": ");
+            if (name == std::string::npos || mbps == std::string::npos)
+                continue;
+            
+            name += 9;
+            baseline[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + mbps + 8);
+        }
+        
+        unsigned regressions = 0;
+        for (const auto& result : myResults)
+        {
+            auto it = baseline.find(result.myName);
+            if (it == baseline.end())
+                continue;
+            
+            if (result.mbps() < it->second * (1.0 - tolerance))
+            {
+                std::printf("REGRESSION %s: %.2f MB/s, baseline %.2f MB/s (%.1f%%)\n", result.myName.c_str(), result.mbps(), it->second, 100.0 * (result.mbps() / it->second - 1.0));
+                regressions++;
+            }
+        }
+        
+        return regressions;
+    }
+
+private:
+    
+    static double rawSize(const BenchmarkImage& image)
+    {
+        return static_cast<double>(lodepng_get_raw_size(image.myWidth, image.myHeight, &image.myMode));
+    }
+    
+    // times op once per image and repetition, op returns non-zero on error
+    void measure(const std::string& name, const std::function<unsigned(const BenchmarkImage&)>& op)
+    {
+        BenchmarkResult result;
+        result.myName = name;
+        for (const auto& image : myImages)
+        {
+            for (unsigned i = 0; i < myRepeat; i++)
+            {
+                auto start = std::chrono::high_resolution_clock::now();
+                unsigned error = op(image);
+                double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                
+                if (error)
+                {
+                    std::cerr << name << " " << image.myName << ": error " << error << ": " << lodepng_error_text(error) << std::endl;
+                    break;
+                }
+                
+                result.mySeconds.push_back(seconds);
+                result.myTotalSeconds += seconds;
+                result.myTotalBytes += rawSize(image);
+            }
+        }
+        myResults.push_back(result);
+    }
+    
+    void runDecode()
+    {
+        measure("decode", [](const BenchmarkImage& image)
+        {
+            unsigned char* out = nullptr;
+            unsigned w, h;
+            LodePNGState state;
+            lodepng_state_init(&state);
+            unsigned error = lodepng_decode(&out, &w, &h, &state, image.myPNG.data(), image.myPNG.size());
+            lodepng_state_cleanup(&state);
+            free(out);
+            return error;
+        });
+    }
+    
+    void runEncode()
+    {
+        static const struct { LodePNGFilterStrategy strategy; const char* name; } strategies[] =
+        {
+            { LFS_ZERO, "zero" },
+            { LFS_MINSUM, "minsum" },
+            { LFS_ENTROPY, "entropy" },
+            { LFS_BRUTE_FORCE, "brute_force" },
+        };
+        
+        static const struct { unsigned btype; unsigned windowsize; unsigned lazymatching; const char* name; } compressions[] =
+        {
+            { 0, 2048, 0, "store" },
+            { 2, 512, 0, "fast" },
+            { 2, 2048, 1, "default" },
+            { 2, 32768, 1, "best" },
+        };
+        
+        for (const auto& strategy : strategies)
+        {
+            for (const auto& compression : compressions)
+            {
+                measure(std::string("encode/") + strategy.name + "/" + compression.name, [&](const BenchmarkImage& image)
+                {
+                    unsigned char* out = nullptr;
+                    size_t outsize = 0;
+                    LodePNGState state;
+                    lodepng_state_init(&state);
+                    state.encoder.auto_convert = 0;
+                    state.encoder.filter_strategy = strategy.strategy;
+                    state.encoder.zlibsettings.btype = compression.btype;
+                    state.encoder.zlibsettings.windowsize = compression.windowsize;
+                    state.encoder.zlibsettings.lazymatching = compression.lazymatching;
+                    state.info_png.interlace_method = image.myInterlaced;
+                    unsigned error = lodepng_color_mode_copy(&state.info_raw, &image.myMode);
+                    if (!error)
+                        error = lodepng_color_mode_copy(&state.info_png.color, &image.myMode);
+                    if (!error)
+                        error = lodepng_encode(&out, &outsize, image.myRaw.data(), image.myWidth, image.myHeight, &state);
+                    lodepng_state_cleanup(&state);
+                    free(out);
+                    return error;
+                });
+            }
+        }
+    }
+    
+    void runZlib()
+    {
+        // the deflate stream of each image's raw pixels, for inflate to chew on
+        std::map<const BenchmarkImage*, std::vector<unsigned char>> deflated;
+        for (const auto& image : myImages)
+        {
+            unsigned char* out = nullptr;
+            size_t outsize = 0;
+            lodepng_deflate(&out, &outsize, image.myRaw.data(), image.myRaw.size(), &lodepng_default_compress_settings);
+            deflated[&image].assign(out, out + outsize);
+            free(out);
+        }
+        
+        measure("deflate", [](const BenchmarkImage& image)
+        {
+            unsigned char* out = nullptr;
+            size_t outsize = 0;
+            unsigned error = lodepng_deflate(&out, &outsize, image.myRaw.data(), image.myRaw.size(), &lodepng_default_compress_settings);
+            free(out);
+            return error;
+        });
+        
+        measure("inflate", [&deflated](const BenchmarkImage& image)
+        {
+            const auto& in = deflated[&image];
+            unsigned char* out = nullptr;
+            size_t outsize = 0;
+            unsigned error = lodepng_inflate(&out, &outsize, in.data(), in.size(), &lodepng_default_decompress_settings);
+            free(out);
+            return error;
+        });
+    }
+    
+    void runCRC32()
+    {
+        measure("crc32", [](const BenchmarkImage& image)
+        {
+            // volatile so that the checksum can't be optimized away
+            volatile unsigned crc = lodepng_crc32(image.myRaw.data(), image.myRaw.size());
+            (void)crc;
+            return 0u;
+        });
+    }
+    
+    void runConvert()
+    {
+        measure("convert/rgba8", [](const BenchmarkImage& image)
+        {
+            LodePNGColorMode rgba8;
+            lodepng_color_mode_init(&rgba8);
+            std::vector<unsigned char> out(size_t(image.myWidth) * image.myHeight * 4);
+            return lodepng_convert(out.data(), image.myRaw.data(), &rgba8, &image.myMode, image.myWidth, image.myHeight);
+        });
+    }
+    
+    const std::vector<BenchmarkImage>& myImages;
+    unsigned myRepeat = 1;
+    std::vector<BenchmarkResult> myResults;
+};
+
+int main(int argc, char* argv[])
+{
+    std::string corpus;
+    std::string jsonFilename;
+    std::string baselineFilename;
+    bool synthetic = true;
+    unsigned size = 512;
+    unsigned repeat = 5;
+    double tolerance = 0.1;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--corpus" && hasValue)
+            corpus = argv[++i];
+        else if (arg == "--no-synthetic")
+            synthetic = false;
+        else if (arg == "--size" && hasValue)
+            size = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--repeat" && hasValue)
+            repeat = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--json" && hasValue)
+            jsonFilename = argv[++i];
+        else if (arg == "--baseline" && hasValue)
+            baselineFilename = argv[++i];
+        else if (arg == "--tolerance" && hasValue)
+            tolerance = std::atof(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--corpus <dir>] [--no-synthetic] [--size <pixels>] [--repeat <n>] [--json <file>] [--baseline <file>] [--tolerance <fraction>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    std::vector<BenchmarkImage> images;
+    if (synthetic && size > 0)
+        addSyntheticImages(images, size);
+    if (!corpus.empty())
+        addCorpusImages(images, corpus);
+    
+    for (auto& image : images)
+        if (image.myPNG.empty() && !encodeImage(image))
+            return EXIT_FAILURE;
+    
+    if (images.empty() || repeat == 0)
+    {
+        std::cerr << "nothing to benchmark" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    LodePNGBenchmark benchmark(images, repeat);
+    benchmark.run();
+    benchmark.print();
+    
+    if (!jsonFilename.empty())
+    {
+        std::ofstream json(jsonFilename);
+        benchmark.writeJSON(json);
+    }
+    
+    if (!baselineFilename.empty() && benchmark.compareToBaseline(baselineFilename, tolerance) > 0)
+        return EXIT_FAILURE;
+    
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,851 @@
+// Offline texture cooker for VulkanTutorial2.
+//
+// Decodes a PNG with lodepng, builds its mip chain with the app's filter (VulkanTutorial2/PNGImage.h) and block
+// compresses every level into a KTX (version 1) file, which the app uploads as is where the device can sample the
+// format. The encoders are plain scalar float code; the blocks are encoded on all cores, a row of blocks at a time,
+// then decoded again in software and compared with the uncompressed levels, so the encoders can be checked without
+// a GPU.
+//
+// usage: TextureCooker [--format bc1|bc3|bc7] [--quality fast|normal|high] [--threads <n>] [--min-psnr <dB>]
+//                      <input.png> <output.ktx>
+//
+// bc1 is 4 bits per pixel and opaque, bc3 8 bits with a separate alpha block, and bc7 (the default) 8 bits at the best
+// quality. bc7 is always written in mode 6: one subset, RGBA endpoints with a shared lowest bit, 4 bit indices.
+// fast fits the endpoints to the bounding box of each block, normal (the default) to the principal axis of its colors,
+// and high also refits them by least squares to the chosen indices and tries every bc7 p-bit pair.
+// With --min-psnr the exit code is non-zero when any level decodes worse than that.
+// The app looks for <name>.bc7.ktx, <name>.bc3.ktx, <name>.bc1.ktx and <name>.astc.ktx (ASTC 4x4 from another
+// encoder, there is none here) in its resources before <name>.png, e.g.
+// TextureCooker VulkanTutorial2/fractal_tree.png VulkanTutorial2/fractal_tree.bc7.ktx
+//
+// Outside of Xcode: c++ -O2 -std=gnu++14 -IVulkanTutorial2 Tools/TextureCooker.cpp VulkanTutorial2/lodepng.cpp -lpthread
+
+#include "PNGImage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class BlockFormat
+{
+    BC1,
+    BC3,
+    BC7,
+};
+
+enum class Quality
+{
+    Fast,
+    Normal,
+    High,
+};
+
+// what KTX files call the formats, the OpenGL enums
+enum : uint32_t
+{
+    KTXFormatBC1 = 0x83F0, // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    KTXFormatBC3 = 0x83F3, // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    KTXFormatBC7 = 0x8E8C, // GL_COMPRESSED_RGBA_BPTC_UNORM
+    KTXBaseFormatRGB = 0x1907,
+    KTXBaseFormatRGBA = 0x1908,
+};
+
+struct Level
+{
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<unsigned char> rgba;
+};
+
+typedef float BlockPixels[16][4];
+typedef unsigned char DecodedBlock[16][4];
+
+static const int ourBC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// the pixels of the block at bx, by, with the last row and column repeated where the level ends inside it
+static void fetchBlock(const Level& level, unsigned bx, unsigned by, BlockPixels pixels)
+{
+    for (unsigned i = 0; i < 16; i++)
+    {
+        const unsigned x = std::min(bx * 4 + i % 4, level.width - 1);
+        const unsigned y = std::min(by * 4 + i / 4, level.height - 1);
+        const unsigned char* pixel = &level.rgba[(size_t(y) * level.width + x) * 4];
+        for (unsigned c = 0; c < 4; c++)
+            pixels[i][c] = pixel[c];
+    }
+}
+
+// endpoints for the first channelCount channels of the block, e0 and e1 at the two ends of the colors' spread
+static void fitEndpoints(const BlockPixels pixels, unsigned channelCount, Quality quality, float e0[4], float e1[4])
+{
+    float mean[4] = {};
+    for (unsigned i = 0; i < 16; i++)
+        for (unsigned c = 0; c < 4; c++)
+            mean[c] += pixels[i][c] * (1.0f / 16);
+    
+    if (quality == Quality::Fast)
+    {
+        float lo[4] = { 255, 255, 255, 255 };
+        float hi[4] = {};
+        unsigned widest = 0;
+        for (unsigned c = 0; c < channelCount; c++)
+        {
+            for (unsigned i = 0; i < 16; i++)
+            {
+                lo[c] = std::min(lo[c], pixels[i][c]);
+                hi[c] = std::max(hi[c], pixels[i][c]);
+            }
+            if (hi[c] - lo[c] > hi[widest] - lo[widest])
+                widest = c;
+        }
+        
+        // the box diagonal that runs along the colors, channels that fall while the widest one rises are flipped
+        for (unsigned c = 0; c < channelCount; c++)
+        {
+            float covariance = 0;
+            for (unsigned i = 0; i < 16; i++)
+                covariance += (pixels[i][c] - mean[c]) * (pixels[i][widest] - mean[widest]);
+            
+            // the extremes are rarely worth spending an endpoint on, pull them in by 1/16 of the range
+            const float inset = (hi[c] - lo[c]) / 16;
+            e0[c] = covariance < 0 ? lo[c] + inset : hi[c] - inset;
+            e1[c] = covariance < 0 ? hi[c] - inset : lo[c] + inset;
+        }
+        return;
+    }
+    
+    float covariance[4][4] = {};
+    for (unsigned i = 0; i < 16; i++)
+        for (unsigned a = 0; a < channelCount; a++)
+            for (unsigned b = 0; b < channelCount; b++)
+                covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+    
+    // power iteration for the principal axis, starting from the diagonal of the color cube
+    float axis[4] = { 1, 1, 1, 1 };
+    for (unsigned iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = {};
+        for (unsigned a = 0; a < channelCount; a++)
+            for (unsigned b = 0; b < channelCount; b++)
+                next[a] += covariance[a][b] * axis[b];
+        
+        float length = 0;
+        for (unsigned c = 0; c < channelCount; c++)
+            length = std::max(length, std::fabs(next[c]));
+        if (length < 1e-6f)
+            break;
+        
+        for (unsigned c = 0; c < channelCount; c++)
+            axis[c] = next[c] / length;
+    }
+    
+    float tMin = 0;
+    float tMax = 0;
+    float axisLengthSquared = 0;
+    for (unsigned c = 0; c < channelCount; c++)
+        axisLengthSquared += axis[c] * axis[c];
+    for (unsigned i = 0; i < 16; i++)
+    {
+        float t = 0;
+        for (unsigned c = 0; c < channelCount; c++)
+            t += (pixels[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    
+    for (unsigned c = 0; c < channelCount; c++)
+    {
+        e0[c] = std::min(std::max(mean[c] + axis[c] * tMax / axisLengthSquared, 0.0f), 255.0f);
+        e1[c] = std::min(std::max(mean[c] + axis[c] * tMin / axisLengthSquared, 0.0f), 255.0f);
+    }
+}
+
+// least squares endpoints for the pixels, given where along e0 to e1 each of them is interpolated (0 is e0)
+static void refitEndpoints(const BlockPixels pixels, unsigned channelCount, const float weights[16], float e0[4], float e1[4])
+{
+    float a = 0;
+    float b = 0;
+    float c = 0;
+    float x[4] = {};
+    float y[4] = {};
+    for (unsigned i = 0; i < 16; i++)
+    {
+        const float w = weights[i];
+        a += (1 - w) * (1 - w);
+        b += (1 - w) * w;
+        c += w * w;
+        for (unsigned channel = 0; channel < channelCount; channel++)
+        {
+            x[channel] += (1 - w) * pixels[i][channel];
+            y[channel] += w * pixels[i][channel];
+        }
+    }
+    
+    // all pixels on one index, the endpoints stay as they are
+    const float determinant = a * c - b * b;
+    if (std::fabs(determinant) < 1e-6f)
+        return;
+    
+    for (unsigned channel = 0; channel < channelCount; channel++)
+    {
+        e0[channel] = std::min(std::max((c * x[channel] - b * y[channel]) / determinant, 0.0f), 255.0f);
+        e1[channel] = std::min(std::max((a * y[channel] - b * x[channel]) / determinant, 0.0f), 255.0f);
+    }
+}
+
+static uint16_t toRGB565(const float color[4])
+{
+    const unsigned r = static_cast<unsigned>(color[0] * 31 / 255 + 0.5f);
+    const unsigned g = static_cast<unsigned>(color[1] * 63 / 255 + 0.5f);
+    const unsigned b = static_cast<unsigned>(color[2] * 31 / 255 + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void fromRGB565(uint16_t value, int out[3])
+{
+    const int r = value >> 11;
+    const int g = (value >> 5) & 63;
+    const int b = value & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+// the four color mode, which is also the only one in bc3. returns the squared error and where along the endpoints
+// each pixel ended up
+static float makeBC1ColorBlock(const BlockPixels pixels, uint16_t c0, uint16_t c1, unsigned char out[8], float weights[16])
+{
+    if (c0 < c1)
+        std::swap(c0, c1);
+    
+    int palette[4][3];
+    fromRGB565(c0, palette[0]);
+    fromRGB565(c1, palette[1]);
+    for (unsigned c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    
+    // equal endpoints would be the three color mode, everything is on index 0 then
+    static const float indexWeights[4] = { 0, 1, 1.0f / 3, 2.0f / 3 };
+    const unsigned indexCount = c0 == c1 ? 1 : 4;
+    
+    uint32_t indices = 0;
+    float error = 0;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        unsigned bestIndex = 0;
+        float bestError = std::numeric_limits<float>::max();
+        for (unsigned index = 0; index < indexCount; index++)
+        {
+            float indexError = 0;
+            for (unsigned c = 0; c < 3; c++)
+                indexError += (pixels[i][c] - palette[index][c]) * (pixels[i][c] - palette[index][c]);
+            if (indexError < bestError)
+            {
+                bestError = indexError;
+                bestIndex = index;
+            }
+        }
+        
+        indices |= bestIndex << (2 * i);
+        weights[i] = indexWeights[bestIndex];
+        error += bestError;
+    }
+    
+    out[0] = static_cast<unsigned char>(c0);
+    out[1] = static_cast<unsigned char>(c0 >> 8);
+    out[2] = static_cast<unsigned char>(c1);
+    out[3] = static_cast<unsigned char>(c1 >> 8);
+    for (unsigned i = 0; i < 4; i++)
+        out[4 + i] = static_cast<unsigned char>(indices >> (8 * i));
+    
+    return error;
+}
+
+static void encodeBC1ColorBlock(const BlockPixels pixels, Quality quality, unsigned char out[8])
+{
+    float e0[4];
+    float e1[4];
+    fitEndpoints(pixels, 3, quality, e0, e1);
+    
+    float bestError = std::numeric_limits<float>::max();
+    const unsigned iterations = quality == Quality::High ? 3 : 1;
+    for (unsigned iteration = 0; iteration < iterations; iteration++)
+    {
+        unsigned char block[8];
+        float weights[16];
+        const float error = makeBC1ColorBlock(pixels, toRGB565(e0), toRGB565(e1), block, weights);
+        if (error >= bestError)
+            break;
+        
+        bestError = error;
+        memcpy(out, block, sizeof(block));
+        
+        // the swap in makeBC1ColorBlock flips which endpoint the weights are relative to
+        if (toRGB565(e0) < toRGB565(e1))
+            for (float& weight : weights)
+                weight = 1 - weight;
+        refitEndpoints(pixels, 3, weights, e0, e1);
+    }
+}
+
+// the eight value mode between the block's lowest and highest alpha, with 3 bit indices
+static void encodeBC3AlphaBlock(const BlockPixels pixels, unsigned char out[8])
+{
+    int a0 = 0;
+    int a1 = 255;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        a0 = std::max(a0, static_cast<int>(pixels[i][3]));
+        a1 = std::min(a1, static_cast<int>(pixels[i][3]));
+    }
+    
+    int palette[8] = { a0, a1 };
+    for (int i = 1; i < 7; i++)
+        palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    
+    uint64_t indices = 0;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        unsigned bestIndex = 0;
+        for (unsigned index = 1; index < 8; index++)
+            if (std::fabs(pixels[i][3] - palette[index]) < std::fabs(pixels[i][3] - palette[bestIndex]))
+                bestIndex = index;
+        
+        indices |= uint64_t(bestIndex) << (3 * i);
+    }
+    
+    out[0] = static_cast<unsigned char>(a0);
+    out[1] = static_cast<unsigned char>(a1);
+    for (unsigned i = 0; i < 6; i++)
+        out[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+}
+
+// bc7 blocks are written from the lowest bit up
+class BitWriter
+{
+public:
+    
+    void write(uint32_t value, unsigned bitCount)
+    {
+        for (unsigned i = 0; i < bitCount; i++, myPosition++)
+            myBytes[myPosition / 8] |= static_cast<unsigned char>(((value >> i) & 1) << (myPosition % 8));
+    }
+    
+    unsigned char myBytes[16] = {};
+    unsigned myPosition = 0;
+};
+
+class BitReader
+{
+public:
+    
+    BitReader(const unsigned char bytes[16])
+    : myBytes(bytes)
+    {
+    }
+    
+    uint32_t read(unsigned bitCount)
+    {
+        uint32_t value = 0;
+        for (unsigned i = 0; i < bitCount; i++, myPosition++)
+            value |= uint32_t((myBytes[myPosition / 8] >> (myPosition % 8)) & 1) << i;
+        
+        return value;
+    }
+    
+private:
+    
+    const unsigned char* myBytes;
+    unsigned myPosition = 0;
+};
+
+struct BC7Mode6Endpoints
+{
+    unsigned q[2][4]; // 7 bits per channel
+    unsigned p[2];
+};
+
+// the 7 bit value that with the p-bit below it comes closest to value
+static unsigned quantizeBC7(float value, unsigned p)
+{
+    return static_cast<unsigned>(std::min(std::max((value - p) / 2 + 0.5f, 0.0f), 127.0f));
+}
+
+static float makeBC7Mode6Indices(const BlockPixels pixels, const BC7Mode6Endpoints& endpoints, unsigned indices[16])
+{
+    int palette[16][4];
+    for (unsigned c = 0; c < 4; c++)
+    {
+        const int e0 = static_cast<int>(endpoints.q[0][c] << 1 | endpoints.p[0]);
+        const int e1 = static_cast<int>(endpoints.q[1][c] << 1 | endpoints.p[1]);
+        for (unsigned index = 0; index < 16; index++)
+            palette[index][c] = ((64 - ourBC7Weights[index]) * e0 + ourBC7Weights[index] * e1 + 32) >> 6;
+    }
+    
+    float error = 0;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        float bestError = std::numeric_limits<float>::max();
+        for (unsigned index = 0; index < 16; index++)
+        {
+            float indexError = 0;
+            for (unsigned c = 0; c < 4; c++)
+                indexError += (pixels[i][c] - palette[index][c]) * (pixels[i][c] - palette[index][c]);
+            if (indexError < bestError)
+            {
+                bestError = indexError;
+                indices[i] = index;
+            }
+        }
+        error += bestError;
+    }
+    
+    return error;
+}
+
+static void encodeBC7Mode6Block(const BlockPixels pixels, Quality quality, unsigned char out[16])
+{
+    float e[2][4];
+    fitEndpoints(pixels, 4, quality, e[0], e[1]);
+    
+    BC7Mode6Endpoints best = {};
+    unsigned bestIndices[16] = {};
+    float bestError = std::numeric_limits<float>::max();
+    
+    const unsigned iterations = quality == Quality::High ? 3 : 1;
+    for (unsigned iteration = 0; iteration < iterations; iteration++)
+    {
+        const float iterationStartError = bestError;
+        
+        // high tries all four p-bit pairs against the whole block, the others take the p-bit that suits each
+        // endpoint on its own
+        for (unsigned pBits = 0; pBits < 4; pBits++)
+        {
+            BC7Mode6Endpoints endpoints;
+            for (unsigned endpoint = 0; endpoint < 2; endpoint++)
+            {
+                unsigned p = (pBits >> endpoint) & 1;
+                if (quality != Quality::High)
+                {
+                    float errors[2] = {};
+                    for (unsigned candidate = 0; candidate < 2; candidate++)
+                    {
+                        for (unsigned c = 0; c < 4; c++)
+                        {
+                            const float value = static_cast<float>(quantizeBC7(e[endpoint][c], candidate) << 1 | candidate);
+                            errors[candidate] += (e[endpoint][c] - value) * (e[endpoint][c] - value);
+                        }
+                    }
+                    p = errors[1] < errors[0] ? 1 : 0;
+                }
+                
+                endpoints.p[endpoint] = p;
+                for (unsigned c = 0; c < 4; c++)
+                    endpoints.q[endpoint][c] = quantizeBC7(e[endpoint][c], p);
+            }
+            
+            unsigned indices[16];
+            const float error = makeBC7Mode6Indices(pixels, endpoints, indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                best = endpoints;
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+            
+            if (quality != Quality::High)
+                break;
+        }
+        
+        if (iteration + 1 == iterations || bestError >= iterationStartError)
+            break;
+        
+        float weights[16];
+        for (unsigned i = 0; i < 16; i++)
+            weights[i] = ourBC7Weights[bestIndices[i]] / 64.0f;
+        refitEndpoints(pixels, 4, weights, e[0], e[1]);
+    }
+    
+    // the first pixel's index has an implied top bit of 0, flipping the endpoints makes it so
+    if (bestIndices[0] >= 8)
+    {
+        std::swap(best.q[0], best.q[1]);
+        std::swap(best.p[0], best.p[1]);
+        for (unsigned& index : bestIndices)
+            index = 15 - index;
+    }
+    
+    BitWriter writer;
+    writer.write(1 << 6, 7);
+    for (unsigned c = 0; c < 4; c++)
+    {
+        writer.write(best.q[0][c], 7);
+        writer.write(best.q[1][c], 7);
+    }
+    writer.write(best.p[0], 1);
+    writer.write(best.p[1], 1);
+    for (unsigned i = 0; i < 16; i++)
+        writer.write(bestIndices[i], i == 0 ? 3 : 4);
+    
+    memcpy(out, writer.myBytes, sizeof(writer.myBytes));
+}
+
+static void decodeBC1ColorBlock(const unsigned char in[8], DecodedBlock out)
+{
+    const uint16_t c0 = static_cast<uint16_t>(in[0] | in[1] << 8);
+    const uint16_t c1 = static_cast<uint16_t>(in[2] | in[3] << 8);
+    
+    int palette[4][3];
+    fromRGB565(c0, palette[0]);
+    fromRGB565(c1, palette[1]);
+    for (unsigned c = 0; c < 3; c++)
+    {
+        if (c0 > c1)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    
+    const uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 | uint32_t(in[7]) << 24;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        const unsigned index = (indices >> (2 * i)) & 3;
+        for (unsigned c = 0; c < 3; c++)
+            out[i][c] = static_cast<unsigned char>(palette[index][c]);
+        out[i][3] = 255;
+    }
+}
+
+static void decodeBC3AlphaBlock(const unsigned char in[8], DecodedBlock out)
+{
+    const int a0 = in[0];
+    const int a1 = in[1];
+    
+    int palette[8] = { a0, a1 };
+    if (a0 > a1)
+    {
+        for (int i = 1; i < 7; i++)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    
+    uint64_t indices = 0;
+    for (unsigned i = 0; i < 6; i++)
+        indices |= uint64_t(in[2 + i]) << (8 * i);
+    for (unsigned i = 0; i < 16; i++)
+        out[i][3] = static_cast<unsigned char>(palette[(indices >> (3 * i)) & 7]);
+}
+
+// only mode 6, which is all the encoder writes
+static bool decodeBC7Mode6Block(const unsigned char in[16], DecodedBlock out)
+{
+    BitReader reader(in);
+    if (reader.read(7) != 1 << 6)
+        return false;
+    
+    unsigned q[2][4];
+    for (unsigned c = 0; c < 4; c++)
+    {
+        q[0][c] = reader.read(7);
+        q[1][c] = reader.read(7);
+    }
+    const unsigned p0 = reader.read(1);
+    const unsigned p1 = reader.read(1);
+    
+    for (unsigned i = 0; i < 16; i++)
+    {
+        const unsigned index = reader.read(i == 0 ? 3 : 4);
+        for (unsigned c = 0; c < 4; c++)
+        {
+            const int e0 = static_cast<int>(q[0][c] << 1 | p0);
+            const int e1 = static_cast<int>(q[1][c] << 1 | p1);
+            out[i][c] = static_cast<unsigned char>(((64 - ourBC7Weights[index]) * e0 + ourBC7Weights[index] * e1 + 32) >> 6);
+        }
+    }
+    
+    return true;
+}
+
+static unsigned getBlockSizeBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+// rows of blocks are handed out to the threads one at a time, the calling thread is one of them
+static void forEachBlockRow(unsigned blockRows, unsigned threadCount, const std::function<void(unsigned blockRow)>& function)
+{
+    std::atomic<unsigned> nextRow(0);
+    auto work = [&]()
+    {
+        for (unsigned row = nextRow++; row < blockRows; row = nextRow++)
+            function(row);
+    };
+    
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < threadCount; i++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+static std::vector<unsigned char> encodeLevel(const Level& level, BlockFormat format, Quality quality, unsigned threadCount)
+{
+    const unsigned blocksX = (level.width + 3) / 4;
+    const unsigned blocksY = (level.height + 3) / 4;
+    const unsigned blockSizeBytes = getBlockSizeBytes(format);
+    
+    std::vector<unsigned char> blocks(size_t(blocksX) * blocksY * blockSizeBytes);
+    forEachBlockRow(blocksY, threadCount, [&](unsigned by)
+    {
+        for (unsigned bx = 0; bx < blocksX; bx++)
+        {
+            BlockPixels pixels;
+            fetchBlock(level, bx, by, pixels);
+            
+            unsigned char* block = &blocks[(size_t(by) * blocksX + bx) * blockSizeBytes];
+            if (format == BlockFormat::BC1)
+            {
+                encodeBC1ColorBlock(pixels, quality, block);
+            }
+            else if (format == BlockFormat::BC3)
+            {
+                encodeBC3AlphaBlock(pixels, block);
+                encodeBC1ColorBlock(pixels, quality, block + 8);
+            }
+            else
+            {
+                encodeBC7Mode6Block(pixels, quality, block);
+            }
+        }
+    });
+    
+    return blocks;
+}
+
+// the level as a gpu would sample it, false for blocks the decoder doesn't know
+static bool decodeLevel(const std::vector<unsigned char>& blocks, unsigned width, unsigned height, BlockFormat format, Level& out)
+{
+    const unsigned blocksX = (width + 3) / 4;
+    const unsigned blocksY = (height + 3) / 4;
+    const unsigned blockSizeBytes = getBlockSizeBytes(format);
+    
+    out.width = width;
+    out.height = height;
+    out.rgba.resize(size_t(width) * height * 4);
+    
+    for (unsigned by = 0; by < blocksY; by++)
+    {
+        for (unsigned bx = 0; bx < blocksX; bx++)
+        {
+            const unsigned char* block = &blocks[(size_t(by) * blocksX + bx) * blockSizeBytes];
+            
+            DecodedBlock pixels;
+            if (format == BlockFormat::BC1)
+            {
+                decodeBC1ColorBlock(block, pixels);
+            }
+            else if (format == BlockFormat::BC3)
+            {
+                decodeBC1ColorBlock(block + 8, pixels);
+                decodeBC3AlphaBlock(block, pixels);
+            }
+            else if (!decodeBC7Mode6Block(block, pixels))
+            {
+                return false;
+            }
+            
+            for (unsigned i = 0; i < 16; i++)
+            {
+                const unsigned x = bx * 4 + i % 4;
+                const unsigned y = by * 4 + i / 4;
+                if (x < width && y < height)
+                    memcpy(&out.rgba[(size_t(y) * width + x) * 4], pixels[i], 4);
+            }
+        }
+    }
+    
+    return true;
+}
+
+// over the channels the format stores, bc1 has no alpha
+static double psnr(const Level& a, const Level& b, unsigned channelCount)
+{
+    double squaredError = 0;
+    for (size_t i = 0; i < a.rgba.size(); i += 4)
+        for (unsigned c = 0; c < channelCount; c++)
+            squaredError += double(a.rgba[i + c] - b.rgba[i + c]) * (a.rgba[i + c] - b.rgba[i + c]);
+    
+    const double meanSquaredError = squaredError / (a.rgba.size() / 4 * channelCount);
+    return meanSquaredError > 0 ? 10 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+}
+
+static void writeUInt32(std::ofstream& file, uint32_t value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static bool writeKTX(const std::string& filename, BlockFormat format, const std::vector<Level>& levels, const std::vector<std::vector<unsigned char>>& blocks)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+    
+    static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(identifier), sizeof(identifier));
+    
+    writeUInt32(file, 0x04030201); // endianness, written natively
+    writeUInt32(file, 0); // glType, compressed
+    writeUInt32(file, 1); // glTypeSize
+    writeUInt32(file, 0); // glFormat, compressed
+    writeUInt32(file, format == BlockFormat::BC1 ? KTXFormatBC1 : format == BlockFormat::BC3 ? KTXFormatBC3 : KTXFormatBC7);
+    writeUInt32(file, format == BlockFormat::BC1 ? KTXBaseFormatRGB : KTXBaseFormatRGBA);
+    writeUInt32(file, levels[0].width);
+    writeUInt32(file, levels[0].height);
+    writeUInt32(file, 0); // pixelDepth
+    writeUInt32(file, 0); // numberOfArrayElements
+    writeUInt32(file, 1); // numberOfFaces
+    writeUInt32(file, static_cast<uint32_t>(levels.size()));
+    writeUInt32(file, 0); // bytesOfKeyValueData
+    
+    // blocks are 8 or 16 bytes, so the levels never need padding to 4 bytes
+    for (const std::vector<unsigned char>& levelBlocks : blocks)
+    {
+        writeUInt32(file, static_cast<uint32_t>(levelBlocks.size()));
+        file.write(reinterpret_cast<const char*>(levelBlocks.data()), levelBlocks.size());
+    }
+    
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char* argv[])
+{
+    BlockFormat format = BlockFormat::BC7;
+    Quality quality = Quality::Normal;
+    unsigned threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    double minPSNR = 0;
+    std::vector<std::string> filenames;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        std::string value = hasValue ? argv[i + 1] : "";
+        if (arg == "--format" && (value == "bc1" || value == "bc3" || value == "bc7"))
+        {
+            format = value == "bc1" ? BlockFormat::BC1 : value == "bc3" ? BlockFormat::BC3 : BlockFormat::BC7;
+            i++;
+        }
+        else if (arg == "--quality" && (value == "fast" || value == "normal" || value == "high"))
+        {
+            quality = value == "fast" ? Quality::Fast : value == "normal" ? Quality::Normal : Quality::High;
+            i++;
+        }
+        else if (arg == "--threads" && hasValue)
+            threadCount = std::max(std::atoi(argv[++i]), 1);
+        else if (arg == "--min-psnr" && hasValue)
+            minPSNR = std::atof(argv[++i]);
+        else if (arg.compare(0, 2, "--") != 0)
+            filenames.push_back(arg);
+        else
+        {
+            filenames.clear();
+            break;
+        }
+    }
+    
+    if (filenames.size() != 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [--format bc1|bc3|bc7] [--quality fast|normal|high] [--threads <n>] [--min-psnr <dB>] <input.png> <output.ktx>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    // the same chain the app builds when it loads the PNG itself, filtered in linear light like its textures
+    std::vector<Level> levels;
+    try
+    {
+        PNGImage image(filenames[0].c_str(), true, true);
+        for (const PNGImage::MipLevel& mipLevel : image.myMipLevels)
+        {
+            Level level;
+            level.width = mipLevel.width;
+            level.height = mipLevel.height;
+            const unsigned char* pixels = &image.myImage[mipLevel.offset];
+            level.rgba.assign(pixels, pixels + size_t(level.width) * level.height * 4);
+            levels.push_back(level);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "decoder error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<unsigned char>> blocks;
+    for (const Level& level : levels)
+        blocks.push_back(encodeLevel(level, format, quality, threadCount));
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    bool belowMinPSNR = false;
+    size_t pixelCount = 0;
+    size_t compressedBytes = 0;
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        Level decoded;
+        if (!decodeLevel(blocks[i], levels[i].width, levels[i].height, format, decoded))
+        {
+            std::cerr << "level " << i << " doesn't decode" << std::endl;
+            return EXIT_FAILURE;
+        }
+        
+        const double levelPSNR = psnr(levels[i], decoded, format == BlockFormat::BC1 ? 3 : 4);
+        belowMinPSNR |= levelPSNR < minPSNR;
+        pixelCount += size_t(levels[i].width) * levels[i].height;
+        compressedBytes += blocks[i].size();
+        std::printf("level %2zu: %4ux%-4u %8zu bytes, psnr %.2f dB\n", i, levels[i].width, levels[i].height, blocks[i].size(), levelPSNR);
+    }
+    
+    std::printf("%zu bytes instead of %zu, encoded in %.1f ms on %u threads, %.1f Mpixels/s\n", compressedBytes, pixelCount * 4, seconds * 1000.0, threadCount, pixelCount / seconds / 1e6);
+    
+    if (!writeKTX(filenames[1], format, levels, blocks))
+    {
+        std::cerr << "failed to write " << filenames[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if (belowMinPSNR)
+    {
+        std::cerr << "psnr below " << minPSNR << " dB" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
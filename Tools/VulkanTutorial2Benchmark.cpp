@@ -0,0 +1,481 @@
+// Headless frame throughput benchmark for VulkanTutorial2.
+//
+// Creates the app without a window, so it renders into offscreen images, then draws a number of frames and
+// reports CPU frame time (the time spent in vktut2_drawframe, including waiting for a free frame in flight),
+// GPU frame time from timestamp queries, and frames per second over the whole run including the final wait.
+// Runs on anything with a Vulkan driver, including a software ICD like lavapipe or SwiftShader, e.g.
+// VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json.
+//
+// usage: VulkanTutorial2Benchmark [--resources <dir>] [--width <pixels>] [--height <pixels>] [--frames <n>]
+//                                 [--warmup <n>] [--png <file>] [--pipeline-cache <file>] [--draws <n>]
+//                                 [--threads <n>] [--thread-scaling] [--sprites <n>] [--gpu-culling] [--textures <n>]
+//                                 [--bindless] [--uncompressed] [--loose-files] [--cold-file-cache]
+//                                 [--texture-cache <dir>] [--texture-budget <megabytes>] [--frames-in-flight <n>]
+//                                 [--latency-sweep] [--gpu-profile <file>]
+//
+// The resource directory needs vert.spv, frag.spv, frag_bindless.spv and cull.spv, which VulkanTutorial2/ has, and
+// fractal_tree.png, which it doesn't: the Xcode project expects one next to the shaders, but the image isn't checked
+// in. Any 8 or 16 bit PNG saved under that name works, e.g. a 512x512 RGBA one. Without it the app reports that the
+// texture failed to load and everything is benchmarked with the 1x1 grey placeholder, which isn't representative.
+// With --png, the last frame is written out for a quick look at what was benchmarked.
+// With --pipeline-cache, the cache file is deleted and the app is created twice, once with a cold and once with a
+// warm pipeline cache, and both startup times are reported. Without it, the user's pipeline cache is used as is.
+// --draws splits each frame into that many draw calls and --threads records them on that many threads.
+// With --thread-scaling, the benchmark runs once for every thread count from 1 to --threads (default: the number of
+// cores) with 100000 draws unless --draws says otherwise, to show where recording stops being the bottleneck.
+// --sprites draws that many moving sprites instead of the single quad, and reports how many sprite instances were
+// streamed and drawn per millisecond of cpu and gpu frame time. The sprites move within a world larger than the view,
+// and --gpu-culling culls them against the view in a compute pass before drawing the ones left with indirect draws.
+// --textures spreads the sprites over that many textures, which takes a descriptor set bind and a draw per texture,
+// unless --bindless puts them all in one descriptor array that the sprites index into.
+// A cooked fractal_tree.bc7.ktx (or .bc3.ktx, .bc1.ktx, .astc.ktx) in the resource directory is used instead of the
+// PNG, see Tools/TextureCooker.cpp, unless --uncompressed says otherwise.
+// An assets.pack in the resource directory (see Tools/AssetPackBuilder.cpp) is mapped and the shaders and textures it
+// has are taken from there, unless --loose-files says otherwise. With --cold-file-cache, the resource directory's files
+// are dropped from the file cache and the app is created twice, like with --pipeline-cache, to show the startup time
+// with and without reading them from the disk. Dropping them only works where there is posix_fadvise, i.e. not on macOS.
+// --texture-cache keeps decoded textures in that directory instead of the user's cache directory, and empties it
+// first, so the first create decodes the PNG and the second maps what the first one cached.
+// Textures load on background threads while the app draws grey placeholders. Before the warmup, frame 0 is drawn until
+// they are all uploaded, and how long that took after startup is reported along with how many frames were drawn.
+// --texture-budget streams the textures' mip levels in and out to stay within that much memory, and reports how much
+// they had at the end and how many levels were loaded and evicted. Try it with --sprites and --textures, with a budget
+// smaller than what all textures take with all of their levels.
+// Every run reports the latency from where a frame reads its input until the gpu has finished it, mean and p99, which
+// --frames-in-flight trades against throughput (1 to 4, 2 by default). --latency-sweep runs once for every depth from
+// 1 to 4 to show the trade. Presenting isn't included, the present mode and swap chain image count only apply to the
+// windowed app, see vktut2_set_present_mode and vktut2_set_swap_chain_images.
+// The gpu time is also broken down into scopes like the render pass and the draws, with min, mean and p99 over the
+// last 256 frames each. --gpu-profile writes them to a CSV file too, to track them across builds on a benchmark host.
+//
+// Outside of Xcode: c++ -O2 -std=gnu++14 -IVulkanTutorial2 -I<VulkanMemoryAllocator>/src Tools/VulkanTutorial2Benchmark.cpp
+//                   VulkanTutorial2/VulkanTutorial2.cpp VulkanTutorial2/lodepng.cpp -lvulkan -lpthread
+
+#include "VulkanTutorial2.hpp"
+
+#include "lodepng.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static double percentileMs(std::vector<double>& seconds, double p)
+{
+    if (seconds.empty())
+        return 0;
+    
+    std::sort(seconds.begin(), seconds.end());
+    size_t rank = static_cast<size_t>(p * (seconds.size() - 1) + 0.5);
+    return seconds[rank] * 1000.0;
+}
+
+// drops the files' clean pages from the file cache, so that the next create reads them from the disk again
+static bool evictFromFileCache(const std::string& directory)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return false;
+    
+    while (const dirent* entry = readdir(dir))
+    {
+        int file = open((directory + "/" + entry->d_name).c_str(), O_RDONLY);
+        if (file < 0)
+            continue;
+        
+        // written pages have to reach the disk before they can be dropped
+        fdatasync(file);
+        posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+        close(file);
+    }
+    
+    closedir(dir);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// what the app cached in there, so that the next create decodes its textures again
+static void removeCachedTextures(const std::string& directory)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        return;
+    
+    while (const dirent* entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name.size() > 8 && name.compare(name.size() - 8, 8, ".texture") == 0)
+            std::remove((directory + "/" + name).c_str());
+    }
+    
+    closedir(dir);
+}
+
+// one line per gpu scope, and the same as CSV into csvFilename unless it is empty
+static bool printGpuScopes(const std::string& csvFilename)
+{
+    FILE* csv = nullptr;
+    if (!csvFilename.empty())
+    {
+        csv = std::fopen(csvFilename.c_str(), "w");
+        if (csv == nullptr)
+            return false;
+        
+        std::fprintf(csv, "scope,frames,min_ms,mean_ms,p99_ms\n");
+    }
+    
+    for (unsigned scope = 0; scope < vktut2_gpu_scope_count(); scope++)
+    {
+        const char* name;
+        double minMilliseconds, meanMilliseconds, p99Milliseconds;
+        unsigned frameCount;
+        vktut2_gpu_scope_stats(scope, &name, &minMilliseconds, &meanMilliseconds, &p99Milliseconds, &frameCount);
+        if (frameCount == 0)
+            continue;
+        
+        std::printf("gpu %s: min %.3f ms, mean %.3f ms, p99 %.3f ms over the last %u frames\n", name, minMilliseconds, meanMilliseconds, p99Milliseconds, frameCount);
+        if (csv != nullptr)
+            std::fprintf(csv, "%s,%u,%.6f,%.6f,%.6f\n", name, frameCount, minMilliseconds, meanMilliseconds, p99Milliseconds);
+    }
+    
+    return csv == nullptr || std::fclose(csv) == 0;
+}
+
+struct FrameStats
+{
+    double cpuMeanMs;
+    double cpuP50Ms;
+    double cpuP90Ms;
+    double cpuP99Ms;
+    double gpuMeanMs;
+    unsigned gpuFrames;
+    double fps;
+    double textureLoadMs;
+    unsigned placeholderFrames;
+    double latencyMeanMs;
+    double latencyP99Ms;
+};
+
+// draws frame 0 until the textures loading in the background are uploaded, so that the frames measured afterwards
+// show them. returns how long that took
+static double waitForTextures(unsigned& outPlaceholderFrames)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    outPlaceholderFrames = 0;
+    while (vktut2_pending_texture_loads() > 0)
+    {
+        vktut2_drawframe(0);
+        outPlaceholderFrames++;
+    }
+    
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// waits for the textures, draws warmup frames, then measures frames more
+static FrameStats drawFrames(unsigned warmup, unsigned frames)
+{
+    unsigned placeholderFrames;
+    double textureLoadSeconds = waitForTextures(placeholderFrames);
+    
+    unsigned frameIndex = 0;
+    for (unsigned i = 0; i < warmup; i++)
+        vktut2_drawframe(frameIndex++);
+    
+    vktut2_finish();
+    
+    double warmupGpuMilliseconds;
+    unsigned warmupGpuFrames;
+    vktut2_gpu_stats(&warmupGpuMilliseconds, &warmupGpuFrames);
+    
+    // the latency stats start over with every call
+    double latencyMeanMs, latencyP99Ms;
+    unsigned latencyFrames;
+    vktut2_latency_stats(&latencyMeanMs, &latencyP99Ms, &latencyFrames);
+    
+    std::vector<double> cpuSeconds;
+    cpuSeconds.reserve(frames);
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < frames; i++)
+    {
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        vktut2_drawframe(frameIndex++);
+        cpuSeconds.push_back(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameStart).count());
+    }
+    vktut2_finish();
+    double totalSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    
+    double gpuMilliseconds;
+    unsigned gpuFrames;
+    vktut2_gpu_stats(&gpuMilliseconds, &gpuFrames);
+    gpuMilliseconds -= warmupGpuMilliseconds;
+    gpuFrames -= warmupGpuFrames;
+    
+    vktut2_latency_stats(&latencyMeanMs, &latencyP99Ms, &latencyFrames);
+    
+    double cpuTotalSeconds = 0;
+    for (double seconds : cpuSeconds)
+        cpuTotalSeconds += seconds;
+    
+    FrameStats stats;
+    stats.cpuMeanMs = cpuTotalSeconds * 1000.0 / frames;
+    stats.cpuP50Ms = percentileMs(cpuSeconds, 0.5);
+    stats.cpuP90Ms = percentileMs(cpuSeconds, 0.9);
+    stats.cpuP99Ms = percentileMs(cpuSeconds, 0.99);
+    stats.gpuMeanMs = gpuFrames > 0 ? gpuMilliseconds / gpuFrames : 0;
+    stats.gpuFrames = gpuFrames;
+    stats.fps = frames / totalSeconds;
+    stats.textureLoadMs = textureLoadSeconds * 1000.0;
+    stats.placeholderFrames = placeholderFrames;
+    stats.latencyMeanMs = latencyMeanMs;
+    stats.latencyP99Ms = latencyP99Ms;
+    return stats;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string resources = "VulkanTutorial2";
+    std::string pngFilename;
+    std::string pipelineCacheFilename;
+    std::string textureCacheDirectory;
+    std::string gpuProfileFilename;
+    int width = 1280;
+    int height = 720;
+    unsigned frames = 1000;
+    unsigned warmup = 60;
+    unsigned draws = 0;
+    unsigned threads = 0;
+    bool threadScaling = false;
+    unsigned sprites = 0;
+    bool gpuCulling = false;
+    unsigned textures = 0;
+    bool bindless = false;
+    bool uncompressed = false;
+    bool looseFiles = false;
+    bool coldFileCache = false;
+    unsigned textureBudget = 0;
+    unsigned framesInFlight = 0;
+    bool latencySweep = false;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--resources" && hasValue)
+            resources = argv[++i];
+        else if (arg == "--width" && hasValue)
+            width = std::atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)
+            height = std::atoi(argv[++i]);
+        else if (arg == "--frames" && hasValue)
+            frames = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue)
+            warmup = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--png" && hasValue)
+            pngFilename = argv[++i];
+        else if (arg == "--pipeline-cache" && hasValue)
+            pipelineCacheFilename = argv[++i];
+        else if (arg == "--texture-cache" && hasValue)
+            textureCacheDirectory = argv[++i];
+        else if (arg == "--draws" && hasValue)
+            draws = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--threads" && hasValue)
+            threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--thread-scaling")
+            threadScaling = true;
+        else if (arg == "--sprites" && hasValue)
+            sprites = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--gpu-culling")
+            gpuCulling = true;
+        else if (arg == "--textures" && hasValue)
+            textures = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--bindless")
+            bindless = true;
+        else if (arg == "--uncompressed")
+            uncompressed = true;
+        else if (arg == "--loose-files")
+            looseFiles = true;
+        else if (arg == "--cold-file-cache")
+            coldFileCache = true;
+        else if (arg == "--texture-budget" && hasValue)
+            textureBudget = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--frames-in-flight" && hasValue)
+            framesInFlight = static_cast<unsigned>(std::atoi(argv[++i]));
+        else if (arg == "--latency-sweep")
+            latencySweep = true;
+        else if (arg == "--gpu-profile" && hasValue)
+            gpuProfileFilename = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--resources <dir>] [--width <pixels>] [--height <pixels>] [--frames <n>] [--warmup <n>] [--png <file>] [--pipeline-cache <file>] [--draws <n>] [--threads <n>] [--thread-scaling] [--sprites <n>] [--gpu-culling] [--textures <n>] [--bindless] [--uncompressed] [--loose-files] [--cold-file-cache] [--texture-cache <dir>] [--texture-budget <megabytes>] [--frames-in-flight <n>] [--latency-sweep] [--gpu-profile <file>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    
+    if (width <= 0 || height <= 0 || frames == 0)
+    {
+        std::cerr << "invalid size or frame count" << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    if (sprites > 0)
+        vktut2_set_sprite_count(sprites);
+    vktut2_set_gpu_culling(gpuCulling);
+    if (textures > 0)
+        vktut2_set_texture_count(textures);
+    vktut2_set_bindless_textures(bindless);
+    vktut2_set_compressed_textures(!uncompressed);
+    vktut2_set_asset_pack(!looseFiles);
+    vktut2_set_texture_budget(textureBudget);
+    if (framesInFlight > 0)
+        vktut2_set_frames_in_flight(framesInFlight);
+    
+    if (threadScaling)
+    {
+        if (draws == 0)
+            draws = 100000;
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        
+        vktut2_set_draw_count(draws);
+        
+        std::printf("%u frames at %dx%d, %u draws per frame\n", frames, width, height, draws);
+        for (unsigned threadCount = 1; threadCount <= threads; threadCount++)
+        {
+            vktut2_set_recording_threads(threadCount);
+            if (vktut2_create_headless(width, height, resources.c_str()) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+            
+            FrameStats stats = drawFrames(warmup, frames);
+            std::printf("%2u threads: cpu frame time mean %.3f ms, p50 %.3f ms, p99 %.3f ms, gpu frame time mean %.3f ms, fps %.1f\n", threadCount, stats.cpuMeanMs, stats.cpuP50Ms, stats.cpuP99Ms, stats.gpuMeanMs, stats.fps);
+            
+            vktut2_destroy();
+        }
+        
+        return EXIT_SUCCESS;
+    }
+    
+    if (draws > 0)
+        vktut2_set_draw_count(draws);
+    if (threads > 0)
+        vktut2_set_recording_threads(threads);
+    
+    if (latencySweep)
+    {
+        std::printf("%u frames at %dx%d\n", frames, width, height);
+        for (unsigned frameCount = 1; frameCount <= 4; frameCount++)
+        {
+            vktut2_set_frames_in_flight(frameCount);
+            if (vktut2_create_headless(width, height, resources.c_str()) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+            
+            FrameStats stats = drawFrames(warmup, frames);
+            std::printf("%u frames in flight: latency mean %.3f ms, p99 %.3f ms, cpu frame time mean %.3f ms, gpu frame time mean %.3f ms, fps %.1f\n", frameCount, stats.latencyMeanMs, stats.latencyP99Ms, stats.cpuMeanMs, stats.gpuMeanMs, stats.fps);
+            
+            vktut2_destroy();
+        }
+        
+        return EXIT_SUCCESS;
+    }
+    
+    // what the first create starts without
+    std::string coldCaches;
+    if (!pipelineCacheFilename.empty())
+        coldCaches = "pipeline cache";
+    if (!textureCacheDirectory.empty())
+        coldCaches += coldCaches.empty() ? "texture cache" : ", texture cache";
+    if (coldFileCache)
+        coldCaches += coldCaches.empty() ? "file cache" : ", file cache";
+    
+    double coldStartupSeconds = 0;
+    double coldTextureLoadSeconds = 0;
+    if (!coldCaches.empty())
+    {
+        if (!pipelineCacheFilename.empty())
+        {
+            vktut2_set_pipeline_cache_path(pipelineCacheFilename.c_str());
+            std::remove(pipelineCacheFilename.c_str());
+        }
+        
+        if (!textureCacheDirectory.empty())
+        {
+            vktut2_set_texture_cache_path(textureCacheDirectory.c_str());
+            removeCachedTextures(textureCacheDirectory);
+        }
+        
+        if (coldFileCache && !evictFromFileCache(resources))
+            std::cerr << "can't drop " << resources << " from the file cache, the cold startup reads it from the cache" << std::endl;
+        
+        auto coldStart = std::chrono::high_resolution_clock::now();
+        if (vktut2_create_headless(width, height, resources.c_str()) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        coldStartupSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - coldStart).count();
+        
+        // the textures are only cached once they are decoded
+        unsigned placeholderFrames;
+        coldTextureLoadSeconds = waitForTextures(placeholderFrames);
+        
+        // writes the pipeline cache, if there is one, for the next create. the texture cache is already written
+        vktut2_destroy();
+    }
+    
+    auto startupStart = std::chrono::high_resolution_clock::now();
+    if (vktut2_create_headless(width, height, resources.c_str()) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    double startupSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startupStart).count();
+    
+    FrameStats stats = drawFrames(warmup, frames);
+    
+    std::printf("%u frames at %dx%d\n", frames, width, height);
+    if (!coldCaches.empty())
+        std::printf("startup: cold %s %.3f ms, warm %s %.3f ms\n", coldCaches.c_str(), coldStartupSeconds * 1000.0, coldCaches.c_str(), startupSeconds * 1000.0);
+    else
+        std::printf("startup: %.3f ms\n", startupSeconds * 1000.0);
+    if (!coldCaches.empty())
+        std::printf("textures loaded after startup: cold %s %.3f ms, warm %s %.3f ms with %u frames drawn meanwhile\n", coldCaches.c_str(), coldTextureLoadSeconds * 1000.0, coldCaches.c_str(), stats.textureLoadMs, stats.placeholderFrames);
+    else
+        std::printf("textures loaded after startup: %.3f ms with %u frames drawn meanwhile\n", stats.textureLoadMs, stats.placeholderFrames);
+    std::printf("cpu frame time: mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms\n", stats.cpuMeanMs, stats.cpuP50Ms, stats.cpuP90Ms, stats.cpuP99Ms);
+    if (stats.gpuFrames > 0)
+        std::printf("gpu frame time: mean %.3f ms over %u frames\n", stats.gpuMeanMs, stats.gpuFrames);
+    else
+        std::printf("gpu frame time: no timestamp support\n");
+    std::printf("fps: %.1f\n", stats.fps);
+    std::printf("latency: mean %.3f ms, p99 %.3f ms\n", stats.latencyMeanMs, stats.latencyP99Ms);
+    if (!printGpuScopes(gpuProfileFilename))
+        std::cerr << "failed to write " << gpuProfileFilename << std::endl;
+    if (sprites > 0)
+        std::printf("sprites: %u%s%s, %.1f instances per ms of cpu frame time, %.1f per ms of gpu frame time\n", sprites, gpuCulling ? " culled on the gpu" : "", bindless ? " with bindless textures" : "", sprites / stats.cpuMeanMs, stats.gpuFrames > 0 ? sprites / stats.gpuMeanMs : 0.0);
+    if (textureBudget > 0)
+    {
+        double residentMegabytes, budgetMegabytes;
+        unsigned loadedLevels, evictedLevels;
+        vktut2_texture_stats(&residentMegabytes, &budgetMegabytes, &loadedLevels, &evictedLevels);
+        std::printf("textures: %.1f MB resident of a %.1f MB budget, %u mip levels loaded, %u evicted\n", residentMegabytes, budgetMegabytes, loadedLevels, evictedLevels);
+    }
+    
+    if (!pngFilename.empty())
+    {
+        std::vector<unsigned char> rgba(size_t(width) * height * 4);
+        vktut2_read_frame(rgba.data());
+        
+        unsigned error = lodepng::encode(pngFilename, rgba, static_cast<unsigned>(width), static_cast<unsigned>(height));
+        if (error)
+            std::cerr << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    }
+    
+    vktut2_destroy();
+    
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// the layout of the asset packs that Tools/AssetPackBuilder.cpp writes and the app maps into memory. an AssetPackHeader
+// at the start, then its table of contents, then the payloads, each starting at a multiple of AssetPackAlignment so
+// that they can be used in place. little endian, like every platform the app runs on
+
+enum
+{
+    AssetPackMagic = 0x31504B56, // "VKP1"
+    AssetPackVersion = 1,
+    AssetPackAlignment = 256, // SPIR-V words, texel blocks and any optimalBufferCopyOffsetAlignment seen so far
+    AssetPackMaxMipLevels = 16, // 32768 x 32768
+};
+
+enum class AssetPackEntryType : uint32_t
+{
+    SPIRV = 1,
+    Texture2D = 2, // all mip levels, tightly packed one after the other like vkCmdCopyBufferToImage takes them
+};
+
+struct AssetPackHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t entrySizeBytes; // sizeof(AssetPackEntry)
+    uint64_t entriesOffset; // entryCount entries, sorted by nameHash
+};
+
+struct AssetPackEntry
+{
+    uint64_t nameHash; // hashAssetName of the file the asset was built from, e.g. "fractal_tree.png"
+    uint64_t offset;
+    uint64_t size;
+    AssetPackEntryType type;
+    uint32_t format; // VkFormat, textures only
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t texelBlockSizeBytes; // of a pixel, or of a whole block for block compressed formats
+    uint64_t mipOffsets[AssetPackMaxMipLevels]; // from offset
+};
+
+static_assert(sizeof(AssetPackHeader) == 24, "asset pack header layout changed");
+static_assert(sizeof(AssetPackEntry) == 176, "asset pack entry layout changed");
+
+// 64 bit FNV-1a, collisions are rejected when the pack is built
+inline uint64_t hashAssetName(const char* name)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char* c = reinterpret_cast<const unsigned char*>(name); *c; c++)
+        hash = (hash ^ *c) * 1099511628211ull;
+    
+    return hash;
+}
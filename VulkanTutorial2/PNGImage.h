@@ -0,0 +1,339 @@
+#pragma once
+
+#include "lodepng.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+// a PNG decoded with lodepng, optionally with its full mip chain. shared by the app and the tools that prepare its
+// textures offline, so that every mip level is filtered the same way wherever it is built
+
+struct PNGImage
+{
+    enum class PixelFormat
+    {
+        RGBA8, // R8G8B8A8_UNORM
+        RGBA16, // R16G16B16A16_UNORM, native endian
+        RGBA16F, // R16G16B16A16_SFLOAT
+    };
+    
+    struct MipLevel
+    {
+        size_t offset;
+        unsigned width;
+        unsigned height;
+    };
+    
+    // with generateMips the full chain is built in one pass over the decoded rows, each level consuming the rows
+    // of the one above while they are still in cache, and packed into myImage level after level, with
+    // myMipLevels as the offset table for the buffer to image copies.
+    // sRGB content is averaged in linear light, anything else (normal maps, masks) as stored.
+    // format16 is what PNGs with 16 bit channels are decoded to, 8 bit PNGs are always RGBA8.
+    PNGImage(const char* filename, bool generateMips = false, bool sRGB = false, PixelFormat format16 = PixelFormat::RGBA8)
+    : mySRGB(sRGB)
+    {
+        std::vector<unsigned char> png;
+        unsigned error = lodepng::load_file(png, filename);
+        
+        decode(png.data(), png.size(), error, generateMips, format16);
+    }
+    
+    // the same for a PNG file that is already in memory
+    PNGImage(const unsigned char* png, size_t pngSize, bool generateMips = false, bool sRGB = false, PixelFormat format16 = PixelFormat::RGBA8)
+    : mySRGB(sRGB)
+    {
+        decode(png, pngSize, 0, generateMips, format16);
+    }
+    
+    std::vector<unsigned char> myImage;
+    std::vector<MipLevel> myMipLevels;
+    unsigned myWidth = 0;
+    unsigned myHeight = 0;
+    PixelFormat myFormat = PixelFormat::RGBA8;
+    unsigned myPixelSizeBytes = 4;
+    
+#if defined(LODEPNG_COMPILE_STATS)
+    LodePNGStats myStats; // of this decode only
+#endif
+    
+    // what RGBA16F is made from, in place. also for RGBA16 texels that were stored ahead of time
+    static void unorm16ToHalf(uint16_t* data, size_t count)
+    {
+        static const HalfTable table;
+        
+        for (size_t i = 0; i < count; i++)
+            data[i] = table.fromUnorm16[data[i]];
+    }
+
+private:
+    
+    // error is from loading the file, and reported like a decoder error. decoding runs on the loader threads,
+    // so a broken PNG throws for the caller to report instead of taking the process down
+    void decode(const unsigned char* png, size_t pngSize, unsigned error, bool generateMips, PixelFormat format16)
+    {
+        lodepng::State state;
+#if defined(LODEPNG_COMPILE_STATS)
+        lodepng_stats_init(&myStats);
+        state.stats = &myStats;
+#endif
+        if (!error)
+            error = lodepng_inspect(&myWidth, &myHeight, &state, png, pngSize);
+        
+        if (!error && state.info_png.color.bitdepth == 16 && format16 != PixelFormat::RGBA8)
+        {
+            myFormat = format16;
+            myPixelSizeBytes = 8;
+            state.info_raw.bitdepth = 16;
+        }
+        
+        if (!error)
+            error = lodepng::decode(myImage, myWidth, myHeight, state, png, pngSize);
+        
+        if (error)
+            throw std::runtime_error(lodepng_error_text(error));
+        
+        // lodepng's 16 bit output is big endian like the PNG itself
+        if (myPixelSizeBytes == 8)
+            swapBytes16(myImage.data(), myImage.size() / 2);
+        
+        myMipLevels.push_back({ 0, myWidth, myHeight });
+        if (generateMips)
+        {
+            size_t size = myImage.size();
+            for (unsigned width = myWidth, height = myHeight; width > 1 || height > 1;)
+            {
+                width = std::max(width / 2, 1u);
+                height = std::max(height / 2, 1u);
+                myMipLevels.push_back({ size, width, height });
+                size += size_t(width) * height * myPixelSizeBytes;
+            }
+            
+            // level 0 is already in place at offset 0
+            myImage.resize(size);
+            
+            for (unsigned y = 0; y < myHeight; y++)
+                rowFinished(0, y);
+        }
+        
+        // halfs have the same size as the unorm values, so the whole chain converts in place
+        if (myFormat == PixelFormat::RGBA16F)
+            unorm16ToHalf(reinterpret_cast<uint16_t*>(myImage.data()), myImage.size() / 2);
+    }
+    
+    // each finished pair of rows in a level (or triple, for an odd height) immediately produces one row in the next
+    void rowFinished(unsigned level, unsigned y)
+    {
+        if (level + 1 == myMipLevels.size())
+            return;
+        
+        const MipLevel& src = myMipLevels[level];
+        const MipLevel& dst = myMipLevels[level + 1];
+        
+        float rowWeights[3];
+        const unsigned rowCount = getBoxWeights(src.height, dst.height, 0, rowWeights);
+        if (rowCount > 1 && (y < rowCount - 1 || (y + 1) % 2 != rowCount % 2))
+            return;
+        
+        const unsigned dstY = rowCount > 1 ? (y + 1 - rowCount) / 2 : 0;
+        if (myPixelSizeBytes == 8)
+            downsampleLevelRow<uint16_t>(src, dst, dstY, rowCount);
+        else
+            downsampleLevelRow<unsigned char>(src, dst, dstY, rowCount);
+        
+        rowFinished(level + 1, dstY);
+    }
+    
+    // row y of a level, as channels of the texel type
+    template <typename T>
+    T* getRow(const MipLevel& level, unsigned y)
+    {
+        return reinterpret_cast<T*>(&myImage[level.offset + size_t(y) * level.width * myPixelSizeBytes]);
+    }
+    
+    // row dstY of dst from the rowCount rows of src under it
+    template <typename T>
+    void downsampleLevelRow(const MipLevel& src, const MipLevel& dst, unsigned dstY, unsigned rowCount)
+    {
+        T* out = getRow<T>(dst, dstY);
+        const T* rows[3] = {};
+        for (unsigned i = 0; i < rowCount; i++)
+            rows[i] = getRow<T>(src, 2 * dstY + i);
+        
+        if (rowCount == 3 || (src.width > 1 && (src.width & 1)))
+        {
+            downsampleRowOdd(out, rows, rowCount, src, dst, dstY);
+            return;
+        }
+        
+        // a width or height of 1 pairs each pixel with itself
+        const unsigned dx = src.width > 1 ? 4 : 0;
+        const T* row1 = rows[rowCount - 1];
+        
+        // only 8 bit content is ever sRGB, the casts are no-ops there
+        if (mySRGB && sizeof(T) == 1)
+            downsampleRowSRGB(reinterpret_cast<unsigned char*>(out), reinterpret_cast<const unsigned char*>(rows[0]), reinterpret_cast<const unsigned char*>(row1), dst.width, dx);
+        else
+            downsampleRow(out, rows[0], row1, dst.width, dx);
+    }
+    
+    // weights of the source texels (or rows) that destination texel i covers, returns how many there are.
+    // an odd size is the exact box filter over 3 texels, so the edges are kept and the image does not shift
+    static unsigned getBoxWeights(unsigned srcSize, unsigned dstSize, unsigned i, float weights[3])
+    {
+        if (srcSize == 1)
+        {
+            weights[0] = 1.0f;
+            return 1;
+        }
+        
+        if (!(srcSize & 1))
+        {
+            weights[0] = weights[1] = 0.5f;
+            return 2;
+        }
+        
+        const float n = static_cast<float>(dstSize);
+        weights[0] = (n - i) / srcSize;
+        weights[1] = n / srcSize;
+        weights[2] = (i + 1.0f) / srcSize;
+        return 3;
+    }
+    
+    // the general case for odd sizes, weighted in float and in linear light for sRGB content
+    template <typename T>
+    void downsampleRowOdd(T* out, const T* const* rows, unsigned rowCount, const MipLevel& src, const MipLevel& dst, unsigned dstY) const
+    {
+        static const SRGBTables tables;
+        
+        const bool sRGB = mySRGB && sizeof(T) == 1;
+        const float scale = std::numeric_limits<T>::max();
+        
+        float rowWeights[3];
+        getBoxWeights(src.height, dst.height, dstY, rowWeights);
+        
+        for (unsigned x = 0; x < dst.width; x++, out += 4)
+        {
+            float columnWeights[3];
+            const unsigned columnCount = getBoxWeights(src.width, dst.width, x, columnWeights);
+            const unsigned x0 = src.width > 1 ? 2 * x : 0;
+            
+            for (unsigned c = 0; c < 4; c++)
+            {
+                // alpha is always linear
+                const bool linearize = sRGB && c < 3;
+                
+                float sum = 0.0f;
+                for (unsigned r = 0; r < rowCount; r++)
+                    for (unsigned k = 0; k < columnCount; k++)
+                    {
+                        const T value = rows[r][(x0 + k) * 4 + c];
+                        sum += rowWeights[r] * columnWeights[k] * (linearize ? tables.toLinear[value] : value / scale);
+                    }
+                
+                if (linearize)
+                    out[c] = static_cast<T>(tables.fromLinear[static_cast<unsigned>(std::min(std::max(sum, 0.0f), 1.0f) * (SRGBTables::FromLinearSize - 1) + 0.5f)]);
+                else
+                    out[c] = static_cast<T>(std::min(std::max(sum, 0.0f), 1.0f) * scale + 0.5f);
+            }
+        }
+    }
+    
+    // dx is the distance to the horizontally neighbouring pixel, in channels
+    template <typename T>
+    static void downsampleRow(T* out, const T* row0, const T* row1, unsigned width, unsigned dx)
+    {
+        // plain loop over all channels so that it vectorizes
+        for (unsigned x = 0; x < width; x++, row0 += 2 * dx, row1 += 2 * dx, out += 4)
+            for (unsigned c = 0; c < 4; c++)
+                out[c] = static_cast<T>((uint32_t(row0[c]) + row0[c + dx] + row1[c] + row1[c + dx] + 2) >> 2);
+    }
+    
+    static void downsampleRowSRGB(unsigned char* out, const unsigned char* row0, const unsigned char* row1, unsigned width, unsigned dx)
+    {
+        static const SRGBTables tables;
+        
+        for (unsigned x = 0; x < width; x++, row0 += 2 * dx, row1 += 2 * dx, out += 4)
+        {
+            for (unsigned c = 0; c < 3; c++)
+            {
+                float sum = tables.toLinear[row0[c]] + tables.toLinear[row0[c + dx]] + tables.toLinear[row1[c]] + tables.toLinear[row1[c + dx]];
+                out[c] = tables.fromLinear[static_cast<unsigned>(sum * (SRGBTables::FromLinearSize - 1) * 0.25f + 0.5f)];
+            }
+            
+            // alpha is always linear
+            out[3] = static_cast<unsigned char>((row0[3] + row0[3 + dx] + row1[3] + row1[3 + dx] + 2) >> 2);
+        }
+    }
+    
+    static void swapBytes16(unsigned char* data, size_t count)
+    {
+        // branch free byte loop, vectorizes into shuffles
+        for (size_t i = 0; i < count; i++, data += 2)
+        {
+            unsigned char hi = data[0];
+            data[0] = data[1];
+            data[1] = hi;
+        }
+    }
+    
+    struct SRGBTables
+    {
+        enum
+        {
+            FromLinearSize = 4096,
+        };
+        
+        SRGBTables()
+        {
+            for (unsigned i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (unsigned i = 0; i < FromLinearSize; i++)
+            {
+                float l = static_cast<float>(i) / (FromLinearSize - 1);
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                fromLinear[i] = static_cast<unsigned char>(std::min(std::max(c * 255.0f + 0.5f, 0.0f), 255.0f));
+            }
+        }
+        
+        float toLinear[256];
+        unsigned char fromLinear[FromLinearSize];
+    };
+    
+    // every unorm16 value as an IEEE half, rounded to nearest even
+    struct HalfTable
+    {
+        HalfTable()
+        {
+            for (uint32_t i = 0; i < 65536; i++)
+            {
+                float f = i / 65535.0f;
+                if (f < 6.103515625e-05f) // below the smallest normal half, 2^-14
+                {
+                    fromUnorm16[i] = static_cast<uint16_t>(f * 16777216.0f + 0.5f); // denormal, in units of 2^-24
+                    continue;
+                }
+                
+                uint32_t bits;
+                memcpy(&bits, &f, sizeof(bits));
+                uint32_t mantissa = bits & 0x7fffff;
+                uint32_t half = ((((bits >> 23) & 0xff) - 127 + 15) << 10) | (mantissa >> 13);
+                uint32_t rest = mantissa & 0x1fff;
+                if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+                    half++; // a carry into the exponent is still the right value
+                fromUnorm16[i] = static_cast<uint16_t>(half);
+            }
+        }
+        
+        uint16_t fromUnorm16[65536];
+    };
+    
+    bool mySRGB = false;
+};
@@ -1,27 +1,52 @@
 #include "VulkanTutorial2.hpp"
 
+#include "AssetPack.h"
+#include "PNGImage.h"
 #include "lodepng.h"
 
 #include <vulkan/vulkan.h>
+#if defined(__APPLE__)
 #include <vulkan/vulkan_macos.h>
+#endif
 
 #define VMA_IMPLEMENTATION
 #include <vk_mem_alloc.h>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <assert.h>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
 #include <CoreFoundation/CFBundle.h>
+#endif
 
 #define CHECK_VKRESULT(res) \
 assert(res == VK_SUCCESS)
@@ -78,10 +103,90 @@ static std::vector<char> readSPIRVFile(const std::string& filename)
     return buffer;
 }
 
+// a full chain, down to 1x1
+static uint getMipLevelCount(uint width, uint height)
+{
+    uint mipLevels = 1;
+    for (uint size = std::max(width, height); size > 1; size /= 2)
+        mipLevels++;
+    
+    return mipLevels;
+}
+
+// where to write a file before renaming it to path, unique per process and thread so that concurrent writers of
+// the same file never write into each other's
+static std::string getTemporaryPath(const std::string& path)
+{
+    return path + "." + std::to_string(getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+}
+
+static uint32_t hashFNV1a(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    
+    return hash;
+}
+
+// for content that is looked up by its hash, where 32 bits collide too often, like whole files. chained by passing
+// the last hash in as the seed. this is xxHash64: 8 bytes per step in four independent lanes, so that it keeps up
+// with reading the file instead of doing a multiply per byte. words are read in native byte order
+static uint64_t hashXX64(const void* data, size_t size, uint64_t seed = 0)
+{
+    static const uint64_t prime1 = 11400714785074694791ull;
+    static const uint64_t prime2 = 14029467366897019727ull;
+    static const uint64_t prime3 = 1609587929392839161ull;
+    static const uint64_t prime4 = 9650029242287828579ull;
+    static const uint64_t prime5 = 2870177450012600261ull;
+    
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&rotl](uint64_t acc, uint64_t input) { return rotl(acc + input * prime2, 31) * prime1; };
+    auto read64 = [](const unsigned char* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; };
+    
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    const unsigned char* end = bytes + size;
+    
+    uint64_t hash = seed + prime5;
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+        for (; end - bytes >= 32; bytes += 32)
+            for (uint lane = 0; lane < 4; lane++)
+                lanes[lane] = round(lanes[lane], read64(bytes + 8 * lane));
+        
+        hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for (uint lane = 0; lane < 4; lane++)
+            hash = (hash ^ round(0, lanes[lane])) * prime1 + prime4;
+    }
+    hash += size;
+    
+    for (; end - bytes >= 8; bytes += 8)
+        hash = rotl(hash ^ round(0, read64(bytes)), 27) * prime1 + prime4;
+    
+    if (end - bytes >= 4)
+    {
+        uint32_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = rotl(hash ^ (word * prime1), 23) * prime2 + prime3;
+        bytes += 4;
+    }
+    
+    for (; bytes < end; bytes++)
+        hash = rotl(hash ^ (*bytes * prime5), 11) * prime1;
+    
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
 struct Vertex
 {
     float pos[2];
-    float color[3];
     float texCoord[2];
     
     static VkVertexInputBindingDescription getBindingDescription()
@@ -93,21 +198,62 @@ struct Vertex
         return bindingDescription;
     }
     
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions()
     {
-        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
         attributeDescriptions[0].binding = 0;
         attributeDescriptions[0].location = 0;
         attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
         attributeDescriptions[0].offset = offsetof(Vertex, pos);
         attributeDescriptions[1].binding = 0;
         attributeDescriptions[1].location = 1;
-        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attributeDescriptions[1].offset = offsetof(Vertex, color);
-        attributeDescriptions[2].binding = 0;
-        attributeDescriptions[2].location = 2;
-        attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+        attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(Vertex, texCoord);
+        return attributeDescriptions;
+    }
+};
+
+// per instance vertex data, places, textures and tints one copy of the quad
+struct SpriteInstance
+{
+    float transform[4]; // 2x2 matrix, column major
+    float offset[2];
+    float texRect[4]; // offset and size in texture coordinates
+    uint8_t tint[4];
+    uint32_t textureIndex; // slot in the bindless texture array, unused without it
+    
+    static VkVertexInputBindingDescription getBindingDescription()
+    {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 1;
+        bindingDescription.stride = sizeof(SpriteInstance);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        return bindingDescription;
+    }
+    
+    static std::array<VkVertexInputAttributeDescription, 5> getAttributeDescriptions()
+    {
+        std::array<VkVertexInputAttributeDescription, 5> attributeDescriptions = {};
+        attributeDescriptions[0].binding = 1;
+        attributeDescriptions[0].location = 2;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[0].offset = offsetof(SpriteInstance, transform);
+        attributeDescriptions[1].binding = 1;
+        attributeDescriptions[1].location = 3;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+        attributeDescriptions[1].offset = offsetof(SpriteInstance, offset);
+        attributeDescriptions[2].binding = 1;
+        attributeDescriptions[2].location = 4;
+        attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescriptions[2].offset = offsetof(SpriteInstance, texRect);
+        attributeDescriptions[3].binding = 1;
+        attributeDescriptions[3].location = 5;
+        attributeDescriptions[3].format = VK_FORMAT_R8G8B8A8_UNORM;
+        attributeDescriptions[3].offset = offsetof(SpriteInstance, tint);
+        attributeDescriptions[4].binding = 1;
+        attributeDescriptions[4].location = 6;
+        attributeDescriptions[4].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[4].offset = offsetof(SpriteInstance, textureIndex);
         return attributeDescriptions;
     }
 };
@@ -127,21 +273,95 @@ struct Vec4
     };
 };
 
-struct PNGImage
+// a KTX (version 1) file with a block compressed 2D texture and all of its mip levels, like Tools/TextureCooker.cpp
+// writes them. the levels are packed into myImage like PNGImage does, myMipOffsets is where each one starts.
+// myFormat stays VK_FORMAT_UNDEFINED if the file is missing, broken or in a format that isn't one of the below
+struct KTXImage
 {
-    PNGImage(const char* filename)
+    KTXImage() = default;
+    
+    explicit KTXImage(const char* filename)
     {
-        unsigned error = lodepng::decode(myImage, myWidth, myHeight, filename);
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            return;
+        
+        static const unsigned char identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        
+        // endianness, glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat, pixelWidth, pixelHeight,
+        // pixelDepth, numberOfArrayElements, numberOfFaces, numberOfMipmapLevels, bytesOfKeyValueData
+        unsigned char fileIdentifier[12];
+        uint32_t header[13];
+        file.read(reinterpret_cast<char*>(fileIdentifier), sizeof(fileIdentifier));
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file || memcmp(fileIdentifier, identifier, sizeof(identifier)) != 0 || header[0] != 0x04030201)
+            return;
+        
+        // a single 2D image, no arrays, cube maps or volumes
+        if (header[6] == 0 || header[7] == 0 || header[8] != 0 || header[9] != 0 || header[10] != 1)
+            return;
+        
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        switch (header[4])
+        {
+            case 0x83F0: // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+                myBlockSizeBytes = 8;
+                break;
+            case 0x83F1: // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+                format = VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+                myBlockSizeBytes = 8;
+                break;
+            case 0x83F3: // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                format = VK_FORMAT_BC3_UNORM_BLOCK;
+                myBlockSizeBytes = 16;
+                break;
+            case 0x8E8C: // GL_COMPRESSED_RGBA_BPTC_UNORM
+                format = VK_FORMAT_BC7_UNORM_BLOCK;
+                myBlockSizeBytes = 16;
+                break;
+            case 0x93B0: // GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+                format = VK_FORMAT_ASTC_4x4_UNORM_BLOCK;
+                myBlockSizeBytes = 16;
+                break;
+            default:
+                return;
+        }
+        
+        myWidth = header[6];
+        myHeight = header[7];
+        file.seekg(header[12], std::ios::cur);
         
-        if (error)
-            std::cerr << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        const uint32_t mipLevels = std::max(header[11], 1u);
+        for (uint32_t level = 0; level < mipLevels; level++)
+        {
+            const VkDeviceSize width = std::max(myWidth >> level, 1u);
+            const VkDeviceSize height = std::max(myHeight >> level, 1u);
+            const VkDeviceSize levelSize = ((width + 3) / 4) * ((height + 3) / 4) * myBlockSizeBytes;
+            
+            uint32_t imageSize = 0;
+            file.read(reinterpret_cast<char*>(&imageSize), sizeof(imageSize));
+            if (!file || imageSize != levelSize)
+                return;
+            
+            myMipOffsets.push_back(myImage.size());
+            myImage.resize(myImage.size() + imageSize);
+            file.read(reinterpret_cast<char*>(myImage.data() + myMipOffsets.back()), imageSize);
+            
+            // levels are padded to 4 bytes, which whole blocks always are
+            if (!file)
+                return;
+        }
         
-        assert(!error);
+        myFormat = format;
     }
     
     std::vector<unsigned char> myImage;
+    std::vector<VkDeviceSize> myMipOffsets;
     unsigned myWidth = 0;
     unsigned myHeight = 0;
+    VkFormat myFormat = VK_FORMAT_UNDEFINED;
+    uint myBlockSizeBytes = 0; // per 4x4 block
 };
 
 struct UniformBufferObject
@@ -151,214 +371,2561 @@ struct UniformBufferObject
     Vec4 proj[4];
 };
 
-class VulkanTutorialApp
+// a whole file mapped read only. the mapping stays valid when the file is replaced or removed in the meantime
+class MappedFile
 {
 public:
     
-    VulkanTutorialApp(void* view, int width, int height, float backingScaleFactor)
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile()
     {
-        initVulkan(view, width, height, backingScaleFactor);
+        close();
     }
     
-    ~VulkanTutorialApp()
+    // empty files can't be mapped
+    bool open(const char* path)
     {
-        cleanup();
+        close();
+        
+        int file = ::open(path, O_RDONLY);
+        if (file < 0)
+            return false;
+        
+        struct stat fileStatus;
+        void* data = MAP_FAILED;
+        if (fstat(file, &fileStatus) == 0 && fileStatus.st_size > 0)
+            data = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        
+        // the mapping keeps its own reference to the file
+        ::close(file);
+        if (data == MAP_FAILED)
+            return false;
+        
+        myData = static_cast<const unsigned char*>(data);
+        mySize = static_cast<size_t>(fileStatus.st_size);
+        
+        // files are mapped to be read front to back right away, so start reading all of it ahead
+        madvise(data, mySize, MADV_WILLNEED);
+        
+        return true;
     }
     
-    void draw(uint frameIndex)
+    void close()
     {
-        updateUniformBuffer(frameIndex);
-        drawFrame(frameIndex);
+        if (myData)
+            munmap(const_cast<unsigned char*>(myData), mySize);
+        
+        myData = nullptr;
+        mySize = 0;
+    }
+    
+    const unsigned char* getData() const
+    {
+        return myData;
+    }
+    
+    size_t getSize() const
+    {
+        return mySize;
     }
     
 private:
     
-    void createInstance()
+    const unsigned char* myData = nullptr;
+    size_t mySize = 0;
+};
+
+// an asset pack (see AssetPack.h) mapped into memory. the payloads are used in place, for as long as the pack is open
+class AssetPack
+{
+public:
+    
+    // false if the file can't be mapped or isn't a pack, the checks are cheap enough to do on every open
+    bool open(const char* path)
     {
-        VkApplicationInfo appInfo = {};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName = "No Engine";
-        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_1;
-        
-        uint32_t instanceLayerCount;
-        CHECK_VKRESULT(vkEnumerateInstanceLayerProperties(&instanceLayerCount, nullptr));
-        std::cout << instanceLayerCount << " layers found!\n";
-        if (instanceLayerCount > 0)
-        {
-            std::unique_ptr<VkLayerProperties[]> instanceLayers(new VkLayerProperties[instanceLayerCount]);
-            CHECK_VKRESULT(vkEnumerateInstanceLayerProperties(&instanceLayerCount, instanceLayers.get()));
-            for (int i = 0; i < instanceLayerCount; ++i)
-                std::cout << instanceLayers[i].layerName << "\n";
-        }
+        close();
         
-        const char * enabledLayerNames[] =
-        {
-            "VK_LAYER_LUNARG_standard_validation"
-        };
+        if (!myFile.open(path))
+            return false;
         
-        uint32_t instanceExtensionCount;
-        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, nullptr);
+        const unsigned char* data = myFile.getData();
+        const size_t size = myFile.getSize();
         
-        std::vector<VkExtensionProperties> availableInstanceExtensions(instanceExtensionCount);
-        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, availableInstanceExtensions.data());
+        const AssetPackHeader& header = *reinterpret_cast<const AssetPackHeader*>(data);
+        if (size < sizeof(AssetPackHeader) || header.magic != AssetPackMagic || header.version != AssetPackVersion ||
+            header.entrySizeBytes != sizeof(AssetPackEntry) || header.entriesOffset % alignof(AssetPackEntry) != 0 ||
+            header.entriesOffset > size || header.entryCount > (size - header.entriesOffset) / sizeof(AssetPackEntry))
+        {
+            close();
+            return false;
+        }
         
-        std::vector<const char*> instanceExtensions(instanceExtensionCount);
-        for (uint i = 0; i < instanceExtensionCount; i++)
-            instanceExtensions[i] = availableInstanceExtensions[i].extensionName;
+        myEntries = reinterpret_cast<const AssetPackEntry*>(data + header.entriesOffset);
+        myEntryCount = header.entryCount;
         
-        std::sort(instanceExtensions.begin(), instanceExtensions.end(), [](const char* lhs, const char* rhs)
+        for (uint32_t i = 0; i < myEntryCount; i++)
         {
-            return strcmp(lhs, rhs) < 0;
-        });
+            const AssetPackEntry& entry = myEntries[i];
+            if (entry.offset > size || entry.size > size - entry.offset || entry.offset % AssetPackAlignment != 0 ||
+                entry.mipLevels > AssetPackMaxMipLevels || (i > 0 && myEntries[i - 1].nameHash >= entry.nameHash))
+            {
+                close();
+                return false;
+            }
+        }
         
-        std::vector<const char*> requiredExtensions =
-        {
-            "VK_KHR_surface",
-            "VK_MVK_macos_surface",
-        };
+        return true;
+    }
+    
+    void close()
+    {
+        myFile.close();
+        myEntries = nullptr;
+        myEntryCount = 0;
+    }
+    
+    // the asset built from name.type, if the pack has it
+    const AssetPackEntry* find(const char* name, const char* type, AssetPackEntryType entryType) const
+    {
+        const uint64_t nameHash = hashAssetName((std::string(name) + "." + type).c_str());
         
-        assert(std::includes(instanceExtensions.begin(), instanceExtensions.end(), requiredExtensions.begin(), requiredExtensions.end(), [](const char* lhs, const char* rhs)
+        const AssetPackEntry* end = myEntries + myEntryCount;
+        const AssetPackEntry* entry = std::lower_bound(myEntries, end, nameHash, [](const AssetPackEntry& entry, uint64_t hash)
         {
-            return strcmp(lhs, rhs) < 0;
-        }));
-        
-        VkInstanceCreateInfo info = {};
-        info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        info.pApplicationInfo = &appInfo;
-        info.enabledLayerCount = 1;
-        info.ppEnabledLayerNames = enabledLayerNames;
-        info.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
-        info.ppEnabledExtensionNames = instanceExtensions.data();
+            return entry.nameHash < hash;
+        });
         
-        CHECK_VKRESULT(vkCreateInstance(&info, NULL, &myInstance));
+        return entry != end && entry->nameHash == nameHash && entry->type == entryType ? entry : nullptr;
     }
     
-    void createDebugCallback()
+    const unsigned char* getData(const AssetPackEntry& entry) const
     {
-        VkDebugReportCallbackCreateInfoEXT debugCallbackInfo = {};
-        debugCallbackInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-        debugCallbackInfo.flags = VK_DEBUG_REPORT_INFORMATION_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT | VK_DEBUG_REPORT_DEBUG_BIT_EXT| VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-        debugCallbackInfo.pfnCallback = debugCallback;
+        return myFile.getData() + entry.offset;
+    }
+    
+private:
+    
+    MappedFile myFile;
+    const AssetPackEntry* myEntries = nullptr;
+    uint32_t myEntryCount = 0;
+};
+
+// decoded textures on disk, one file each, named after a hash of the PNG file's bytes and the settings it was decoded
+// with, so a changed PNG simply misses. the pixels are stored as they are uploaded and mapped straight from the file.
+// files are written under a temporary name and renamed, so other processes see all of a file or none of it, and
+// the least recently used ones are removed when the cache grows beyond its size
+class TextureCache
+{
+public:
+    
+    enum
+    {
+        MaxMipLevels = 16,
+    };
+    
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        VkFormat format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipLevels;
+        uint32_t texelBlockSizeBytes;
+        uint32_t reserved;
+        uint64_t dataSize; // what follows the header
+        VkDeviceSize mipOffsets[MaxMipLevels];
+    };
+    
+    // an empty directory disables the cache
+    void create(const std::string& directory, uint64_t maxSizeBytes)
+    {
+        myDirectory = directory;
+        myMaxSizeBytes = maxSizeBytes;
         
-        auto vkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(myInstance, "vkCreateDebugReportCallbackEXT");
-        assert(vkCreateDebugReportCallbackEXT != nullptr);
-        CHECK_VKRESULT(vkCreateDebugReportCallbackEXT(myInstance, &debugCallbackInfo, nullptr, &myDebugCallback));
+        // fails harmlessly if it is already there, and if it can't be made every store fails
+        if (!myDirectory.empty())
+            mkdir(myDirectory.c_str(), 0755);
     }
     
-    void createSurface(void* view)
+    // what to look a decoded file up by, settings being whatever else changes the decoded pixels
+    static uint64_t getKey(const void* source, size_t sourceSize, const void* settings, size_t settingsSize)
     {
-        VkMacOSSurfaceCreateInfoMVK surfaceCreateInfo = {};
-        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_MACOS_SURFACE_CREATE_INFO_MVK;
-        surfaceCreateInfo.flags = 0;
-        surfaceCreateInfo.pView = view;
-        auto vkCreateMacOSSurfaceMVK = (PFN_vkCreateMacOSSurfaceMVK)vkGetInstanceProcAddr(myInstance, "vkCreateMacOSSurfaceMVK");
-        assert(vkCreateMacOSSurfaceMVK != nullptr);
-        CHECK_VKRESULT(vkCreateMacOSSurfaceMVK(myInstance, &surfaceCreateInfo, nullptr, &mySurface));
+        const uint32_t version = FileVersion;
+        
+        uint64_t key = hashXX64(source, sourceSize);
+        key = hashXX64(settings, settingsSize, key);
+        return hashXX64(&version, sizeof(version), key);
     }
     
-    void createDevice()
+    // maps the texture cached for key into file, its pixels follow the header. mipLevels is how many levels there are
+    // pixels for, which is all of them unless they are generated on the gpu
+    const FileHeader* find(uint64_t key, MappedFile& file) const
     {
-        uint32_t deviceCount = 0;
-        CHECK_VKRESULT(vkEnumeratePhysicalDevices(myInstance, &deviceCount, nullptr));
-        if (deviceCount == 0)
-            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+        if (myDirectory.empty())
+            return nullptr;
         
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        CHECK_VKRESULT(vkEnumeratePhysicalDevices(myInstance, &deviceCount, devices.data()));
+        const std::string path = getPath(key);
+        if (!file.open(path.c_str()))
+            return nullptr;
         
-        for (const auto& device : devices)
+        const FileHeader* header = reinterpret_cast<const FileHeader*>(file.getData());
+        if (file.getSize() < sizeof(FileHeader) || header->magic != FileMagic || header->version != FileVersion ||
+            header->key != key || header->mipLevels == 0 || header->mipLevels > MaxMipLevels ||
+            header->dataSize != file.getSize() - sizeof(FileHeader) || !hasLevels(*header))
         {
-            myQueueFamilyIndex = isDeviceSuitable(myInstance, mySurface, device);
-            if (myQueueFamilyIndex >= 0)
-            {
-                myPhysicalDevice = device;
-                break;
-            }
+            file.close();
+            return nullptr;
         }
         
-        if (myPhysicalDevice == VK_NULL_HANDLE)
-            throw std::runtime_error("failed to find a suitable GPU!");
-        
-        const float graphicsQueuePriority = 1.0f;
+        // eviction goes by the modification time
+        utimes(path.c_str(), nullptr);
         
-        VkDeviceQueueCreateInfo queueCreateInfo = {};
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queueCreateInfo.queueFamilyIndex = myQueueFamilyIndex;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &graphicsQueuePriority;
+        return header;
+    }
+    
+    void store(uint64_t key, VkFormat format, uint width, uint height, uint mipLevels, const VkDeviceSize* mipOffsets, uint texelBlockSizeBytes, const void* data, size_t dataSize)
+    {
+        if (myDirectory.empty() || mipLevels > MaxMipLevels)
+            return;
+        
+        FileHeader header = {};
+        header.magic = FileMagic;
+        header.version = FileVersion;
+        header.key = key;
+        header.format = format;
+        header.width = width;
+        header.height = height;
+        header.mipLevels = mipLevels;
+        header.texelBlockSizeBytes = texelBlockSizeBytes;
+        header.dataSize = dataSize;
+        std::copy(mipOffsets, mipOffsets + mipLevels, header.mipOffsets);
+        
+        // the asset loader's threads can store the same texture at the same time
+        const std::string path = getPath(key);
+        const std::string temporaryPath = getTemporaryPath(path);
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return;
+            
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(static_cast<const char*>(data), dataSize);
+            file.close();
+            if (!file)
+            {
+                std::remove(temporaryPath.c_str());
+                return;
+            }
+        }
         
-        VkPhysicalDeviceFeatures deviceFeatures = {};
-        deviceFeatures.samplerAnisotropy = VK_TRUE;
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            std::remove(temporaryPath.c_str());
         
-        uint32_t deviceExtensionCount;
-        vkEnumerateDeviceExtensionProperties(myPhysicalDevice, nullptr, &deviceExtensionCount, nullptr);
+        evict();
+    }
+    
+private:
+    
+    enum
+    {
+        FileMagic = 0x43545456, // "VTTC"
+        FileVersion = 2, // 2: cpu mip chains are filtered in linear light with an exact box for odd sizes
+        StaleTemporaryFileSeconds = 600, // left behind by a process that died while writing
+    };
+    
+    // the pixels of every level are within the data, which only has uncompressed formats
+    static bool hasLevels(const FileHeader& header)
+    {
+        for (uint level = 0; level < header.mipLevels; level++)
+        {
+            const uint64_t levelSize = uint64_t(std::max(header.width >> level, 1u)) * std::max(header.height >> level, 1u) * header.texelBlockSizeBytes;
+            if (header.mipOffsets[level] > header.dataSize || levelSize > header.dataSize - header.mipOffsets[level])
+                return false;
+        }
         
-        std::vector<VkExtensionProperties> availableDeviceExtensions(deviceExtensionCount);
-        vkEnumerateDeviceExtensionProperties(myPhysicalDevice, nullptr, &deviceExtensionCount, availableDeviceExtensions.data());
+        return true;
+    }
+    
+    std::string getPath(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.texture", static_cast<unsigned long long>(key));
+        return myDirectory + "/" + name;
+    }
+    
+    // the most recently used files that fit into the size, other processes that still have a removed file mapped keep
+    // using it until they unmap it
+    void evict() const
+    {
+        DIR* dir = opendir(myDirectory.c_str());
+        if (dir == nullptr)
+            return;
         
-        assert(std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(), [](const VkExtensionProperties& extension)
+        struct CachedFile
         {
-            return strcmp(extension.extensionName, "VK_KHR_swapchain") == 0;
-        }) != availableDeviceExtensions.end());
+            std::string path;
+            time_t lastUsed;
+            uint64_t size;
+        };
         
-        std::vector<const char*> deviceExtensions;
-        for (const auto& extension : availableDeviceExtensions)
+        std::vector<CachedFile> files;
+        const time_t now = time(nullptr);
+        while (const dirent* entry = readdir(dir))
         {
-            if (strcmp(extension.extensionName, "VK_MVK_moltenvk") == 0 ||
-                strcmp(extension.extensionName, "VK_KHR_surface") == 0 ||
-                strcmp(extension.extensionName, "VK_MVK_macos_surface") == 0)
+            const std::string name = entry->d_name;
+            const std::string path = myDirectory + "/" + name;
+            
+            struct stat fileStatus;
+            if (stat(path.c_str(), &fileStatus) != 0 || !S_ISREG(fileStatus.st_mode))
                 continue;
             
-            deviceExtensions.push_back(extension.extensionName);
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            {
+                if (now - fileStatus.st_mtime > StaleTemporaryFileSeconds)
+                    std::remove(path.c_str());
+            }
+            else if (name.size() > 8 && name.compare(name.size() - 8, 8, ".texture") == 0)
+            {
+                files.push_back({ path, fileStatus.st_mtime, static_cast<uint64_t>(fileStatus.st_size) });
+            }
         }
+        closedir(dir);
         
-        std::sort(deviceExtensions.begin(), deviceExtensions.end(), [](const char* lhs, const char* rhs)
+        std::sort(files.begin(), files.end(), [](const CachedFile& a, const CachedFile& b)
         {
-            return strcmp(lhs, rhs) < 0;
+            return a.lastUsed > b.lastUsed;
         });
         
-        /*
-         static const std::vector<const char*> requiredExtensions =
-         {
-         "VK_KHR_get_memory_requirements2",
-         "VK_KHR_dedicated_allocation",
-         };
-         
-         assert(std::includes(deviceExtensions.begin(), deviceExtensions.end(), requiredExtensions.begin(), requiredExtensions.end(), [](const char* lhs, const char* rhs)
-         {
-         return strcmp(lhs, rhs) < 0;
-         }));
-         */
-        
-        VkDeviceCreateInfo deviceCreateInfo = {};
-        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-        deviceCreateInfo.queueCreateInfoCount = 1;
-        deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-        deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
-        
-        CHECK_VKRESULT(vkCreateDevice(myPhysicalDevice, &deviceCreateInfo, nullptr, &myDevice));
-        
-        vkGetDeviceQueue(myDevice, myQueueFamilyIndex, 0, &myQueue);
+        uint64_t size = 0;
+        for (const CachedFile& file : files)
+        {
+            size += file.size;
+            if (size > myMaxSizeBytes)
+                std::remove(file.path.c_str());
+        }
     }
     
-    void createAllocator()
-    {
-        VmaAllocatorCreateInfo allocatorInfo = {};
+    std::string myDirectory;
+    uint64_t myMaxSizeBytes = 0;
+};
+
+// all upload staging memory comes out of one persistently mapped buffer, handed out front to back and wrapping around.
+// ranges belong to the next submit (see fenceForSubmit) and are reused once that submit's fence has signalled.
+// submits are numbered, so callers can wait for or poll one of them without holding on to its fence.
+// uploads that are larger than the whole ring get a dedicated staging buffer with the same lifetime.
+class StagingRing
+{
+public:
+    
+    enum
+    {
+        MaxAlignment = 256,
+    };
+    
+    struct Range
+    {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        void* data;
+    };
+    
+    void create(VkDevice device, VmaAllocator allocator, VkDeviceSize capacity)
+    {
+        assert(myBuffer == VK_NULL_HANDLE);
+        
+        myDevice = device;
+        myAllocator = allocator;
+        myCapacity = (capacity + MaxAlignment - 1) & ~VkDeviceSize(MaxAlignment - 1);
+        
+        VmaAllocationInfo allocationInfo;
+        createMappedBuffer(myCapacity, myBuffer, myMemory, allocationInfo);
+        myData = static_cast<unsigned char*>(allocationInfo.pMappedData);
+    }
+    
+    void destroy()
+    {
+        while (retireOldest(true)) {}
+        
+        for (const auto& dedicated : myUnsubmittedDedicated)
+            vmaDestroyBuffer(myAllocator, dedicated.first, dedicated.second);
+        myUnsubmittedDedicated.clear();
+        
+        for (VkFence fence : myFreeFences)
+            vkDestroyFence(myDevice, fence, nullptr);
+        myFreeFences.clear();
+        
+        if (myBuffer != VK_NULL_HANDLE)
+            vmaDestroyBuffer(myAllocator, myBuffer, myMemory);
+        myBuffer = VK_NULL_HANDLE;
+        myMemory = VK_NULL_HANDLE;
+        myData = nullptr;
+    }
+    
+    // alignment must be a power of two, at most MaxAlignment. blocks on the oldest submits until there is room
+    Range allocate(VkDeviceSize size, VkDeviceSize alignment)
+    {
+        assert(myBuffer != VK_NULL_HANDLE);
+        assert(alignment > 0 && alignment <= MaxAlignment && (alignment & (alignment - 1)) == 0);
+        
+        if (size > myCapacity)
+            return allocateDedicated(size);
+        
+        while (retireOldest(false)) {}
+        
+        // positions only ever grow, the offset into the buffer is position % capacity, which keeps the alignment
+        uint64_t begin = (myHead + alignment - 1) & ~uint64_t(alignment - 1);
+        if (begin % myCapacity + size > myCapacity)
+            begin = (begin / myCapacity + 1) * myCapacity;
+        
+        while (begin + size - myTail > myCapacity)
+        {
+            // what is left is held by ranges that haven't been submitted yet
+            if (!retireOldest(true))
+                return allocateDedicated(size);
+        }
+        
+        myHead = begin + size;
+        
+        VkDeviceSize offset = begin % myCapacity;
+        return { myBuffer, offset, myData + offset };
+    }
+    
+    // everything allocated since the previous call is released when the returned fence signals,
+    // so it has to be passed to the vkQueueSubmit that reads those ranges
+    VkFence fenceForSubmit(uint64_t* outSerial = nullptr)
+    {
+        Submission submission;
+        if (myFreeFences.empty())
+        {
+            VkFenceCreateInfo fenceInfo = {};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            
+            CHECK_VKRESULT(vkCreateFence(myDevice, &fenceInfo, nullptr, &submission.fence));
+        }
+        else
+        {
+            submission.fence = myFreeFences.back();
+            myFreeFences.pop_back();
+        }
+        submission.serial = ++mySubmitSerial;
+        submission.end = myHead;
+        submission.dedicated.swap(myUnsubmittedDedicated);
+        
+        mySubmissions.push_back(std::move(submission));
+        
+        if (outSerial)
+            *outSerial = mySubmitSerial;
+        
+        return mySubmissions.back().fence;
+    }
+    
+    bool isRetired(uint64_t serial)
+    {
+        while (retireOldest(false)) {}
+        
+        return serial <= myRetiredSerial;
+    }
+    
+    void waitUntilRetired(uint64_t serial)
+    {
+        assert(serial <= mySubmitSerial);
+        
+        while (serial > myRetiredSerial)
+            retireOldest(true);
+    }
+    
+private:
+    
+    struct Submission
+    {
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t serial = 0;
+        uint64_t end = 0;
+        std::vector<std::pair<VkBuffer, VmaAllocation>> dedicated;
+    };
+    
+    void createMappedBuffer(VkDeviceSize size, VkBuffer& outBuffer, VmaAllocation& outMemory, VmaAllocationInfo& outAllocationInfo)
+    {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        
+        CHECK_VKRESULT(vmaCreateBuffer(myAllocator, &bufferInfo, &allocInfo, &outBuffer, &outMemory, &outAllocationInfo));
+        assert(outAllocationInfo.pMappedData != nullptr);
+    }
+    
+    Range allocateDedicated(VkDeviceSize size)
+    {
+        VkBuffer buffer;
+        VmaAllocation memory;
+        VmaAllocationInfo allocationInfo;
+        createMappedBuffer(size, buffer, memory, allocationInfo);
+        
+        myUnsubmittedDedicated.emplace_back(buffer, memory);
+        
+        return { buffer, 0, allocationInfo.pMappedData };
+    }
+    
+    bool retireOldest(bool wait)
+    {
+        if (mySubmissions.empty())
+            return false;
+        
+        Submission& submission = mySubmissions.front();
+        if (wait)
+            CHECK_VKRESULT(vkWaitForFences(myDevice, 1, &submission.fence, VK_TRUE, std::numeric_limits<uint64_t>::max()));
+        else if (vkGetFenceStatus(myDevice, submission.fence) != VK_SUCCESS)
+            return false;
+        
+        myTail = submission.end;
+        myRetiredSerial = submission.serial;
+        
+        for (const auto& dedicated : submission.dedicated)
+            vmaDestroyBuffer(myAllocator, dedicated.first, dedicated.second);
+        
+        CHECK_VKRESULT(vkResetFences(myDevice, 1, &submission.fence));
+        myFreeFences.push_back(submission.fence);
+        
+        mySubmissions.pop_front();
+        
+        return true;
+    }
+    
+    VkDevice myDevice = VK_NULL_HANDLE;
+    VmaAllocator myAllocator = VK_NULL_HANDLE;
+    VkBuffer myBuffer = VK_NULL_HANDLE;
+    VmaAllocation myMemory = VK_NULL_HANDLE;
+    unsigned char* myData = nullptr;
+    VkDeviceSize myCapacity = 0;
+    uint64_t myHead = 0;
+    uint64_t myTail = 0;
+    uint64_t mySubmitSerial = 0;
+    uint64_t myRetiredSerial = 0;
+    std::deque<Submission> mySubmissions;
+    std::vector<VkFence> myFreeFences;
+    std::vector<std::pair<VkBuffer, VmaAllocation>> myUnsubmittedDedicated;
+};
+
+// records the copies and layout transitions of a whole loading phase into one command buffer that is submitted once.
+// barriers are held back until the next copy (or end), so the transitions of consecutive uploads go out merged
+// into a single vkCmdPipelineBarrier. only one batch at a time, the staging ranges it uses belong to its submit.
+// when the batch runs on another queue family than its readers, the barriers for the readers become queue family
+// ownership releases, and the matching acquires are collected for the reading queue (see takeAcquireBarriers)
+class UploadBatch
+{
+public:
+    
+    UploadBatch(VkDevice device, VkCommandPool commandPool, uint32_t queueFamilyIndex, uint32_t readerQueueFamilyIndex)
+    : myQueueFamilyIndex(queueFamilyIndex)
+    , myReaderQueueFamilyIndex(readerQueueFamilyIndex)
+    {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        
+        CHECK_VKRESULT(vkAllocateCommandBuffers(device, &allocInfo, &myCommandBuffer));
+        
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        
+        CHECK_VKRESULT(vkBeginCommandBuffer(myCommandBuffer, &beginInfo));
+    }
+    
+    ~UploadBatch()
+    {
+        assert(myCommandBuffer == VK_NULL_HANDLE); // never ended, end() hands the command buffer over for submission
+    }
+    
+    // dstUsage says how dstBuffer is read afterwards, which is what the barrier after the copy waits for
+    void copyBuffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize size, VkBufferUsageFlags dstUsage)
+    {
+        flushBarriers();
+        
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = srcOffset;
+        copyRegion.dstOffset = 0;
+        copyRegion.size = size;
+        vkCmdCopyBuffer(myCommandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = dstBuffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        
+        VkPipelineStageFlags destinationStage = 0;
+        if (dstUsage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+        {
+            barrier.dstAccessMask |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+            destinationStage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        }
+        if (dstUsage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+        {
+            barrier.dstAccessMask |= VK_ACCESS_INDEX_READ_BIT;
+            destinationStage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+        }
+        if (dstUsage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+        {
+            barrier.dstAccessMask |= VK_ACCESS_UNIFORM_READ_BIT;
+            destinationStage |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+        if (dstUsage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+        {
+            barrier.dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+            destinationStage |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        }
+        if (dstUsage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT)
+        {
+            barrier.dstAccessMask |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+            destinationStage |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+        }
+        if (destinationStage == 0)
+        {
+            // any other use waits for everything, slow but correct
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+            destinationStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+        
+        if (myQueueFamilyIndex != myReaderQueueFamilyIndex)
+        {
+            barrier.srcQueueFamilyIndex = myQueueFamilyIndex;
+            barrier.dstQueueFamilyIndex = myReaderQueueFamilyIndex;
+            
+            VkBufferMemoryBarrier acquire = barrier;
+            acquire.srcAccessMask = 0;
+            myAcquireBufferBarriers.push_back(acquire);
+            
+            // the release only needs to make the writes available, the acquire does the rest on the reader's queue
+            barrier.dstAccessMask = 0;
+            myReaderStages |= destinationStage;
+            destinationStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        }
+        else
+        {
+            myReaderStages |= destinationStage;
+        }
+        
+        myBufferBarriers.push_back(barrier);
+        mySourceStages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+        myDestinationStages |= destinationStage;
+    }
+    
+    void copyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint width, uint height, uint mipLevels = 1, const VkDeviceSize* mipOffsets = nullptr)
+    {
+        flushBarriers();
+        
+        std::vector<VkBufferImageCopy> regions(mipLevels);
+        for (uint level = 0; level < mipLevels; level++)
+        {
+            VkBufferImageCopy& region = regions[level];
+            region.bufferOffset = bufferOffset + (mipOffsets ? mipOffsets[level] : 0);
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = level;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = { 0, 0, 0 };
+            region.imageExtent = { std::max(width >> level, 1u), std::max(height >> level, 1u), 1 };
+        }
+        
+        vkCmdCopyBufferToImage(myCommandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+    }
+    
+    void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint mipLevels = 1, uint baseMipLevel = 0)
+    {
+        // two transitions of the same levels can't go into the same barrier command, their order would be undefined
+        for (const auto& pending : myImageBarriers)
+        {
+            const VkImageSubresourceRange& range = pending.subresourceRange;
+            if (pending.image == image && range.baseMipLevel < baseMipLevel + mipLevels && baseMipLevel < range.baseMipLevel + range.levelCount)
+            {
+                flushBarriers();
+                break;
+            }
+        }
+        
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = baseMipLevel;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        
+        VkPipelineStageFlags sourceStage;
+        VkPipelineStageFlags destinationStage;
+        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+        {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        }
+        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        {
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+        {
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        }
+        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        {
+            barrier.srcAccessMask = 0; // only read, waiting for the reads is enough
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+        else
+        {
+            assert(false); // not implemented yet
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = 0;
+            sourceStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            destinationStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        }
+        
+        // anything past the transfer stage is the hand over to the readers
+        if (destinationStage != VK_PIPELINE_STAGE_TRANSFER_BIT)
+        {
+            if (myQueueFamilyIndex != myReaderQueueFamilyIndex)
+            {
+                barrier.srcQueueFamilyIndex = myQueueFamilyIndex;
+                barrier.dstQueueFamilyIndex = myReaderQueueFamilyIndex;
+                
+                VkImageMemoryBarrier acquire = barrier;
+                acquire.srcAccessMask = 0;
+                myAcquireImageBarriers.push_back(acquire);
+                
+                barrier.dstAccessMask = 0;
+                myReaderStages |= destinationStage;
+                destinationStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            }
+            else
+            {
+                myReaderStages |= destinationStage;
+            }
+        }
+        
+        myImageBarriers.push_back(barrier);
+        mySourceStages |= sourceStage;
+        myDestinationStages |= destinationStage;
+    }
+    
+    // fills levels 1 and up from level 0, which has been copied and is still in TRANSFER_DST_OPTIMAL like the rest.
+    // every level is blitted from the one above it once that one has been turned into a blit source, and at the end all
+    // levels go to the readers. needs a queue with graphics and a format with linear filtered blits
+    void generateMipmaps(VkImage image, uint width, uint height, uint mipLevels)
+    {
+        for (uint level = 1; level < mipLevels; level++)
+        {
+            transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 1, level - 1);
+            flushBarriers();
+            
+            VkImageBlit blit = {};
+            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel = level - 1;
+            blit.srcSubresource.baseArrayLayer = 0;
+            blit.srcSubresource.layerCount = 1;
+            blit.srcOffsets[1] = { static_cast<int32_t>(std::max(width >> (level - 1), 1u)), static_cast<int32_t>(std::max(height >> (level - 1), 1u)), 1 };
+            blit.dstSubresource = blit.srcSubresource;
+            blit.dstSubresource.mipLevel = level;
+            blit.dstOffsets[1] = { static_cast<int32_t>(std::max(width >> level, 1u)), static_cast<int32_t>(std::max(height >> level, 1u)), 1 };
+            
+            vkCmdBlitImage(myCommandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+        }
+        
+        // the last level has only been written
+        if (mipLevels > 1)
+            transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels - 1);
+        transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, mipLevels - 1);
+    }
+    
+    // ends recording and hands the command buffer over, the batch is done after this
+    VkCommandBuffer end()
+    {
+        flushBarriers();
+        
+        CHECK_VKRESULT(vkEndCommandBuffer(myCommandBuffer));
+        
+        VkCommandBuffer commandBuffer = myCommandBuffer;
+        myCommandBuffer = VK_NULL_HANDLE;
+        
+        return commandBuffer;
+    }
+    
+    // the stages that read the uploads, and the ownership acquires to run at the start of them on the reader's queue
+    // (none if both queues are in the same family)
+    VkPipelineStageFlags takeAcquireBarriers(std::vector<VkBufferMemoryBarrier>& outBufferBarriers, std::vector<VkImageMemoryBarrier>& outImageBarriers)
+    {
+        outBufferBarriers.insert(outBufferBarriers.end(), myAcquireBufferBarriers.begin(), myAcquireBufferBarriers.end());
+        outImageBarriers.insert(outImageBarriers.end(), myAcquireImageBarriers.begin(), myAcquireImageBarriers.end());
+        myAcquireBufferBarriers.clear();
+        myAcquireImageBarriers.clear();
+        
+        VkPipelineStageFlags readerStages = myReaderStages;
+        myReaderStages = 0;
+        
+        return readerStages;
+    }
+    
+private:
+    
+    void flushBarriers()
+    {
+        if (myImageBarriers.empty() && myBufferBarriers.empty())
+            return;
+        
+        vkCmdPipelineBarrier(myCommandBuffer, mySourceStages, myDestinationStages, 0,
+            0, nullptr,
+            static_cast<uint32_t>(myBufferBarriers.size()), myBufferBarriers.data(),
+            static_cast<uint32_t>(myImageBarriers.size()), myImageBarriers.data());
+        
+        myImageBarriers.clear();
+        myBufferBarriers.clear();
+        mySourceStages = 0;
+        myDestinationStages = 0;
+    }
+    
+    const uint32_t myQueueFamilyIndex;
+    const uint32_t myReaderQueueFamilyIndex;
+    VkCommandBuffer myCommandBuffer = VK_NULL_HANDLE;
+    std::vector<VkImageMemoryBarrier> myImageBarriers;
+    std::vector<VkBufferMemoryBarrier> myBufferBarriers;
+    VkPipelineStageFlags mySourceStages = 0;
+    VkPipelineStageFlags myDestinationStages = 0;
+    std::vector<VkImageMemoryBarrier> myAcquireImageBarriers;
+    std::vector<VkBufferMemoryBarrier> myAcquireBufferBarriers;
+    VkPipelineStageFlags myReaderStages = 0;
+};
+
+// records secondary command buffers for slices of a draw list on a set of threads, the calling thread records the
+// first slice itself and the others go to worker threads. every thread has its own command pool per frame in flight,
+// which is reset as a whole when that frame slot comes around again instead of freeing its command buffers.
+// the frame's primary command buffer comes out of the calling thread's pool
+class ParallelRecorder
+{
+public:
+    
+    typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end)> RecordFunction;
+    
+    void create(VkDevice device, uint32_t queueFamilyIndex, uint32_t frameCount, uint32_t threadCount)
+    {
+        assert(myWorkers.empty() && myThreadFrames.empty());
+        assert(frameCount > 0 && threadCount > 0);
+        
+        myDevice = device;
+        myFrameCount = frameCount;
+        myThreadCount = threadCount;
+        myThreadFrames.resize(frameCount * threadCount);
+        myPrimaryCommandBuffers.resize(frameCount);
+        mySecondaryCommandBuffers.resize(threadCount);
+        
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndex;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            for (uint32_t thread = 0; thread < threadCount; thread++)
+            {
+                ThreadFrame& threadFrame = myThreadFrames[frame * threadCount + thread];
+                CHECK_VKRESULT(vkCreateCommandPool(myDevice, &poolInfo, nullptr, &threadFrame.pool));
+                
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = threadFrame.pool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                allocInfo.commandBufferCount = 1;
+                
+                CHECK_VKRESULT(vkAllocateCommandBuffers(myDevice, &allocInfo, &threadFrame.secondaryCommandBuffer));
+                
+                if (thread == 0)
+                {
+                    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                    CHECK_VKRESULT(vkAllocateCommandBuffers(myDevice, &allocInfo, &myPrimaryCommandBuffers[frame]));
+                }
+            }
+        }
+        
+        myQuit = false;
+        for (uint32_t thread = 1; thread < threadCount; thread++)
+            myWorkers.emplace_back(&ParallelRecorder::workerMain, this, thread);
+    }
+    
+    void destroy()
+    {
+        {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myQuit = true;
+        }
+        myWorkAvailable.notify_all();
+        
+        for (std::thread& worker : myWorkers)
+            worker.join();
+        myWorkers.clear();
+        
+        // destroying the pools frees their command buffers
+        for (const ThreadFrame& threadFrame : myThreadFrames)
+            vkDestroyCommandPool(myDevice, threadFrame.pool, nullptr);
+        myThreadFrames.clear();
+        myPrimaryCommandBuffers.clear();
+        mySecondaryCommandBuffers.clear();
+    }
+    
+    uint32_t getThreadCount() const
+    {
+        return myThreadCount;
+    }
+    
+    // reset along with the secondaries in record(), so begin it after that
+    VkCommandBuffer getPrimaryCommandBuffer(uint32_t frame) const
+    {
+        return myPrimaryCommandBuffers[frame];
+    }
+    
+    // the command buffers of frame must have finished executing. function is called once per thread, possibly with
+    // an empty slice, and only reads shared state. returns one secondary command buffer per thread, in draw order
+    const std::vector<VkCommandBuffer>& record(uint32_t frame, uint32_t itemCount, const VkCommandBufferInheritanceInfo& inheritance, const RecordFunction& function)
+    {
+        assert(frame < myFrameCount);
+        
+        {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myJobFrame = frame;
+            myJobItemCount = itemCount;
+            myJobInheritance = &inheritance;
+            myJobFunction = &function;
+            myPendingWorkers = myThreadCount - 1;
+            myJobSerial++;
+        }
+        myWorkAvailable.notify_all();
+        
+        recordSlice(0);
+        
+        std::unique_lock<std::mutex> lock(myMutex);
+        myWorkDone.wait(lock, [this] { return myPendingWorkers == 0; });
+        
+        return mySecondaryCommandBuffers;
+    }
+    
+private:
+    
+    struct ThreadFrame
+    {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        VkCommandBuffer secondaryCommandBuffer = VK_NULL_HANDLE;
+    };
+    
+    void workerMain(uint32_t thread)
+    {
+        uint64_t jobSerial = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(myMutex);
+                myWorkAvailable.wait(lock, [this, jobSerial] { return myQuit || myJobSerial != jobSerial; });
+                if (myQuit)
+                    return;
+                
+                jobSerial = myJobSerial;
+            }
+            
+            recordSlice(thread);
+            
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (--myPendingWorkers == 0)
+                    myWorkDone.notify_one();
+            }
+        }
+    }
+    
+    // the job is only written while all workers are waiting, so it can be read here without the lock
+    void recordSlice(uint32_t thread)
+    {
+        ThreadFrame& threadFrame = myThreadFrames[myJobFrame * myThreadCount + thread];
+        CHECK_VKRESULT(vkResetCommandPool(myDevice, threadFrame.pool, 0));
+        
+        uint32_t begin = static_cast<uint32_t>(uint64_t(myJobItemCount) * thread / myThreadCount);
+        uint32_t end = static_cast<uint32_t>(uint64_t(myJobItemCount) * (thread + 1) / myThreadCount);
+        
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = myJobInheritance;
+        
+        CHECK_VKRESULT(vkBeginCommandBuffer(threadFrame.secondaryCommandBuffer, &beginInfo));
+        (*myJobFunction)(threadFrame.secondaryCommandBuffer, begin, end);
+        CHECK_VKRESULT(vkEndCommandBuffer(threadFrame.secondaryCommandBuffer));
+        
+        mySecondaryCommandBuffers[thread] = threadFrame.secondaryCommandBuffer;
+    }
+    
+    VkDevice myDevice = VK_NULL_HANDLE;
+    uint32_t myFrameCount = 0;
+    uint32_t myThreadCount = 0;
+    std::vector<ThreadFrame> myThreadFrames; // frame * myThreadCount + thread
+    std::vector<VkCommandBuffer> myPrimaryCommandBuffers;
+    std::vector<VkCommandBuffer> mySecondaryCommandBuffers;
+    std::vector<std::thread> myWorkers;
+    std::mutex myMutex;
+    std::condition_variable myWorkAvailable;
+    std::condition_variable myWorkDone;
+    uint64_t myJobSerial = 0;
+    uint32_t myPendingWorkers = 0;
+    bool myQuit = false;
+    uint32_t myJobFrame = 0;
+    uint32_t myJobItemCount = 0;
+    const VkCommandBufferInheritanceInfo* myJobInheritance = nullptr;
+    const RecordFunction* myJobFunction = nullptr;
+};
+
+// many threads push, one thread pops, and neither takes a lock. pushes go onto a linked stack that the consumer takes
+// over as a whole and reverses, so what one thread pushes comes out in the order it went in
+template <typename T>
+class MPSCQueue
+{
+public:
+    
+    MPSCQueue() = default;
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+    
+    ~MPSCQueue()
+    {
+        T item;
+        while (pop(item))
+            continue;
+    }
+    
+    // from any thread
+    void push(T item)
+    {
+        Node* node = new Node{ std::move(item), myHead.load(std::memory_order_relaxed) };
+        while (!myHead.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+            continue; // node->next is the new head now
+    }
+    
+    // from the consumer thread only
+    bool pop(T& outItem)
+    {
+        if (myPopped == nullptr)
+        {
+            for (Node* node = myHead.exchange(nullptr, std::memory_order_acquire); node != nullptr;)
+            {
+                Node* next = node->next;
+                node->next = myPopped;
+                myPopped = node;
+                node = next;
+            }
+            
+            if (myPopped == nullptr)
+                return false;
+        }
+        
+        Node* node = myPopped;
+        myPopped = node->next;
+        outItem = std::move(node->item);
+        delete node;
+        
+        return true;
+    }
+    
+private:
+    
+    struct Node
+    {
+        T item;
+        Node* next;
+    };
+    
+    std::atomic<Node*> myHead{ nullptr };
+    Node* myPopped = nullptr; // the consumer's, oldest first
+};
+
+// threads of its own for the file I/O and decoding of assets, which the render thread must never wait for. jobs run in
+// the order they were queued and hand back their results themselves, e.g. through an MPSCQueue
+class AssetLoader
+{
+public:
+    
+    typedef std::function<void()> Job;
+    
+    void create(uint32_t threadCount)
+    {
+        assert(myWorkers.empty() && threadCount > 0);
+        
+        myQuit = false;
+        for (uint32_t thread = 0; thread < threadCount; thread++)
+            myWorkers.emplace_back(&AssetLoader::workerMain, this);
+    }
+    
+    // waits for the jobs that are running, the ones still queued are dropped
+    void destroy()
+    {
+        {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myQuit = true;
+            myJobs.clear();
+        }
+        myJobAvailable.notify_all();
+        
+        for (std::thread& worker : myWorkers)
+            worker.join();
+        myWorkers.clear();
+    }
+    
+    void enqueue(Job job)
+    {
+        assert(!myWorkers.empty());
+        
+        {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myJobs.push_back(std::move(job));
+        }
+        myJobAvailable.notify_one();
+    }
+    
+private:
+    
+    void workerMain()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(myMutex);
+                myJobAvailable.wait(lock, [this] { return myQuit || !myJobs.empty(); });
+                if (myQuit)
+                    return;
+                
+                job = std::move(myJobs.front());
+                myJobs.pop_front();
+            }
+            
+            job();
+        }
+    }
+    
+    std::vector<std::thread> myWorkers;
+    std::mutex myMutex;
+    std::condition_variable myJobAvailable;
+    std::deque<Job> myJobs;
+    bool myQuit = false;
+};
+
+// gpu time of named scopes, from pairs of timestamps written around them in each frame's command buffers. there is a
+// pair of queries per scope and frame in flight, so a frame's results are read once its fence has signalled, frames in
+// flight later, and nothing waits for them. each scope keeps its last HistorySize times for min, mean and p99, and
+// sums up all of them
+class GpuProfiler
+{
+public:
+    
+    enum
+    {
+        HistorySize = 256,
+    };
+    
+    struct ScopeStats
+    {
+        const char* name;
+        double minMilliseconds;
+        double meanMilliseconds;
+        double p99Milliseconds;
+        uint32_t frameCount; // in the history
+        double totalMilliseconds; // of all frames so far
+        uint64_t totalFrameCount;
+    };
+    
+    // without timestamps on the queue, i.e. zero validBits, nothing is measured
+    void create(VkDevice device, uint32_t frameCount, uint32_t validBits, float period, std::vector<const char*> scopeNames)
+    {
+        assert(myQueryPool == VK_NULL_HANDLE);
+        
+        myDevice = device;
+        myValidBits = validBits;
+        myPeriod = period;
+        myScopes.resize(scopeNames.size());
+        for (size_t scope = 0; scope < myScopes.size(); scope++)
+            myScopes[scope].name = scopeNames[scope];
+        myWritten.assign(frameCount * myScopes.size(), 0);
+        
+        if (validBits == 0)
+            return;
+        
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(2 * myWritten.size());
+        
+        CHECK_VKRESULT(vkCreateQueryPool(myDevice, &queryPoolInfo, nullptr, &myQueryPool));
+    }
+    
+    void destroy()
+    {
+        if (myQueryPool != VK_NULL_HANDLE)
+            vkDestroyQueryPool(myDevice, myQueryPool, nullptr);
+        myQueryPool = VK_NULL_HANDLE;
+        myScopes.clear();
+        myWritten.clear();
+    }
+    
+    // outside of a render pass, before the scope's timestamps in this frame. they can be in another command buffer,
+    // as long as it runs after this one
+    void resetScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+    {
+        if (myQueryPool != VK_NULL_HANDLE)
+            vkCmdResetQueryPool(commandBuffer, myQueryPool, getQuery(frame, scope), 2);
+    }
+    
+    // a scope can begin and end in different command buffers, and be written on any thread, as long as every scope is
+    // only written on one at a time
+    void beginScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+    {
+        if (myQueryPool != VK_NULL_HANDLE)
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, myQueryPool, getQuery(frame, scope));
+    }
+    
+    void endScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope)
+    {
+        if (myQueryPool == VK_NULL_HANDLE)
+            return;
+        
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, myQueryPool, getQuery(frame, scope) + 1);
+        myWritten[frame * myScopes.size() + scope] = 1;
+    }
+    
+    // once the frame's fence has signalled, and before its command buffers are recorded again
+    void collect(uint32_t frame)
+    {
+        const uint64_t mask = myValidBits < 64 ? (uint64_t(1) << myValidBits) - 1 : ~uint64_t(0);
+        for (uint32_t scope = 0; scope < myScopes.size(); scope++)
+        {
+            uint8_t& written = myWritten[frame * myScopes.size() + scope];
+            if (!written)
+                continue;
+            
+            written = 0;
+            
+            // the fence has signalled, so the results are there, VK_NOT_READY would mean they never will be
+            uint64_t timestamps[2];
+            if (vkGetQueryPoolResults(myDevice, myQueryPool, getQuery(frame, scope), 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+                continue;
+            
+            Scope& scopeData = myScopes[scope];
+            const double milliseconds = static_cast<double>((timestamps[1] - timestamps[0]) & mask) * myPeriod * 1e-6;
+            if (scopeData.history.size() < HistorySize)
+                scopeData.history.push_back(milliseconds);
+            else
+                scopeData.history[scopeData.totalFrameCount % HistorySize] = milliseconds;
+            scopeData.totalMilliseconds += milliseconds;
+            scopeData.totalFrameCount++;
+        }
+    }
+    
+    uint32_t getScopeCount() const
+    {
+        return static_cast<uint32_t>(myScopes.size());
+    }
+    
+    ScopeStats getScopeStats(uint32_t scope) const
+    {
+        const Scope& scopeData = myScopes[scope];
+        
+        ScopeStats stats = {};
+        stats.name = scopeData.name;
+        stats.frameCount = static_cast<uint32_t>(scopeData.history.size());
+        stats.totalMilliseconds = scopeData.totalMilliseconds;
+        stats.totalFrameCount = scopeData.totalFrameCount;
+        if (scopeData.history.empty())
+            return stats;
+        
+        std::vector<double> history = scopeData.history;
+        std::sort(history.begin(), history.end());
+        stats.minMilliseconds = history.front();
+        stats.p99Milliseconds = history[std::min(history.size() - 1, static_cast<size_t>(history.size() * 0.99))];
+        for (double milliseconds : history)
+            stats.meanMilliseconds += milliseconds;
+        stats.meanMilliseconds /= history.size();
+        
+        return stats;
+    }
+    
+private:
+    
+    struct Scope
+    {
+        const char* name = nullptr;
+        std::vector<double> history; // a ring once it is full
+        double totalMilliseconds = 0.0;
+        uint64_t totalFrameCount = 0;
+    };
+    
+    uint32_t getQuery(uint32_t frame, uint32_t scope) const
+    {
+        return static_cast<uint32_t>(2 * (frame * myScopes.size() + scope));
+    }
+    
+    VkDevice myDevice = VK_NULL_HANDLE;
+    VkQueryPool myQueryPool = VK_NULL_HANDLE;
+    uint32_t myValidBits = 0;
+    float myPeriod = 1.0f; // nanoseconds per tick
+    std::vector<Scope> myScopes;
+    std::vector<uint8_t> myWritten; // frame * scope count + scope, not a vector<bool> because threads write it
+};
+
+// hands out the slots of the bindless texture array, lowest first, and takes them back for reuse. a slot must not be
+// freed while a frame that samples it is still in flight
+class TextureSlotAllocator
+{
+public:
+    
+    enum : uint32_t
+    {
+        InvalidSlot = ~0u,
+    };
+    
+    void create(uint32_t capacity)
+    {
+        myCapacity = capacity;
+        myNextSlot = 0;
+        myFreeSlots.clear();
+    }
+    
+    // InvalidSlot when all of them are taken
+    uint32_t allocate()
+    {
+        if (!myFreeSlots.empty())
+        {
+            uint32_t slot = myFreeSlots.back();
+            myFreeSlots.pop_back();
+            return slot;
+        }
+        
+        if (myNextSlot == myCapacity)
+            return InvalidSlot;
+        
+        return myNextSlot++;
+    }
+    
+    void free(uint32_t slot)
+    {
+        assert(slot < myNextSlot);
+        assert(std::find(myFreeSlots.begin(), myFreeSlots.end(), slot) == myFreeSlots.end());
+        
+        myFreeSlots.push_back(slot);
+    }
+    
+    uint32_t getCapacity() const { return myCapacity; }
+    
+private:
+    
+    uint32_t myCapacity = 0;
+    uint32_t myNextSlot = 0; // the slots from here on have never been handed out
+    std::vector<uint32_t> myFreeSlots;
+};
+
+// descriptor sets come out of a list of pools. when the current pool runs out the next one is used, and when there is
+// none left a new one twice the size of the last is added. sets aren't freed one by one, reset() recycles all pools
+// at once, which is how the per frame allocators hand out transient sets. not thread safe
+class DescriptorAllocator
+{
+public:
+    
+    enum : uint32_t
+    {
+        MaxSetsPerPool = 4096,
+    };
+    
+    // the pool sizes are per set, a pool of n sets has room for n times as many descriptors of every type
+    void create(VkDevice device, uint32_t initialMaxSets, const std::vector<VkDescriptorPoolSize>& poolSizesPerSet)
+    {
+        assert(myPools.empty());
+        assert(initialMaxSets > 0);
+        
+        myDevice = device;
+        myNextMaxSets = std::min<uint32_t>(initialMaxSets, MaxSetsPerPool);
+        myPoolSizesPerSet = poolSizesPerSet;
+        myCurrentPool = 0;
+    }
+    
+    void destroy()
+    {
+        for (Pool& pool : myPools)
+            vkDestroyDescriptorPool(myDevice, pool.pool, nullptr);
+        
+        myPools.clear();
+        myCurrentPool = 0;
+    }
+    
+    VkDescriptorSet allocate(VkDescriptorSetLayout layout)
+    {
+        for (;;)
+        {
+            if (myCurrentPool == myPools.size())
+                addPool();
+            
+            Pool& pool = myPools[myCurrentPool];
+            if (pool.setCount < pool.maxSets)
+            {
+                VkDescriptorSetAllocateInfo allocInfo = {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+                allocInfo.descriptorPool = pool.pool;
+                allocInfo.descriptorSetCount = 1;
+                allocInfo.pSetLayouts = &layout;
+                
+                VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+                VkResult result = vkAllocateDescriptorSets(myDevice, &allocInfo, &descriptorSet);
+                if (result == VK_SUCCESS)
+                {
+                    pool.setCount++;
+                    return descriptorSet;
+                }
+                
+                // only the sets are counted here, the pool can run out of some type of descriptor before that
+                if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+                    throw std::runtime_error("failed to allocate descriptor set!");
+                
+                if (pool.setCount == 0)
+                    throw std::runtime_error("descriptor set layout doesn't fit the descriptor pool sizes!");
+            }
+            
+            myCurrentPool++;
+        }
+    }
+    
+    // all sets allocated so far become invalid, no frame in flight may still be using them
+    void reset()
+    {
+        for (size_t i = 0; i < myPools.size() && i <= myCurrentPool; i++)
+        {
+            CHECK_VKRESULT(vkResetDescriptorPool(myDevice, myPools[i].pool, 0));
+            myPools[i].setCount = 0;
+        }
+        
+        myCurrentPool = 0;
+    }
+    
+private:
+    
+    void addPool()
+    {
+        std::vector<VkDescriptorPoolSize> poolSizes(myPoolSizesPerSet);
+        for (VkDescriptorPoolSize& poolSize : poolSizes)
+            poolSize.descriptorCount *= myNextMaxSets;
+        
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = myNextMaxSets;
+        
+        Pool pool;
+        pool.maxSets = myNextMaxSets;
+        CHECK_VKRESULT(vkCreateDescriptorPool(myDevice, &poolInfo, nullptr, &pool.pool));
+        myPools.push_back(pool);
+        
+        myNextMaxSets = std::min<uint32_t>(myNextMaxSets * 2, MaxSetsPerPool);
+    }
+    
+    struct Pool
+    {
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        uint32_t maxSets = 0;
+        uint32_t setCount = 0;
+    };
+    
+    VkDevice myDevice = VK_NULL_HANDLE;
+    std::vector<Pool> myPools;
+    size_t myCurrentPool = 0; // the pools before it are full
+    uint32_t myNextMaxSets = 0;
+    std::vector<VkDescriptorPoolSize> myPoolSizesPerSet;
+};
+
+// a descriptor set layout and the update template that writes a whole set of it from a struct of descriptor infos, at
+// the offsets and strides the bindings give. without templates, on a 1.0 device, the same entries become plain writes
+class DescriptorLayout
+{
+public:
+    
+    struct Binding
+    {
+        VkDescriptorType type;
+        uint32_t count;
+        VkShaderStageFlags stages;
+        const VkSampler* immutableSamplers;
+        size_t offset; // of the binding's first descriptor info in the update data
+        size_t stride; // between the descriptor infos of an array
+    };
+    
+    // bindings[i] is binding i. flags and next go into the layout's create info
+    void create(VkDevice device, bool useTemplate, const std::vector<Binding>& bindings, VkDescriptorSetLayoutCreateFlags flags = 0, const void* next = nullptr)
+    {
+        assert(myLayout == VK_NULL_HANDLE);
+        
+        myDevice = device;
+        
+        std::vector<VkDescriptorSetLayoutBinding> layoutBindings(bindings.size());
+        myEntries.resize(bindings.size());
+        for (uint32_t i = 0; i < bindings.size(); i++)
+        {
+            layoutBindings[i].binding = i;
+            layoutBindings[i].descriptorType = bindings[i].type;
+            layoutBindings[i].descriptorCount = bindings[i].count;
+            layoutBindings[i].stageFlags = bindings[i].stages;
+            layoutBindings[i].pImmutableSamplers = bindings[i].immutableSamplers;
+            
+            myEntries[i].dstBinding = i;
+            myEntries[i].dstArrayElement = 0;
+            myEntries[i].descriptorCount = bindings[i].count;
+            myEntries[i].descriptorType = bindings[i].type;
+            myEntries[i].offset = bindings[i].offset;
+            myEntries[i].stride = bindings[i].stride;
+        }
+        
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext = next;
+        layoutInfo.flags = flags;
+        layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+        layoutInfo.pBindings = layoutBindings.data();
+        
+        CHECK_VKRESULT(vkCreateDescriptorSetLayout(myDevice, &layoutInfo, nullptr, &myLayout));
+        
+        if (useTemplate)
+        {
+            VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+            templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+            templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(myEntries.size());
+            templateInfo.pDescriptorUpdateEntries = myEntries.data();
+            templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+            templateInfo.descriptorSetLayout = myLayout;
+            
+            CHECK_VKRESULT(vkCreateDescriptorUpdateTemplate(myDevice, &templateInfo, nullptr, &myUpdateTemplate));
+        }
+    }
+    
+    void destroy()
+    {
+        if (myUpdateTemplate != VK_NULL_HANDLE)
+            vkDestroyDescriptorUpdateTemplate(myDevice, myUpdateTemplate, nullptr);
+        vkDestroyDescriptorSetLayout(myDevice, myLayout, nullptr);
+        
+        myUpdateTemplate = VK_NULL_HANDLE;
+        myLayout = VK_NULL_HANDLE;
+    }
+    
+    VkDescriptorSetLayout get() const { return myLayout; }
+    
+    // writes all bindings of the set from data
+    void update(VkDescriptorSet descriptorSet, const void* data) const
+    {
+        if (myUpdateTemplate != VK_NULL_HANDLE)
+        {
+            vkUpdateDescriptorSetWithTemplate(myDevice, descriptorSet, myUpdateTemplate, data);
+            return;
+        }
+        
+        // the infos of an array have to be next to each other in a write
+        size_t descriptorCount = 0;
+        for (const VkDescriptorUpdateTemplateEntry& entry : myEntries)
+            descriptorCount += entry.descriptorCount;
+        
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        std::vector<VkDescriptorBufferInfo> bufferInfos;
+        imageInfos.reserve(descriptorCount);
+        bufferInfos.reserve(descriptorCount);
+        
+        std::vector<VkWriteDescriptorSet> descriptorWrites(myEntries.size());
+        for (size_t i = 0; i < myEntries.size(); i++)
+        {
+            const VkDescriptorUpdateTemplateEntry& entry = myEntries[i];
+            const char* infos = static_cast<const char*>(data) + entry.offset;
+            
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = descriptorSet;
+            descriptorWrites[i].dstBinding = entry.dstBinding;
+            descriptorWrites[i].dstArrayElement = entry.dstArrayElement;
+            descriptorWrites[i].descriptorType = entry.descriptorType;
+            descriptorWrites[i].descriptorCount = entry.descriptorCount;
+            
+            if (isImageType(entry.descriptorType))
+            {
+                descriptorWrites[i].pImageInfo = imageInfos.data() + imageInfos.size();
+                for (uint32_t j = 0; j < entry.descriptorCount; j++)
+                    imageInfos.push_back(*reinterpret_cast<const VkDescriptorImageInfo*>(infos + j * entry.stride));
+            }
+            else
+            {
+                descriptorWrites[i].pBufferInfo = bufferInfos.data() + bufferInfos.size();
+                for (uint32_t j = 0; j < entry.descriptorCount; j++)
+                    bufferInfos.push_back(*reinterpret_cast<const VkDescriptorBufferInfo*>(infos + j * entry.stride));
+            }
+        }
+        
+        vkUpdateDescriptorSets(myDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+    
+    // what update would write, field by field so that padding doesn't matter
+    void appendKey(const void* data, std::string& key) const
+    {
+        key.append(reinterpret_cast<const char*>(&myLayout), sizeof(myLayout));
+        
+        for (const VkDescriptorUpdateTemplateEntry& entry : myEntries)
+        {
+            const char* infos = static_cast<const char*>(data) + entry.offset;
+            for (uint32_t j = 0; j < entry.descriptorCount; j++)
+            {
+                if (isImageType(entry.descriptorType))
+                {
+                    const VkDescriptorImageInfo& imageInfo = *reinterpret_cast<const VkDescriptorImageInfo*>(infos + j * entry.stride);
+                    key.append(reinterpret_cast<const char*>(&imageInfo.sampler), sizeof(imageInfo.sampler));
+                    key.append(reinterpret_cast<const char*>(&imageInfo.imageView), sizeof(imageInfo.imageView));
+                    key.append(reinterpret_cast<const char*>(&imageInfo.imageLayout), sizeof(imageInfo.imageLayout));
+                }
+                else
+                {
+                    const VkDescriptorBufferInfo& bufferInfo = *reinterpret_cast<const VkDescriptorBufferInfo*>(infos + j * entry.stride);
+                    key.append(reinterpret_cast<const char*>(&bufferInfo.buffer), sizeof(bufferInfo.buffer));
+                    key.append(reinterpret_cast<const char*>(&bufferInfo.offset), sizeof(bufferInfo.offset));
+                    key.append(reinterpret_cast<const char*>(&bufferInfo.range), sizeof(bufferInfo.range));
+                }
+            }
+        }
+    }
+    
+private:
+    
+    // texel buffer views aren't used by any layout
+    static bool isImageType(VkDescriptorType type)
+    {
+        assert(type != VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER && type != VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
+        
+        return type == VK_DESCRIPTOR_TYPE_SAMPLER || type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+            type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE || type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE ||
+            type == VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    }
+    
+    VkDevice myDevice = VK_NULL_HANDLE;
+    VkDescriptorSetLayout myLayout = VK_NULL_HANDLE;
+    VkDescriptorUpdateTemplate myUpdateTemplate = VK_NULL_HANDLE;
+    std::vector<VkDescriptorUpdateTemplateEntry> myEntries;
+};
+
+// persistent descriptor sets, looked up by their layout and what is written to them, so asking twice for the same
+// bindings gives back the same set. the sets come out of an allocator that is never reset and live as long as it does,
+// the ones given back with recycle are written again for the next bindings that miss
+class DescriptorSetCache
+{
+public:
+    
+    void create(DescriptorAllocator* allocator)
+    {
+        myAllocator = allocator;
+        mySets.clear();
+        myFreeSets.clear();
+    }
+    
+    void destroy()
+    {
+        myAllocator = nullptr;
+        mySets.clear();
+        myFreeSets.clear();
+    }
+    
+    VkDescriptorSet get(const DescriptorLayout& layout, const void* data)
+    {
+        std::string key;
+        layout.appendKey(data, key);
+        
+        auto it = mySets.find(key);
+        if (it != mySets.end())
+            return it->second;
+        
+        VkDescriptorSet descriptorSet;
+        std::vector<VkDescriptorSet>& freeSets = myFreeSets[layout.get()];
+        if (!freeSets.empty())
+        {
+            descriptorSet = freeSets.back();
+            freeSets.pop_back();
+        }
+        else
+        {
+            descriptorSet = myAllocator->allocate(layout.get());
+        }
+        layout.update(descriptorSet, data);
+        mySets.emplace(std::move(key), descriptorSet);
+        
+        return descriptorSet;
+    }
+    
+    // for bindings that won't be asked for again, e.g. because the image view is about to be destroyed. no frame in
+    // flight may still be using the set
+    void recycle(const DescriptorLayout& layout, const void* data)
+    {
+        std::string key;
+        layout.appendKey(data, key);
+        
+        auto it = mySets.find(key);
+        assert(it != mySets.end());
+        
+        myFreeSets[layout.get()].push_back(it->second);
+        mySets.erase(it);
+    }
+    
+private:
+    
+    DescriptorAllocator* myAllocator = nullptr;
+    std::unordered_map<std::string, VkDescriptorSet> mySets;
+    std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>> myFreeSets;
+};
+
+// which mip levels of the streamed textures should be in memory. every texture has its levels from a base level to
+// the last one, and its base moves towards level 0 one level at a time, coarsest textures first, while the budget has
+// room. when it hasn't, the textures drawn least recently give up their finest levels. only the bookkeeping, the app
+// makes the images and says when they are done
+class TextureResidency
+{
+public:
+    
+    struct Request
+    {
+        uint32_t texture;
+        uint baseLevel;
+    };
+    
+    // residentSizes[level] is the size of an image with the levels from level on, coarsestBaseLevel is the base every
+    // texture starts with and never goes above
+    void create(uint32_t textureCount, const std::vector<VkDeviceSize>& residentSizes, uint coarsestBaseLevel)
+    {
+        assert(coarsestBaseLevel < residentSizes.size());
+        
+        myResidentSizes = residentSizes;
+        myCoarsestBaseLevel = coarsestBaseLevel;
+        myEntries.assign(textureCount, Entry());
+        for (Entry& entry : myEntries)
+            entry.baseLevel = entry.targetBaseLevel = coarsestBaseLevel;
+        myResidentBytes = textureCount * residentSizes[coarsestBaseLevel];
+        myLoadedLevelCount = 0;
+        myEvictedLevelCount = 0;
+    }
+    
+    // a sprite with the texture is on screen, covering that much of it, and needs its levels from baseLevel on
+    void markUsed(uint32_t texture, uint64_t frame, uint baseLevel, float coverage)
+    {
+        Entry& entry = myEntries[texture];
+        if (entry.lastUsedFrame != frame || !entry.used)
+        {
+            entry.lastUsedFrame = frame;
+            entry.used = true;
+            entry.wantedBaseLevel = myCoarsestBaseLevel;
+            entry.coverage = 0;
+        }
+        entry.wantedBaseLevel = std::min(entry.wantedBaseLevel, std::min(baseLevel, myCoarsestBaseLevel));
+        entry.coverage += coverage;
+    }
+    
+    // the base levels to change to, after the textures used in frame have been marked. evictions go first and are
+    // done whatever they cost, loading finer levels stops at about maxUploadBytes of images. a texture with a request is
+    // left alone until it is committed or cancelled
+    void plan(uint64_t frame, VkDeviceSize budgetBytes, VkDeviceSize maxUploadBytes, std::vector<Request>& outRequests)
+    {
+        outRequests.clear();
+        
+        VkDeviceSize plannedBytes = 0;
+        for (const Entry& entry : myEntries)
+            plannedBytes += myResidentSizes[entry.targetBaseLevel];
+        
+        // least recently used first, then the ones with more levels than they need, then the smallest on screen
+        std::vector<uint32_t> victims;
+        for (uint32_t texture = 0; texture < myEntries.size(); texture++)
+        {
+            const Entry& entry = myEntries[texture];
+            if (!isPending(entry) && entry.baseLevel < myCoarsestBaseLevel)
+                victims.push_back(texture);
+        }
+        std::sort(victims.begin(), victims.end(), [this, frame](uint32_t lhs, uint32_t rhs)
+        {
+            const Entry& l = myEntries[lhs];
+            const Entry& r = myEntries[rhs];
+            if (l.lastUsedFrame != r.lastUsedFrame || l.used != r.used)
+                return !l.used || (r.used && l.lastUsedFrame < r.lastUsedFrame);
+            if (isSurplus(l, frame) != isSurplus(r, frame))
+                return isSurplus(l, frame);
+            return l.coverage < r.coverage;
+        });
+        
+        std::vector<uint> plannedBaseLevels(myEntries.size());
+        for (uint32_t texture = 0; texture < myEntries.size(); texture++)
+            plannedBaseLevels[texture] = myEntries[texture].targetBaseLevel;
+        
+        // takes away the finest levels of the victims until plannedBytes + neededBytes fits, only those that aren't on
+        // screen or have levels to spare unless anything goes
+        auto evict = [&](VkDeviceSize neededBytes, bool anything)
+        {
+            for (uint32_t texture : victims)
+            {
+                const Entry& entry = myEntries[texture];
+                if (!anything && !isSurplus(entry, frame))
+                    continue;
+                
+                // textures that are on screen keep what their sprites need
+                uint& baseLevel = plannedBaseLevels[texture];
+                const bool onScreen = entry.used && entry.lastUsedFrame == frame;
+                const uint lowestBaseLevel = anything || !onScreen ? myCoarsestBaseLevel : std::max(entry.wantedBaseLevel, baseLevel);
+                while (plannedBytes + neededBytes > budgetBytes && baseLevel < lowestBaseLevel)
+                {
+                    plannedBytes -= myResidentSizes[baseLevel] - myResidentSizes[baseLevel + 1];
+                    baseLevel++;
+                }
+                
+                if (plannedBytes + neededBytes <= budgetBytes)
+                    return true;
+            }
+            
+            return plannedBytes + neededBytes <= budgetBytes;
+        };
+        
+        evict(0, true);
+        
+        // the ones furthest from what they need first, so every texture on screen gets a level before any gets two
+        std::vector<uint32_t> candidates;
+        for (uint32_t texture = 0; texture < myEntries.size(); texture++)
+        {
+            const Entry& entry = myEntries[texture];
+            if (!isPending(entry) && plannedBaseLevels[texture] == entry.baseLevel && entry.used && entry.lastUsedFrame == frame && entry.wantedBaseLevel < entry.baseLevel)
+                candidates.push_back(texture);
+        }
+        std::sort(candidates.begin(), candidates.end(), [this](uint32_t lhs, uint32_t rhs)
+        {
+            const Entry& l = myEntries[lhs];
+            const Entry& r = myEntries[rhs];
+            if (l.baseLevel - l.wantedBaseLevel != r.baseLevel - r.wantedBaseLevel)
+                return l.baseLevel - l.wantedBaseLevel > r.baseLevel - r.wantedBaseLevel;
+            return l.coverage > r.coverage;
+        });
+        
+        VkDeviceSize uploadBytes = 0;
+        for (uint32_t texture : candidates)
+        {
+            const uint baseLevel = plannedBaseLevels[texture] - 1;
+            const VkDeviceSize neededBytes = myResidentSizes[baseLevel] - myResidentSizes[baseLevel + 1];
+            if ((uploadBytes > 0 && uploadBytes + myResidentSizes[baseLevel] > maxUploadBytes) || !evict(neededBytes, false))
+                break;
+            
+            plannedBaseLevels[texture] = baseLevel;
+            plannedBytes += neededBytes;
+            uploadBytes += myResidentSizes[baseLevel];
+        }
+        
+        for (uint32_t texture = 0; texture < myEntries.size(); texture++)
+        {
+            Entry& entry = myEntries[texture];
+            if (plannedBaseLevels[texture] == entry.targetBaseLevel)
+                continue;
+            
+            entry.targetBaseLevel = plannedBaseLevels[texture];
+            outRequests.push_back({ texture, entry.targetBaseLevel });
+        }
+    }
+    
+    // the texture's image now has the levels it was asked for
+    void commit(uint32_t texture)
+    {
+        Entry& entry = myEntries[texture];
+        assert(isPending(entry));
+        
+        if (entry.targetBaseLevel < entry.baseLevel)
+            myLoadedLevelCount += entry.baseLevel - entry.targetBaseLevel;
+        else
+            myEvictedLevelCount += entry.targetBaseLevel - entry.baseLevel;
+        
+        myResidentBytes = myResidentBytes - myResidentSizes[entry.baseLevel] + myResidentSizes[entry.targetBaseLevel];
+        entry.baseLevel = entry.targetBaseLevel;
+    }
+    
+    // the texture keeps the levels it has, e.g. because there wasn't the memory for the new image after all
+    void cancel(uint32_t texture)
+    {
+        Entry& entry = myEntries[texture];
+        entry.targetBaseLevel = entry.baseLevel;
+    }
+    
+    uint getCoarsestBaseLevel() const { return myCoarsestBaseLevel; }
+    VkDeviceSize getResidentBytes() const { return myResidentBytes; }
+    uint getLoadedLevelCount() const { return myLoadedLevelCount; }
+    uint getEvictedLevelCount() const { return myEvictedLevelCount; }
+    
+private:
+    
+    struct Entry
+    {
+        uint baseLevel = 0; // of the image the texture has
+        uint targetBaseLevel = 0; // of the one it is getting, the same if there is no request
+        uint wantedBaseLevel = 0; // what its sprites need on screen, as of lastUsedFrame
+        float coverage = 0; // of the screen, by its sprites, as of lastUsedFrame
+        uint64_t lastUsedFrame = 0;
+        bool used = false; // lastUsedFrame is meaningless until it is
+    };
+    
+    static bool isPending(const Entry& entry)
+    {
+        return entry.targetBaseLevel != entry.baseLevel;
+    }
+    
+    // has finer levels than its sprites need, or has no sprites on screen
+    static bool isSurplus(const Entry& entry, uint64_t frame)
+    {
+        return !entry.used || entry.lastUsedFrame != frame || entry.baseLevel < entry.wantedBaseLevel;
+    }
+    
+    std::vector<VkDeviceSize> myResidentSizes;
+    uint myCoarsestBaseLevel = 0;
+    std::vector<Entry> myEntries;
+    VkDeviceSize myResidentBytes = 0;
+    uint myLoadedLevelCount = 0;
+    uint myEvictedLevelCount = 0;
+};
+
+// set with vktut2_set_pipeline_cache_path, before the app is created
+static std::string thePipelineCachePath;
+static bool theHasPipelineCachePath = false;
+// set with vktut2_set_texture_cache_path, before the app is created
+static std::string theTextureCachePath;
+static bool theHasTextureCachePath = false;
+// set with vktut2_set_draw_count, vktut2_set_recording_threads, vktut2_set_sprite_count, vktut2_set_gpu_culling,
+// vktut2_set_texture_count, vktut2_set_bindless_textures, vktut2_set_compressed_textures, vktut2_set_asset_pack and
+// vktut2_set_texture_budget, vktut2_set_present_mode, vktut2_set_swap_chain_images and vktut2_set_frames_in_flight,
+// before the app is created
+static uint32_t theDrawCount = 1;
+static uint32_t theRecordingThreadCount = 1;
+static uint32_t theSpriteCount = 1;
+static bool theGpuCulling = false;
+static uint32_t theTextureCount = 1;
+static bool theBindlessTextures = false;
+static bool theCompressedTextures = true;
+static bool theAssetPack = true;
+static uint32_t theTextureBudgetMegabytes = 0;
+static VkPresentModeKHR thePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+static uint32_t theSwapChainImageCount = 0;
+static uint32_t theFramesInFlight = 2;
+
+class VulkanTutorialApp
+{
+public:
+    
+    VulkanTutorialApp(void* view, int width, int height, float backingScaleFactor)
+    {
+        initVulkan(view, width, height, backingScaleFactor);
+    }
+    
+    // headless, renders into offscreen images instead of a swap chain and loads its resources from resourcePath
+    VulkanTutorialApp(int width, int height, const char* resourcePath)
+    : myHeadless(true)
+    , myResourcePath(resourcePath)
+    {
+        initVulkan(nullptr, width, height, 1.0f);
+    }
+    
+    ~VulkanTutorialApp()
+    {
+        cleanup();
+    }
+    
+    void draw(uint frameIndex)
+    {
+        drawFrame(frameIndex);
+    }
+    
+    void finish()
+    {
+        // oldest first, so that each wait ends about when its frame does
+        std::vector<uint> frames;
+        for (uint i = 0; i < myFramesInFlight; i++)
+            if (myFrameStartTimes[i] != FrameClock::time_point())
+                frames.push_back(i);
+        std::sort(frames.begin(), frames.end(), [this](uint a, uint b)
+        {
+            return myFrameStartTimes[a] < myFrameStartTimes[b];
+        });
+        for (uint frame : frames)
+        {
+            CHECK_VKRESULT(vkWaitForFences(myDevice, 1, &myInFlightFences[frame], VK_TRUE, std::numeric_limits<uint64_t>::max()));
+            collectFrameLatency(frame);
+        }
+        
+        CHECK_VKRESULT(vkDeviceWaitIdle(myDevice));
+        
+        for (uint32_t i = 0; i < myFramesInFlight; i++)
+            myGpuProfiler.collect(i);
+    }
+    
+    // gpu time of all frames that have finished so far
+    void getGpuStats(double& outTotalMilliseconds, uint& outFrameCount) const
+    {
+        const GpuProfiler::ScopeStats stats = myGpuProfiler.getScopeStats(GpuScopeFrame);
+        outTotalMilliseconds = stats.totalMilliseconds;
+        outFrameCount = static_cast<uint>(stats.totalFrameCount);
+    }
+    
+    // see GpuProfiler, the scopes are the GpuScope* ones
+    uint32_t getGpuScopeCount() const
+    {
+        return myGpuProfiler.getScopeCount();
+    }
+    
+    GpuProfiler::ScopeStats getGpuScopeStats(uint32_t scope) const
+    {
+        return myGpuProfiler.getScopeStats(scope);
+    }
+    
+    // textures that are still loading and show their placeholders
+    uint getPendingTextureLoads() const
+    {
+        return myPendingTextureLoads;
+    }
+    
+    // from where drawFrame reads the input, after waiting for a free frame in flight, until the gpu has finished the
+    // frame, of the frames that finished since the last call. the present and the display come on top. where the
+    // frame had already finished before drawFrame or finish waited for it, it counts as finishing then
+    void getLatencyStats(double& outMeanMilliseconds, double& outP99Milliseconds, uint& outFrameCount)
+    {
+        outFrameCount = static_cast<uint>(myFrameLatencies.size());
+        outMeanMilliseconds = 0.0;
+        outP99Milliseconds = 0.0;
+        if (myFrameLatencies.empty())
+            return;
+        
+        for (double latency : myFrameLatencies)
+            outMeanMilliseconds += latency;
+        outMeanMilliseconds /= myFrameLatencies.size();
+        
+        const size_t p99 = std::min(myFrameLatencies.size() - 1, static_cast<size_t>(myFrameLatencies.size() * 0.99));
+        std::nth_element(myFrameLatencies.begin(), myFrameLatencies.begin() + p99, myFrameLatencies.end());
+        outP99Milliseconds = myFrameLatencies[p99];
+        
+        myFrameLatencies.clear();
+    }
+    
+    // how much memory the streamed textures have and may have, and how many levels they have loaded and evicted
+    void getTextureStats(double& outResidentMegabytes, double& outBudgetMegabytes, uint& outLoadedLevelCount, uint& outEvictedLevelCount) const
+    {
+        outResidentMegabytes = myStreamTextures ? myTextureResidency.getResidentBytes() / (1024.0 * 1024.0) : 0.0;
+        outBudgetMegabytes = myStreamTextures ? getTextureBudget() / (1024.0 * 1024.0) : 0.0;
+        outLoadedLevelCount = myTextureResidency.getLoadedLevelCount();
+        outEvictedLevelCount = myTextureResidency.getEvictedLevelCount();
+    }
+    
+    // copies the last submitted offscreen image into rgba, width * height * 4 bytes
+    void readFrame(unsigned char* rgba)
+    {
+        assert(myHeadless);
+        
+        const VkExtent2D& extent = mySwapChainExtent;
+        VkDeviceSize size = VkDeviceSize(extent.width) * extent.height * 4;
+        
+        VkBuffer readbackBuffer;
+        VmaAllocation readbackBufferMemory;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory);
+        
+        CHECK_VKRESULT(vkDeviceWaitIdle(myDevice));
+        
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        
+        // the render pass leaves the offscreen images in TRANSFER_SRC_OPTIMAL
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { extent.width, extent.height, 1 };
+        vkCmdCopyImageToBuffer(commandBuffer, mySwapChainImages[myLastImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+        
+        endSingleTimeCommands(commandBuffer);
+        
+        void* data;
+        CHECK_VKRESULT(vmaMapMemory(myAllocator, readbackBufferMemory, &data));
+        const unsigned char* bgra = static_cast<const unsigned char*>(data);
+        for (VkDeviceSize i = 0; i < size; i += 4)
+        {
+            rgba[i + 0] = bgra[i + 2];
+            rgba[i + 1] = bgra[i + 1];
+            rgba[i + 2] = bgra[i + 0];
+            rgba[i + 3] = bgra[i + 3];
+        }
+        vmaUnmapMemory(myAllocator, readbackBufferMemory);
+        
+        vmaDestroyBuffer(myAllocator, readbackBuffer, readbackBufferMemory);
+    }
+    
+private:
+    
+    struct Texture; // with the other members, at the end
+    struct LoadedTexture;
+    
+    // the app bundle's resources when windowed, plain files in myResourcePath when headless
+    std::string getResourcePath(const char* name, const char* type) const
+    {
+        std::string path;
+        if (!findResourcePath(name, type, path))
+            throw std::runtime_error("failed to find resource!");
+        
+        return path;
+    }
+    
+    // false for resources that are optional and not there
+    bool findResourcePath(const char* name, const char* type, std::string& outPath) const
+    {
+#if defined(__APPLE__)
+        if (myResourcePath.empty())
+        {
+            CFStringRef nameString = CFStringCreateWithCString(kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+            CFStringRef typeString = CFStringCreateWithCString(kCFAllocatorDefault, type, kCFStringEncodingUTF8);
+            CFURLRef url = CFBundleCopyResourceURL(CFBundleGetMainBundle(), nameString, typeString, NULL);
+            CFRelease(typeString);
+            CFRelease(nameString);
+            if (url == NULL)
+                return false;
+            
+            char path[1024];
+            Boolean result = CFURLGetFileSystemRepresentation(url, true, reinterpret_cast<UInt8*>(path), sizeof(path));
+            CFRelease(url);
+            if (!result)
+                throw std::runtime_error("failed to get resource path!");
+            
+            outPath = path;
+            return true;
+        }
+#endif
+        
+        outPath = (myResourcePath.empty() ? std::string() : myResourcePath + "/") + name + "." + type;
+        return std::ifstream(outPath).good();
+    }
+    
+    void createInstance()
+    {
+        VkApplicationInfo appInfo = {};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_1;
+        
+        static const char* validationLayerName = "VK_LAYER_LUNARG_standard_validation";
+        
+        // the validation layer is used when it is installed, which it isn't on the build farm machines
+        std::vector<const char*> enabledLayerNames;
+        
+        uint32_t instanceLayerCount;
+        CHECK_VKRESULT(vkEnumerateInstanceLayerProperties(&instanceLayerCount, nullptr));
+        std::cout << instanceLayerCount << " layers found!\n";
+        if (instanceLayerCount > 0)
+        {
+            std::unique_ptr<VkLayerProperties[]> instanceLayers(new VkLayerProperties[instanceLayerCount]);
+            CHECK_VKRESULT(vkEnumerateInstanceLayerProperties(&instanceLayerCount, instanceLayers.get()));
+            for (int i = 0; i < instanceLayerCount; ++i)
+            {
+                std::cout << instanceLayers[i].layerName << "\n";
+                if (strcmp(instanceLayers[i].layerName, validationLayerName) == 0)
+                    enabledLayerNames.push_back(validationLayerName);
+            }
+        }
+        
+        uint32_t instanceExtensionCount;
+        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, nullptr);
+        
+        std::vector<VkExtensionProperties> availableInstanceExtensions(instanceExtensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &instanceExtensionCount, availableInstanceExtensions.data());
+        
+        std::vector<const char*> instanceExtensions(instanceExtensionCount);
+        for (uint i = 0; i < instanceExtensionCount; i++)
+            instanceExtensions[i] = availableInstanceExtensions[i].extensionName;
+        
+        std::sort(instanceExtensions.begin(), instanceExtensions.end(), [](const char* lhs, const char* rhs)
+        {
+            return strcmp(lhs, rhs) < 0;
+        });
+        
+        std::vector<const char*> requiredExtensions;
+        if (!myHeadless)
+        {
+            requiredExtensions.push_back("VK_KHR_surface");
+            requiredExtensions.push_back("VK_MVK_macos_surface");
+        }
+        
+        assert(std::includes(instanceExtensions.begin(), instanceExtensions.end(), requiredExtensions.begin(), requiredExtensions.end(), [](const char* lhs, const char* rhs)
+        {
+            return strcmp(lhs, rhs) < 0;
+        }));
+        
+        VkInstanceCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        info.pApplicationInfo = &appInfo;
+        info.enabledLayerCount = static_cast<uint32_t>(enabledLayerNames.size());
+        info.ppEnabledLayerNames = enabledLayerNames.data();
+        info.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
+        info.ppEnabledExtensionNames = instanceExtensions.data();
+        
+        CHECK_VKRESULT(vkCreateInstance(&info, NULL, &myInstance));
+    }
+    
+    void createDebugCallback()
+    {
+        VkDebugReportCallbackCreateInfoEXT debugCallbackInfo = {};
+        debugCallbackInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
+        debugCallbackInfo.flags = VK_DEBUG_REPORT_INFORMATION_BIT_EXT | VK_DEBUG_REPORT_PERFORMANCE_WARNING_BIT_EXT | VK_DEBUG_REPORT_DEBUG_BIT_EXT| VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
+        debugCallbackInfo.pfnCallback = debugCallback;
+        
+        auto vkCreateDebugReportCallbackEXT = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(myInstance, "vkCreateDebugReportCallbackEXT");
+        if (vkCreateDebugReportCallbackEXT == nullptr)
+            return; // no VK_EXT_debug_report, like on a bare software ICD
+        
+        CHECK_VKRESULT(vkCreateDebugReportCallbackEXT(myInstance, &debugCallbackInfo, nullptr, &myDebugCallback));
+    }
+    
+    void createSurface(void* view)
+    {
+#if defined(__APPLE__)
+        VkMacOSSurfaceCreateInfoMVK surfaceCreateInfo = {};
+        surfaceCreateInfo.sType = VK_STRUCTURE_TYPE_MACOS_SURFACE_CREATE_INFO_MVK;
+        surfaceCreateInfo.flags = 0;
+        surfaceCreateInfo.pView = view;
+        auto vkCreateMacOSSurfaceMVK = (PFN_vkCreateMacOSSurfaceMVK)vkGetInstanceProcAddr(myInstance, "vkCreateMacOSSurfaceMVK");
+        assert(vkCreateMacOSSurfaceMVK != nullptr);
+        CHECK_VKRESULT(vkCreateMacOSSurfaceMVK(myInstance, &surfaceCreateInfo, nullptr, &mySurface));
+#else
+        throw std::runtime_error("windowed mode is only implemented for macOS, use the headless backend!");
+#endif
+    }
+    
+    void createDevice()
+    {
+        uint32_t deviceCount = 0;
+        CHECK_VKRESULT(vkEnumeratePhysicalDevices(myInstance, &deviceCount, nullptr));
+        if (deviceCount == 0)
+            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+        
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        CHECK_VKRESULT(vkEnumeratePhysicalDevices(myInstance, &deviceCount, devices.data()));
+        
+        for (const auto& device : devices)
+        {
+            myQueueFamilyIndex = isDeviceSuitable(myInstance, mySurface, device);
+            if (myQueueFamilyIndex >= 0)
+            {
+                myPhysicalDevice = device;
+                break;
+            }
+        }
+        
+        if (myPhysicalDevice == VK_NULL_HANDLE)
+            throw std::runtime_error("failed to find a suitable GPU!");
+        
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(myPhysicalDevice, &deviceProperties);
+        myOptimalBufferCopyOffsetAlignment = deviceProperties.limits.optimalBufferCopyOffsetAlignment;
+        myHasDescriptorUpdateTemplates = deviceProperties.apiVersion >= VK_API_VERSION_1_1;
+        myMinUniformBufferOffsetAlignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+        myMinStorageBufferOffsetAlignment = deviceProperties.limits.minStorageBufferOffsetAlignment;
+        myMaxComputeWorkGroupCount = deviceProperties.limits.maxComputeWorkGroupCount[0];
+        myMaxDrawIndirectCount = deviceProperties.limits.maxDrawIndirectCount;
+        
+        // uploads run on a queue of their own where possible, so they don't serialize with rendering
+        uint32_t transferQueueIndex;
+        findTransferQueue(myPhysicalDevice, myQueueFamilyIndex, myTransferQueueFamilyIndex, transferQueueIndex);
+        
+        const float queuePriorities[] = { 1.0f, 0.5f }; // graphics, transfer
+        
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos(1);
+        VkDeviceQueueCreateInfo& queueCreateInfo = queueCreateInfos[0];
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = myQueueFamilyIndex;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfo.pQueuePriorities = &queuePriorities[0];
+        if (myTransferQueueFamilyIndex == myQueueFamilyIndex)
+        {
+            queueCreateInfo.queueCount = transferQueueIndex + 1;
+        }
+        else
+        {
+            VkDeviceQueueCreateInfo transferQueueCreateInfo = queueCreateInfo;
+            transferQueueCreateInfo.queueFamilyIndex = myTransferQueueFamilyIndex;
+            transferQueueCreateInfo.pQueuePriorities = &queuePriorities[1];
+            queueCreateInfos.push_back(transferQueueCreateInfo);
+        }
+        
+        VkPhysicalDeviceFeatures deviceFeatures = {};
+        deviceFeatures.samplerAnisotropy = VK_TRUE;
+        
+        // cooked textures are loaded in whichever block compressed formats the device has, see loadCookedTexture
+        VkPhysicalDeviceFeatures supportedDeviceFeatures;
+        vkGetPhysicalDeviceFeatures(myPhysicalDevice, &supportedDeviceFeatures);
+        deviceFeatures.textureCompressionBC = supportedDeviceFeatures.textureCompressionBC;
+        deviceFeatures.textureCompressionASTC_LDR = supportedDeviceFeatures.textureCompressionASTC_LDR;
+        
+        // gpu culling draws every work group's visible instances with an indirect draw of its own, see recordCulling
+        deviceFeatures.multiDrawIndirect = supportedDeviceFeatures.multiDrawIndirect;
+        deviceFeatures.drawIndirectFirstInstance = supportedDeviceFeatures.drawIndirectFirstInstance;
+        if (!deviceFeatures.multiDrawIndirect)
+            myMaxDrawIndirectCount = 1;
+        myHasDrawIndirectFirstInstance = deviceFeatures.drawIndirectFirstInstance;
+        
+        uint32_t deviceExtensionCount;
+        vkEnumerateDeviceExtensionProperties(myPhysicalDevice, nullptr, &deviceExtensionCount, nullptr);
+        
+        std::vector<VkExtensionProperties> availableDeviceExtensions(deviceExtensionCount);
+        vkEnumerateDeviceExtensionProperties(myPhysicalDevice, nullptr, &deviceExtensionCount, availableDeviceExtensions.data());
+        
+        assert(myHeadless || std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(), [](const VkExtensionProperties& extension)
+        {
+            return strcmp(extension.extensionName, "VK_KHR_swapchain") == 0;
+        }) != availableDeviceExtensions.end());
+        
+        // headless needs no extensions at all, and enabling everything a software ICD offers can be invalid
+        std::vector<const char*> deviceExtensions;
+        if (!myHeadless)
+        {
+            for (const auto& extension : availableDeviceExtensions)
+            {
+                if (strcmp(extension.extensionName, "VK_MVK_moltenvk") == 0 ||
+                    strcmp(extension.extensionName, "VK_KHR_surface") == 0 ||
+                    strcmp(extension.extensionName, "VK_MVK_macos_surface") == 0)
+                    continue;
+                
+                deviceExtensions.push_back(extension.extensionName);
+            }
+        }
+        
+        // a separate upload queue hands over to the graphics queue with a semaphore, one timeline semaphore if the
+        // device has them, a binary one per upload submit otherwise
+#if defined(VK_KHR_timeline_semaphore)
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+        timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+        
+        const bool hasTimelineSemaphoreExtension = std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(), [](const VkExtensionProperties& extension)
+        {
+            return strcmp(extension.extensionName, "VK_KHR_timeline_semaphore") == 0;
+        }) != availableDeviceExtensions.end();
+        
+        // the queues are fetched after device creation, so test the selected family and index instead of hasAsyncTransferQueue()
+        const bool usesAsyncTransferQueue = myTransferQueueFamilyIndex != myQueueFamilyIndex || transferQueueIndex != 0;
+        if (usesAsyncTransferQueue && hasTimelineSemaphoreExtension && deviceProperties.apiVersion >= VK_API_VERSION_1_1)
+        {
+            VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+            deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            deviceFeatures2.pNext = &timelineSemaphoreFeatures;
+            vkGetPhysicalDeviceFeatures2(myPhysicalDevice, &deviceFeatures2);
+            
+            myHasTimelineSemaphores = timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE;
+            if (myHasTimelineSemaphores && std::find_if(deviceExtensions.begin(), deviceExtensions.end(), [](const char* extensionName)
+            {
+                return strcmp(extensionName, "VK_KHR_timeline_semaphore") == 0;
+            }) == deviceExtensions.end())
+            {
+                deviceExtensions.push_back("VK_KHR_timeline_semaphore");
+            }
+        }
+#endif
+        
+        // bindless textures need a descriptor array that is indexed per fragment, partially bound, and written to
+        // while it is bound
+#if defined(VK_EXT_descriptor_indexing)
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+        descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        
+        const bool hasDescriptorIndexingExtension = std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(), [](const VkExtensionProperties& extension)
+        {
+            return strcmp(extension.extensionName, "VK_EXT_descriptor_indexing") == 0;
+        }) != availableDeviceExtensions.end();
+        
+        if (myBindlessTextures && hasDescriptorIndexingExtension && deviceProperties.apiVersion >= VK_API_VERSION_1_1)
+        {
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedFeatures = {};
+            supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+            
+            VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+            deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            deviceFeatures2.pNext = &supportedFeatures;
+            vkGetPhysicalDeviceFeatures2(myPhysicalDevice, &deviceFeatures2);
+            
+            if (supportedFeatures.shaderSampledImageArrayNonUniformIndexing == VK_TRUE &&
+                supportedFeatures.descriptorBindingSampledImageUpdateAfterBind == VK_TRUE &&
+                supportedFeatures.descriptorBindingUpdateUnusedWhilePending == VK_TRUE &&
+                supportedFeatures.descriptorBindingPartiallyBound == VK_TRUE &&
+                supportedFeatures.runtimeDescriptorArray == VK_TRUE)
+            {
+                descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+                descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+                descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+                descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+                
+                VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties = {};
+                descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+                
+                VkPhysicalDeviceProperties2 deviceProperties2 = {};
+                deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+                deviceProperties2.pNext = &descriptorIndexingProperties;
+                vkGetPhysicalDeviceProperties2(myPhysicalDevice, &deviceProperties2);
+                
+                // a combined image sampler counts as a sampler and as a sampled image
+                myBindlessTextureCapacity = std::min<uint32_t>(
+                {
+                    MaxBindlessTextures,
+                    descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+                    descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                    descriptorIndexingProperties.maxPerStageUpdateAfterBindResources,
+                    descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+                    descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+                });
+                
+                if (std::find_if(deviceExtensions.begin(), deviceExtensions.end(), [](const char* extensionName)
+                {
+                    return strcmp(extensionName, "VK_EXT_descriptor_indexing") == 0;
+                }) == deviceExtensions.end())
+                {
+                    deviceExtensions.push_back("VK_EXT_descriptor_indexing");
+                }
+            }
+        }
+#endif
+        
+        if (myBindlessTextures && myBindlessTextureCapacity == 0)
+            throw std::runtime_error("bindless textures need VK_EXT_descriptor_indexing!");
+        
+        // vmaGetBudget reports what the driver says is left of each heap with it, rather than a guess from the heap sizes
+#if defined(VK_EXT_memory_budget)
+        myHasMemoryBudget = std::find_if(availableDeviceExtensions.begin(), availableDeviceExtensions.end(), [](const VkExtensionProperties& extension)
+        {
+            return strcmp(extension.extensionName, "VK_EXT_memory_budget") == 0;
+        }) != availableDeviceExtensions.end();
+        
+        if (myHasMemoryBudget && std::find_if(deviceExtensions.begin(), deviceExtensions.end(), [](const char* extensionName)
+        {
+            return strcmp(extensionName, "VK_EXT_memory_budget") == 0;
+        }) == deviceExtensions.end())
+        {
+            deviceExtensions.push_back("VK_EXT_memory_budget");
+        }
+#endif
+        
+        std::sort(deviceExtensions.begin(), deviceExtensions.end(), [](const char* lhs, const char* rhs)
+        {
+            return strcmp(lhs, rhs) < 0;
+        });
+        
+        /*
+         static const std::vector<const char*> requiredExtensions =
+         {
+         "VK_KHR_get_memory_requirements2",
+         "VK_KHR_dedicated_allocation",
+         };
+         
+         assert(std::includes(deviceExtensions.begin(), deviceExtensions.end(), requiredExtensions.begin(), requiredExtensions.end(), [](const char* lhs, const char* rhs)
+         {
+         return strcmp(lhs, rhs) < 0;
+         }));
+         */
+        
+        VkDeviceCreateInfo deviceCreateInfo = {};
+        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+        deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+        deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+        deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+        deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+#if defined(VK_KHR_timeline_semaphore)
+        if (myHasTimelineSemaphores)
+            deviceCreateInfo.pNext = &timelineSemaphoreFeatures;
+#endif
+#if defined(VK_EXT_descriptor_indexing)
+        if (myBindlessTextures)
+        {
+            descriptorIndexingFeatures.pNext = const_cast<void*>(deviceCreateInfo.pNext);
+            deviceCreateInfo.pNext = &descriptorIndexingFeatures;
+        }
+#endif
+        
+        CHECK_VKRESULT(vkCreateDevice(myPhysicalDevice, &deviceCreateInfo, nullptr, &myDevice));
+        
+        vkGetDeviceQueue(myDevice, myQueueFamilyIndex, 0, &myQueue);
+        vkGetDeviceQueue(myDevice, myTransferQueueFamilyIndex, transferQueueIndex, &myTransferQueue);
+    }
+    
+    void createAllocator()
+    {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(myPhysicalDevice, &deviceProperties);
+        
+        VmaAllocatorCreateInfo allocatorInfo = {};
         allocatorInfo.physicalDevice = myPhysicalDevice;
         allocatorInfo.device = myDevice;
-        vmaCreateAllocator(&allocatorInfo, &myAllocator);
+        allocatorInfo.instance = myInstance;
+        allocatorInfo.vulkanApiVersion = deviceProperties.apiVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+        if (myHasMemoryBudget)
+            allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+        CHECK_VKRESULT(vmaCreateAllocator(&allocatorInfo, &myAllocator));
+        
+        vkGetPhysicalDeviceMemoryProperties(myPhysicalDevice, &myMemoryProperties);
     }
     
     void createSwapChain(int width, int height, float backingScaleFactor)
     {
+        if (myHeadless)
+        {
+            createOffscreenImages(width, height);
+            return;
+        }
+        
+        VkSurfaceCapabilitiesKHR capabilities;
+        CHECK_VKRESULT(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(myPhysicalDevice, mySurface, &capabilities));
+        
+        const VkPresentModeKHR presentMode = choosePresentMode();
+        
+        // mailbox needs a third image to have one to render into while one is shown and another one is queued
+        uint32_t imageCount = mySwapChainImageCount;
+        if (imageCount == 0)
+            imageCount = presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? 3 : 2;
+        imageCount = std::max(imageCount, capabilities.minImageCount);
+        if (capabilities.maxImageCount > 0)
+            imageCount = std::min(imageCount, capabilities.maxImageCount);
+        
         VkSwapchainCreateInfoKHR swapChainCreateInfo = {};
         swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
         swapChainCreateInfo.surface = mySurface;
-        swapChainCreateInfo.minImageCount = 2;
+        swapChainCreateInfo.minImageCount = imageCount;
         swapChainCreateInfo.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
         swapChainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
         swapChainCreateInfo.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
@@ -369,7 +2936,7 @@ private:
         swapChainCreateInfo.pQueueFamilyIndices = nullptr;
         swapChainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
         swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        swapChainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        swapChainCreateInfo.presentMode = presentMode;
         swapChainCreateInfo.clipped = VK_TRUE;
         swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
         
@@ -379,7 +2946,6 @@ private:
         mySwapChainExtent = swapChainCreateInfo.imageExtent;
         myBackingScaleFactor = backingScaleFactor;
         
-        uint32_t imageCount;
         vkGetSwapchainImagesKHR(myDevice, mySwapChain, &imageCount, nullptr);
         
         mySwapChainImages.resize(imageCount);
@@ -390,6 +2956,48 @@ private:
             mySwapChainImageViews[i] = createImageView2D(mySwapChainImages[i], mySwapChainImageFormat);
     }
     
+    // myPresentMode where the surface has it. otherwise the one closest to it in latency, i.e. mailbox and immediate
+    // stand in for each other, and fifo, which every surface has, for whatever is left
+    VkPresentModeKHR choosePresentMode() const
+    {
+        uint32_t presentModeCount;
+        CHECK_VKRESULT(vkGetPhysicalDeviceSurfacePresentModesKHR(myPhysicalDevice, mySurface, &presentModeCount, nullptr));
+        
+        std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+        CHECK_VKRESULT(vkGetPhysicalDeviceSurfacePresentModesKHR(myPhysicalDevice, mySurface, &presentModeCount, presentModes.data()));
+        
+        std::vector<VkPresentModeKHR> candidates = { myPresentMode };
+        if (myPresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+            candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+        else if (myPresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+            candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+        
+        for (VkPresentModeKHR candidate : candidates)
+        {
+            if (std::find(presentModes.begin(), presentModes.end(), candidate) != presentModes.end())
+                return candidate;
+        }
+        
+        std::cerr << "present mode " << myPresentMode << " isn't supported, using fifo" << std::endl;
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+    
+    // stands in for the swap chain when headless, one image per frame in flight
+    void createOffscreenImages(int width, int height)
+    {
+        mySwapChainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+        mySwapChainExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+        
+        mySwapChainImages.resize(myFramesInFlight);
+        myOffscreenImageMemory.resize(myFramesInFlight);
+        mySwapChainImageViews.resize(myFramesInFlight);
+        for (uint i = 0; i < myFramesInFlight; i++)
+        {
+            CHECK_VKRESULT(createImage2D(mySwapChainExtent.width, mySwapChainExtent.height, 1, mySwapChainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mySwapChainImages[i], myOffscreenImageMemory[i]));
+            mySwapChainImageViews[i] = createImageView2D(mySwapChainImages[i], mySwapChainImageFormat);
+        }
+    }
+    
     void createRenderPass()
     {
         VkAttachmentDescription colorAttachment = {};
@@ -400,7 +3008,7 @@ private:
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        colorAttachment.finalLayout = myHeadless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
         
         VkAttachmentReference colorAttachmentRef = {};
         colorAttachmentRef.attachment = 0;
@@ -429,6 +3037,8 @@ private:
         renderPassInfo.pDependencies = &dependency;
         
         CHECK_VKRESULT(vkCreateRenderPass(myDevice, &renderPassInfo, nullptr, &myRenderPass));
+        
+        myRenderPassFormat = mySwapChainImageFormat;
     }
     
     void createFramebuffers()
@@ -450,106 +3060,364 @@ private:
         }
     }
     
-    void createDescriptorPool()
+    // persistent sets come out of one allocator through the cache, sized for the uniform buffer set and a set per
+    // texture to begin with, and the transient sets out of an allocator per frame in flight, reset when the frame comes
+    // around again. both grow when they run out
+    void createDescriptorAllocators()
     {
-        std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = 1;
-        poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = 1;
+        const uint32_t textureSetCount = myBindlessTextures ? 0 : static_cast<uint32_t>(myTextures.size());
         
-        VkDescriptorPoolCreateInfo poolInfo = {};
-        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-        poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = 1;
-        poolInfo.flags = 0; //VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+        myDescriptorAllocator.create(myDevice, 1 + textureSetCount,
+        {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+        });
+        myDescriptorSetCache.create(&myDescriptorAllocator);
+        
+        // the culling set
+        myFrameDescriptorAllocators.resize(myFramesInFlight);
+        for (DescriptorAllocator& allocator : myFrameDescriptorAllocators)
+        {
+            allocator.create(myDevice, 1,
+            {
+                { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+                { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 },
+            });
+        }
+        
+#if defined(VK_EXT_descriptor_indexing)
+        // the bindless texture set is written to while it is bound, which takes a pool of its own
+        if (myBindlessTextures)
+        {
+            VkDescriptorPoolSize bindlessPoolSize = {};
+            bindlessPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            bindlessPoolSize.descriptorCount = myBindlessTextureCapacity;
+            
+            VkDescriptorPoolCreateInfo bindlessPoolInfo = {};
+            bindlessPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+            bindlessPoolInfo.poolSizeCount = 1;
+            bindlessPoolInfo.pPoolSizes = &bindlessPoolSize;
+            bindlessPoolInfo.maxSets = 1;
+            bindlessPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+            
+            CHECK_VKRESULT(vkCreateDescriptorPool(myDevice, &bindlessPoolInfo, nullptr, &myBindlessDescriptorPool));
+        }
+#endif
+    }
+    
+    void createDescriptorSetLayout()
+    {
+        myDescriptorLayout.create(myDevice, myHasDescriptorUpdateTemplates,
+        {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr, 0, sizeof(VkDescriptorBufferInfo) },
+        });
+        
+        // set 1 has the textures, one per set, or all of them in the bindless array
+        DescriptorLayout::Binding textureBinding = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, &mySampler, 0, sizeof(VkDescriptorImageInfo) };
+        
+#if defined(VK_EXT_descriptor_indexing)
+        // only the slots that have been handed out are written, and new ones are written while frames are in flight
+        const VkDescriptorBindingFlagsEXT bindlessBindingFlags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+        
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+        bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        bindingFlagsInfo.bindingCount = 1;
+        bindingFlagsInfo.pBindingFlags = &bindlessBindingFlags;
+        
+        // its slots are written one at a time, never the whole set from a template
+        if (myBindlessTextures)
+        {
+            textureBinding.count = myBindlessTextureCapacity;
+            textureBinding.immutableSamplers = nullptr; // it would take one per slot, the writes have it instead
+            myTextureDescriptorLayout.create(myDevice, false, { textureBinding }, VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT, &bindingFlagsInfo);
+            return;
+        }
+#endif
+        
+        myTextureDescriptorLayout.create(myDevice, myHasDescriptorUpdateTemplates, { textureBinding });
+    }
+    
+    void createDescriptorSet()
+    {
+        VkDescriptorBufferInfo bufferInfo = {};
+        bufferInfo.buffer = myUniformBuffer;
+        bufferInfo.offset = 0; // plus the dynamic offset of the frame's slice
+        bufferInfo.range = sizeof(UniformBufferObject);
+        
+        myDescriptorSet = myDescriptorSetCache.get(myDescriptorLayout, &bufferInfo);
+    }
+    
+    // without bindless textures every texture has a set of its own, bound before the draws that use it. with them
+    // there is the one set, and every texture is in the slot it was given
+    void createTextureDescriptorSets()
+    {
+        if (myBindlessTextures)
+        {
+            VkDescriptorSetAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = myBindlessDescriptorPool;
+            allocInfo.descriptorSetCount = 1;
+            VkDescriptorSetLayout layout = myTextureDescriptorLayout.get();
+            allocInfo.pSetLayouts = &layout;
+            
+            CHECK_VKRESULT(vkAllocateDescriptorSets(myDevice, &allocInfo, &myBindlessDescriptorSet));
+            
+            myTextureSlots.create(myBindlessTextureCapacity);
+        }
+        
+        for (Texture& texture : myTextures)
+            writeTextureDescriptor(texture);
+    }
+    
+    // writes the view into a free slot of the bindless array, which is what the sprites' textureIndex refers to. the
+    // slot isn't used by any frame in flight, so it can be written while the set is bound
+    uint32_t addBindlessTexture(VkImageView view)
+    {
+        assert(myBindlessTextures);
+        
+        uint32_t slot = myTextureSlots.allocate();
+        if (slot == TextureSlotAllocator::InvalidSlot)
+            throw std::runtime_error("the bindless texture array is full!");
+        
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = view;
+        imageInfo.sampler = mySampler;
+        
+        VkWriteDescriptorSet descriptorWrite = {};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = myBindlessDescriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = slot;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &imageInfo;
+        
+        vkUpdateDescriptorSets(myDevice, 1, &descriptorWrite, 0, nullptr);
+        
+        return slot;
+    }
+    
+    // the descriptor stays as it is until the slot is handed out again, the array is partially bound and nothing
+    // samples it. no frame in flight may still be using the texture
+    void removeBindlessTexture(uint32_t slot)
+    {
+        assert(myBindlessTextures);
+        
+        myTextureSlots.free(slot);
+    }
+    
+    // the uniform buffer, the instances, the visible instances and the draw command, matching cull.comp. the set is
+    // transient, written every frame to point at the frame's slices
+    void createCullingDescriptorSetLayout()
+    {
+        std::vector<DescriptorLayout::Binding> bindings(4);
+        for (uint32_t i = 0; i < bindings.size(); i++)
+            bindings[i] = { i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr, i * sizeof(VkDescriptorBufferInfo), sizeof(VkDescriptorBufferInfo) };
+        
+        myCullingDescriptorLayout.create(myDevice, myHasDescriptorUpdateTemplates, bindings);
+    }
+    
+    // name in the user's cache directory
+    static std::string getUserCachePath(const char* name)
+    {
+#if defined(__APPLE__)
+        if (const char* home = getenv("HOME"))
+            return std::string(home) + "/Library/Caches/" + name;
+#else
+        if (const char* cacheHome = getenv("XDG_CACHE_HOME"))
+            return std::string(cacheHome) + "/" + name;
+        if (const char* home = getenv("HOME"))
+            return std::string(home) + "/.cache/" + name;
+#endif
+        
+        return std::string();
+    }
+    
+    static std::string getPipelineCachePath()
+    {
+        if (theHasPipelineCachePath)
+            return thePipelineCachePath;
+        
+        return getUserCachePath("VulkanTutorial2.pipelinecache");
+    }
+    
+    static std::string getTextureCachePath()
+    {
+        if (theHasTextureCachePath)
+            return theTextureCachePath;
+        
+        return getUserCachePath("VulkanTutorial2.textures");
+    }
+    
+    // what we put in front of the driver's cache data. the driver validates its own header too, but not all of them
+    // do that well, and it doesn't cover a truncated or corrupted file
+    struct PipelineCacheFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint32_t dataHash;
+        uint64_t dataSize;
+    };
+    
+    enum
+    {
+        PipelineCacheFileMagic = 0x43505456, // "VTPC"
+        PipelineCacheFileVersion = 1,
+    };
+    
+    void fillPipelineCacheFileHeader(PipelineCacheFileHeader& header) const
+    {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(myPhysicalDevice, &deviceProperties);
+        
+        memset(&header, 0, sizeof(header));
+        header.magic = PipelineCacheFileMagic;
+        header.version = PipelineCacheFileVersion;
+        header.vendorID = deviceProperties.vendorID;
+        header.deviceID = deviceProperties.deviceID;
+        header.driverVersion = deviceProperties.driverVersion;
+        memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+    }
+    
+    // the cache data in the file, or nothing if it is missing or was written by another device or driver
+    std::vector<char> readPipelineCacheFile() const
+    {
+        std::ifstream file(myPipelineCachePath, std::ios::binary);
+        if (!file.is_open())
+            return std::vector<char>();
+        
+        PipelineCacheFileHeader expected;
+        fillPipelineCacheFileHeader(expected);
+        
+        PipelineCacheFileHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.magic != expected.magic ||
+            header.version != expected.version ||
+            header.vendorID != expected.vendorID ||
+            header.deviceID != expected.deviceID ||
+            header.driverVersion != expected.driverVersion ||
+            memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+            header.dataSize > (256 << 20))
+        {
+            return std::vector<char>();
+        }
+        
+        std::vector<char> data(static_cast<size_t>(header.dataSize));
+        if (!file.read(data.data(), data.size()) || hashFNV1a(data.data(), data.size()) != header.dataHash)
+            return std::vector<char>();
+        
+        // and the driver's own header, VkPipelineCacheHeaderVersionOne
+        uint32_t vulkanHeader[4];
+        if (data.size() < 16 + VK_UUID_SIZE)
+            return std::vector<char>();
+        
+        memcpy(vulkanHeader, data.data(), sizeof(vulkanHeader));
+        if (vulkanHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            vulkanHeader[2] != expected.vendorID ||
+            vulkanHeader[3] != expected.deviceID ||
+            memcmp(data.data() + 16, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            return std::vector<char>();
+        }
         
-        CHECK_VKRESULT(vkCreateDescriptorPool(myDevice, &poolInfo, nullptr, &myDescriptorPool));
+        return data;
     }
     
-    void createDescriptorSetLayout()
+    void createPipelineCache()
     {
-        VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-        uboLayoutBinding.binding = 0;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        uboLayoutBinding.descriptorCount = 1;
-        uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-        uboLayoutBinding.pImmutableSamplers = nullptr;
-        
-        VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-        samplerLayoutBinding.binding = 1;
-        samplerLayoutBinding.descriptorCount = 1;
-        samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        samplerLayoutBinding.pImmutableSamplers = &mySampler;
+        myPipelineCachePath = getPipelineCachePath();
         
-        std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+        std::vector<char> initialData;
+        if (!myPipelineCachePath.empty())
+            initialData = readPipelineCacheFile();
         
-        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-        layoutInfo.pBindings = bindings.data();
+        VkPipelineCacheCreateInfo cacheInfo = {};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = initialData.size();
+        cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
         
-        CHECK_VKRESULT(vkCreateDescriptorSetLayout(myDevice, &layoutInfo, nullptr, &myDescriptorSetLayout));
+        if (vkCreatePipelineCache(myDevice, &cacheInfo, nullptr, &myPipelineCache) != VK_SUCCESS)
+        {
+            // the driver is free to refuse data it doesn't like, start over with an empty cache then
+            cacheInfo.initialDataSize = 0;
+            cacheInfo.pInitialData = nullptr;
+            
+            CHECK_VKRESULT(vkCreatePipelineCache(myDevice, &cacheInfo, nullptr, &myPipelineCache));
+        }
     }
     
-    void createDescriptorSet()
+    // written to a temporary file first and renamed over the old one, so there is never a half written cache
+    void savePipelineCache()
     {
-        VkDescriptorSetLayout layouts[] = { myDescriptorSetLayout };
-        VkDescriptorSetAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-        allocInfo.descriptorPool = myDescriptorPool;
-        allocInfo.descriptorSetCount = 1;
-        allocInfo.pSetLayouts = layouts;
+        if (myPipelineCachePath.empty())
+            return;
         
-        CHECK_VKRESULT(vkAllocateDescriptorSets(myDevice, &allocInfo, &myDescriptorSet));
+        size_t dataSize = 0;
+        CHECK_VKRESULT(vkGetPipelineCacheData(myDevice, myPipelineCache, &dataSize, nullptr));
         
-        VkDescriptorBufferInfo bufferInfo = {};
-        bufferInfo.buffer = myUniformBuffer;
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
+        std::vector<char> data(dataSize);
+        CHECK_VKRESULT(vkGetPipelineCacheData(myDevice, myPipelineCache, &dataSize, data.data()));
+        data.resize(dataSize);
         
-        VkDescriptorImageInfo imageInfo = {};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = myImageView;
-        imageInfo.sampler = mySampler;
+        PipelineCacheFileHeader header;
+        fillPipelineCacheFileHeader(header);
+        header.dataHash = hashFNV1a(data.data(), data.size());
+        header.dataSize = data.size();
         
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = myDescriptorSet;
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = myDescriptorSet;
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
+        // another instance of the app can be saving the same cache at the same time
+        const std::string temporaryPath = getTemporaryPath(myPipelineCachePath);
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                return;
+            
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(data.data(), data.size());
+            file.close();
+            if (!file)
+            {
+                std::remove(temporaryPath.c_str());
+                return;
+            }
+        }
         
-        vkUpdateDescriptorSets(myDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        if (std::rename(temporaryPath.c_str(), myPipelineCachePath.c_str()) != 0)
+            std::remove(temporaryPath.c_str());
     }
     
-    void createGraphicsPipeline()
+    // from the asset pack where it has the shader, otherwise from name.spv
+    VkShaderModule createShaderModule(const char* name)
     {
-        CFBundleRef mainBundle = CFBundleGetMainBundle();
-        
-        CFURLRef vertSPVURL = CFBundleCopyResourceURL(mainBundle, CFSTR("vert"), CFSTR("spv"), NULL);
-        const char* vertSPVPath = CFStringGetCStringPtr(CFURLCopyFileSystemPath(vertSPVURL, kCFURLPOSIXPathStyle), CFStringGetSystemEncoding());
+        VkShaderModuleCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
         
-        auto vsCode = readSPIRVFile(vertSPVPath);
+        std::vector<char> code;
+        if (const AssetPackEntry* entry = myAssetPack.find(name, "spv", AssetPackEntryType::SPIRV))
+        {
+            createInfo.codeSize = static_cast<size_t>(entry->size);
+            createInfo.pCode = reinterpret_cast<const uint32_t*>(myAssetPack.getData(*entry));
+        }
+        else
+        {
+            code = readSPIRVFile(getResourcePath(name, "spv"));
+            createInfo.codeSize = code.size();
+            createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+        }
         
-        VkShaderModuleCreateInfo vsCreateInfo = {};
-        vsCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        vsCreateInfo.codeSize = vsCode.size();
-        vsCreateInfo.pCode = reinterpret_cast<const uint32_t*>(vsCode.data());
+        VkShaderModule shaderModule;
+        CHECK_VKRESULT(vkCreateShaderModule(myDevice, &createInfo, nullptr, &shaderModule));
         
-        VkShaderModule vsModule;
-        CHECK_VKRESULT(vkCreateShaderModule(myDevice, &vsCreateInfo, nullptr, &vsModule));
+        return shaderModule;
+    }
+    
+    void createGraphicsPipeline()
+    {
+        VkShaderModule vsModule = createShaderModule("vert");
         
         VkPipelineShaderStageCreateInfo vsStageInfo = {};
         vsStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -557,18 +3425,7 @@ private:
         vsStageInfo.module = vsModule;
         vsStageInfo.pName = "main";
         
-        CFURLRef fragSPVURL = CFBundleCopyResourceURL(mainBundle, CFSTR("frag"), CFSTR("spv"), NULL);
-        const char* fragSPVPath = CFStringGetCStringPtr(CFURLCopyFileSystemPath(fragSPVURL, kCFURLPOSIXPathStyle), CFStringGetSystemEncoding());
-        
-        auto fsCode = readSPIRVFile(fragSPVPath);
-        
-        VkShaderModuleCreateInfo fsCreateInfo = {};
-        fsCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        fsCreateInfo.codeSize = fsCode.size();
-        fsCreateInfo.pCode = reinterpret_cast<const uint32_t*>(fsCode.data());
-        
-        VkShaderModule fsModule;
-        CHECK_VKRESULT(vkCreateShaderModule(myDevice, &fsCreateInfo, nullptr, &fsModule));
+        VkShaderModule fsModule = createShaderModule(myBindlessTextures ? "frag_bindless" : "frag");
         
         VkPipelineShaderStageCreateInfo fsStageInfo = {};
         fsStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -578,13 +3435,16 @@ private:
         
         VkPipelineShaderStageCreateInfo shaderStages[] = { vsStageInfo, fsStageInfo };
         
-        auto bindingDescription = Vertex::getBindingDescription();
-        auto attributeDescriptions = Vertex::getAttributeDescriptions();
+        VkVertexInputBindingDescription bindingDescriptions[] = { Vertex::getBindingDescription(), SpriteInstance::getBindingDescription() };
+        auto vertexAttributeDescriptions = Vertex::getAttributeDescriptions();
+        auto instanceAttributeDescriptions = SpriteInstance::getAttributeDescriptions();
+        std::vector<VkVertexInputAttributeDescription> attributeDescriptions(vertexAttributeDescriptions.begin(), vertexAttributeDescriptions.end());
+        attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end());
         
         VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 1;
-        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(sizeof_array(bindingDescriptions));
+        vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions;
         vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
         vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
         
@@ -593,24 +3453,13 @@ private:
         inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         inputAssembly.primitiveRestartEnable = VK_FALSE;
         
-        VkViewport viewport = {};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float)(mySwapChainExtent.width);
-        viewport.height = (float)(mySwapChainExtent.height);
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        
-        VkRect2D scissor = {};
-        scissor.offset = { 0, 0 };
-        scissor.extent = mySwapChainExtent;
-        
+        // viewport and scissor are dynamic and set in the command buffers, so the pipeline survives resizes
         VkPipelineViewportStateCreateInfo viewportState = {};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
+        viewportState.pViewports = nullptr;
         viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        viewportState.pScissors = nullptr;
         
         VkPipelineRasterizationStateCreateInfo rasterizer = {};
         rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -655,15 +3504,19 @@ private:
         colorBlending.blendConstants[2] = 0.0f;
         colorBlending.blendConstants[3] = 0.0f;
         
-        //VkPipelineDynamicStateCreateInfo dynamicState = {};
-        //dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-        //dynamicState.dynamicStateCount = 0;
-        //dynamicState.pDynamicStates = nullptr;
+        VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+        
+        VkPipelineDynamicStateCreateInfo dynamicState = {};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(sizeof_array(dynamicStates));
+        dynamicState.pDynamicStates = dynamicStates;
+        
+        VkDescriptorSetLayout setLayouts[] = { myDescriptorLayout.get(), myTextureDescriptorLayout.get() };
         
         VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 1;
-        pipelineLayoutInfo.pSetLayouts = &myDescriptorSetLayout;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(sizeof_array(setLayouts));
+        pipelineLayoutInfo.pSetLayouts = setLayouts;
         pipelineLayoutInfo.pushConstantRangeCount = 0;
         pipelineLayoutInfo.pPushConstantRanges = nullptr;
         
@@ -680,19 +3533,66 @@ private:
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = nullptr;
         pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.pDynamicState = nullptr;
+        pipelineInfo.pDynamicState = &dynamicState;
         pipelineInfo.layout = myPipelineLayout;
         pipelineInfo.renderPass = myRenderPass;
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
         pipelineInfo.basePipelineIndex = -1;
         
-        CHECK_VKRESULT(vkCreateGraphicsPipelines(myDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &myGraphicsPipeline));
+        CHECK_VKRESULT(vkCreateGraphicsPipelines(myDevice, myPipelineCache, 1, &pipelineInfo, nullptr, &myGraphicsPipeline));
         
         vkDestroyShaderModule(myDevice, vsModule, nullptr);
         vkDestroyShaderModule(myDevice, fsModule, nullptr);
     }
     
+    // doesn't depend on the render pass, so unlike the graphics pipeline it lives as long as the app
+    void createCullingPipeline()
+    {
+        // one invocation per instance, CullingGroupSize to a work group
+        if ((mySprites.size() + CullingGroupSize - 1) / CullingGroupSize > myMaxComputeWorkGroupCount)
+            throw std::runtime_error("too many sprites to cull in one dispatch!");
+        
+        // the indirect draws can only bind several textures as a bindless array
+        if (!myBindlessTextures && myTextures.size() > 1)
+            throw std::runtime_error("gpu culling of sprites with several textures needs bindless textures!");
+        
+        // every work group's draw starts at the group's first instance
+        if (!myHasDrawIndirectFirstInstance)
+            throw std::runtime_error("gpu culling needs indirect draws with a first instance!");
+        
+        VkShaderModule csModule = createShaderModule("cull");
+        
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = 2 * sizeof(uint32_t); // the instance count and the index count
+        
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        VkDescriptorSetLayout setLayout = myCullingDescriptorLayout.get();
+        pipelineLayoutInfo.pSetLayouts = &setLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+        
+        CHECK_VKRESULT(vkCreatePipelineLayout(myDevice, &pipelineLayoutInfo, nullptr, &myCullingPipelineLayout));
+        
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = csModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = myCullingPipelineLayout;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        pipelineInfo.basePipelineIndex = -1;
+        
+        CHECK_VKRESULT(vkCreateComputePipelines(myDevice, myPipelineCache, 1, &pipelineInfo, nullptr, &myCullingPipeline));
+        
+        vkDestroyShaderModule(myDevice, csModule, nullptr);
+    }
+    
     void createCommandPool()
     {
         VkCommandPoolCreateInfo poolInfo = {};
@@ -701,19 +3601,126 @@ private:
         poolInfo.flags = 0;
         
         CHECK_VKRESULT(vkCreateCommandPool(myDevice, &poolInfo, nullptr, &myCommandPool));
+        
+        poolInfo.queueFamilyIndex = myTransferQueueFamilyIndex;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        
+        CHECK_VKRESULT(vkCreateCommandPool(myDevice, &poolInfo, nullptr, &myTransferCommandPool));
     }
     
-    void createCommandBuffers()
+    // a single sprite is the quad filling the view, which is what gets drawn unless configured otherwise. more than
+    // that are small sprites, each showing a random cell of the texture, tinted, spinning and moving across the view
+    void createSprites()
     {
-        myCommandBuffers.resize(mySwapChainFramebuffers.size());
+        const uint32_t spriteCount = std::max(theSpriteCount, 1u);
+        mySprites.resize(spriteCount);
         
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = myCommandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = (uint32_t)myCommandBuffers.size();
+        if (spriteCount == 1)
+        {
+            Sprite& sprite = mySprites[0];
+            sprite = {};
+            sprite.size = 1.0f;
+            sprite.texRect[2] = 1.0f;
+            sprite.texRect[3] = 1.0f;
+            memset(sprite.tint, 255, sizeof(sprite.tint));
+            sprite.texture = 0;
+            return;
+        }
         
-        CHECK_VKRESULT(vkAllocateCommandBuffers(myDevice, &allocInfo, myCommandBuffers.data()));
+        // fixed seed, every run draws the same
+        uint32_t seed = 1;
+        auto random = [&seed]()
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<float>(seed >> 8) * (1.0f / 16777216.0f);
+        };
+        
+        const float cellSize = 1.0f / SpriteTextureCells;
+        for (Sprite& sprite : mySprites)
+        {
+            sprite.position[0] = (random() * 2 - 1) * SpriteWorldExtent;
+            sprite.position[1] = (random() * 2 - 1) * SpriteWorldExtent;
+            sprite.velocity[0] = (random() * 2 - 1) * 0.25f;
+            sprite.velocity[1] = (random() * 2 - 1) * 0.25f;
+            sprite.angle = random() * 6.2831853f;
+            sprite.spin = (random() * 2 - 1) * 3.0f;
+            sprite.size = 0.005f + random() * 0.02f;
+            sprite.texRect[0] = std::floor(random() * SpriteTextureCells) * cellSize;
+            sprite.texRect[1] = std::floor(random() * SpriteTextureCells) * cellSize;
+            sprite.texRect[2] = cellSize;
+            sprite.texRect[3] = cellSize;
+            for (uint i = 0; i < 3; i++)
+                sprite.tint[i] = static_cast<uint8_t>(128 + random() * 127);
+            sprite.tint[3] = 255;
+        }
+        
+        // in runs of consecutive sprites, so that without bindless textures there is one texture bind per run
+        const uint64_t textureCount = myTextures.size();
+        for (size_t i = 0; i < spriteCount; i++)
+            mySprites[i].texture = static_cast<uint32_t>(i * textureCount / spriteCount);
+    }
+    
+    // wraps around at the edges of the world, most of which is out of view
+    void getSpriteOffset(uint32_t spriteIndex, float time, float outOffset[2]) const
+    {
+        const Sprite& sprite = mySprites[spriteIndex];
+        for (uint axis = 0; axis < 2; axis++)
+        {
+            const float extent = SpriteWorldExtent;
+            float position = std::fmod(sprite.position[axis] + sprite.velocity[axis] * time + extent, 2.0f * extent);
+            outOffset[axis] = (position < 0 ? position + 2.0f * extent : position) - extent;
+        }
+    }
+    
+    // where the sprites are at time seconds, written straight into the mapped instance buffer
+    void writeSpriteInstances(float time, uint32_t begin, uint32_t end, SpriteInstance* instances) const
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const Sprite& sprite = mySprites[i];
+            
+            const float angle = sprite.angle + sprite.spin * time;
+            const float c = std::cos(angle) * sprite.size;
+            const float s = std::sin(angle) * sprite.size;
+            
+            SpriteInstance instance;
+            instance.transform[0] = c;
+            instance.transform[1] = s;
+            instance.transform[2] = -s;
+            instance.transform[3] = c;
+            getSpriteOffset(i, time, instance.offset);
+            memcpy(instance.texRect, sprite.texRect, sizeof(instance.texRect));
+            memcpy(instance.tint, sprite.tint, sizeof(instance.tint));
+            instance.textureIndex = myBindlessTextures ? myTextures[sprite.texture].slot : 0;
+            
+            instances[i] = instance;
+        }
+    }
+    
+    // the sprites are drawn in runs of consecutive instances, one vkCmdDrawIndexed each. without bindless textures a
+    // run ends where the texture changes, with them a single draw would do. theDrawCount splits them up further,
+    // which is what spreads the recording and the instance streaming over the recording threads
+    void createDrawList()
+    {
+        const uint32_t drawCount = std::max(theDrawCount, 1u);
+        const uint64_t spriteCount = mySprites.size();
+        
+        myDraws.clear();
+        for (uint32_t draw = 0; draw < drawCount; draw++)
+        {
+            uint32_t first = static_cast<uint32_t>(spriteCount * draw / drawCount);
+            const uint32_t end = static_cast<uint32_t>(spriteCount * (draw + 1) / drawCount);
+            while (first < end)
+            {
+                const uint32_t texture = mySprites[first].texture;
+                uint32_t last = first + 1;
+                while (last < end && (myBindlessTextures || mySprites[last].texture == texture))
+                    last++;
+                
+                myDraws.push_back({ first, last - first, texture });
+                first = last;
+            }
+        }
     }
     
     void createSyncObjects()
@@ -725,15 +3732,54 @@ private:
         fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
         fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
         
-        myImageAvailableSemaphores.resize(MaxFramesInFlight);
-        myRenderFinishedSemaphores.resize(MaxFramesInFlight);
-        myInFlightFences.resize(MaxFramesInFlight);
-        for (uint i = 0; i < MaxFramesInFlight; i++)
+        myImageAvailableSemaphores.resize(myFramesInFlight);
+        myRenderFinishedSemaphores.resize(myFramesInFlight);
+        myInFlightFences.resize(myFramesInFlight);
+        for (uint i = 0; i < myFramesInFlight; i++)
         {
             CHECK_VKRESULT(vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myImageAvailableSemaphores[i]));
             CHECK_VKRESULT(vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myRenderFinishedSemaphores[i]));
             CHECK_VKRESULT(vkCreateFence(myDevice, &fenceInfo, nullptr, &myInFlightFences[i]));
         }
+        
+        myFrameAcquireCommandBuffers.resize(myFramesInFlight, VK_NULL_HANDLE);
+        myFrameStartTimes.resize(myFramesInFlight);
+        myFrameAcquireSemaphores.resize(myFramesInFlight);
+        myRetiredTextures.resize(myFramesInFlight);
+    }
+    
+    void createUploadTimelineSemaphore()
+    {
+#if defined(VK_KHR_timeline_semaphore)
+        if (!myHasTimelineSemaphores)
+            return;
+        
+        VkSemaphoreTypeCreateInfoKHR semaphoreTypeInfo = {};
+        semaphoreTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        semaphoreTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        semaphoreTypeInfo.initialValue = 0;
+        
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &semaphoreTypeInfo;
+        
+        CHECK_VKRESULT(vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myUploadTimelineSemaphore));
+#endif
+    }
+    
+    // the names of the GpuScope* scopes, in their order. nothing is measured where the graphics queue has no timestamps
+    void createGpuProfiler()
+    {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(myPhysicalDevice, &queueFamilyCount, nullptr);
+        
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(myPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+        
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(myPhysicalDevice, &deviceProperties);
+        
+        myGpuProfiler.create(myDevice, myFramesInFlight, queueFamilies[myQueueFamilyIndex].timestampValidBits, deviceProperties.limits.timestampPeriod, { "frame", "culling", "render pass", "draws", "upload acquire" });
     }
     
     VkCommandBuffer beginSingleTimeCommands()
@@ -747,199 +3793,732 @@ private:
         
         CHECK_VKRESULT(vkAllocateCommandBuffers(myDevice, &allocInfo, &commandBuffer));
         
-        VkCommandBufferBeginInfo beginInfo = {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        
+        CHECK_VKRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        
+        return commandBuffer;
+    }
+    
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer)
+    {
+        CHECK_VKRESULT(vkEndCommandBuffer(commandBuffer));
+        
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        
+        uint64_t serial;
+        CHECK_VKRESULT(vkQueueSubmit(myQueue, 1, &submitInfo, myStagingRing.fenceForSubmit(&serial)));
+        myStagingRing.waitUntilRetired(serial);
+        
+        vkFreeCommandBuffers(myDevice, myCommandPool, 1, &commandBuffer);
+    }
+    
+    bool hasAsyncTransferQueue() const
+    {
+        return myTransferQueue != myQueue;
+    }
+    
+    // the batch is finished after this and runs on the transfer queue without anybody waiting for it. the returned
+    // serial is what acquireUploads takes to make the results visible to rendering, and what waitForUploads takes
+    // before touching them from the cpu
+    uint64_t submitUploadBatch(UploadBatch& batch)
+    {
+        releaseFinishedUploads();
+        
+        VkCommandBuffer commandBuffer = batch.end();
+        
+        uint64_t serial;
+        VkFence fence = myStagingRing.fenceForSubmit(&serial);
+        
+        PendingUpload upload;
+        upload.serial = serial;
+        upload.readerStages = batch.takeAcquireBarriers(upload.acquireBufferBarriers, upload.acquireImageBarriers);
+        
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        
+#if defined(VK_KHR_timeline_semaphore)
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &serial;
+        if (myHasTimelineSemaphores)
+        {
+            submitInfo.pNext = &timelineInfo;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &myUploadTimelineSemaphore;
+        }
+#endif
+        if (hasAsyncTransferQueue() && !myHasTimelineSemaphores)
+        {
+            upload.semaphore = getUploadSemaphore();
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &upload.semaphore;
+        }
+        
+        CHECK_VKRESULT(vkQueueSubmit(myTransferQueue, 1, &submitInfo, fence));
+        
+        myUploadCommandBuffers.emplace_back(serial, commandBuffer);
+        
+        // on the graphics queue itself, submission order and the batch's own barriers are all it takes
+        if (hasAsyncTransferQueue())
+            myUnacquiredUploads.push_back(std::move(upload));
+        
+        return serial;
+    }
+    
+    // the next frame submitted waits for all uploads up to serial on the gpu and takes ownership of their resources.
+    // for streaming, poll isUploadFinished first, then the frame doesn't actually have to wait
+    void acquireUploads(uint64_t serial)
+    {
+        while (!myUnacquiredUploads.empty() && myUnacquiredUploads.front().serial <= serial)
+        {
+            PendingUpload& upload = myUnacquiredUploads.front();
+            
+            myAcquireBufferBarriers.insert(myAcquireBufferBarriers.end(), upload.acquireBufferBarriers.begin(), upload.acquireBufferBarriers.end());
+            myAcquireImageBarriers.insert(myAcquireImageBarriers.end(), upload.acquireImageBarriers.begin(), upload.acquireImageBarriers.end());
+            myAcquireStages |= upload.readerStages ? upload.readerStages : VkPipelineStageFlags(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            myAcquireTimelineValue = upload.serial;
+            if (upload.semaphore != VK_NULL_HANDLE)
+                myAcquireSemaphores.push_back(upload.semaphore);
+            
+            myUnacquiredUploads.pop_front();
+        }
+    }
+    
+    bool isUploadFinished(uint64_t serial)
+    {
+        return myStagingRing.isRetired(serial);
+    }
+    
+    void waitForUploads(uint64_t serial)
+    {
+        myStagingRing.waitUntilRetired(serial);
+        releaseFinishedUploads();
+    }
+    
+    void releaseFinishedUploads()
+    {
+        while (!myUploadCommandBuffers.empty() && myStagingRing.isRetired(myUploadCommandBuffers.front().first))
+        {
+            vkFreeCommandBuffers(myDevice, myTransferCommandPool, 1, &myUploadCommandBuffers.front().second);
+            myUploadCommandBuffers.pop_front();
+        }
+    }
+    
+    VkSemaphore getUploadSemaphore()
+    {
+        if (!myFreeUploadSemaphores.empty())
+        {
+            VkSemaphore semaphore = myFreeUploadSemaphores.back();
+            myFreeUploadSemaphores.pop_back();
+            return semaphore;
+        }
+        
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        
+        VkSemaphore semaphore;
+        CHECK_VKRESULT(vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &semaphore));
+        
+        return semaphore;
+    }
+    
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags, VkBuffer& outBuffer, VmaAllocation& outBufferMemory)
+    {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.usage = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_UNKNOWN;
+        allocInfo.requiredFlags = flags;
+        allocInfo.memoryTypeBits = 0;//memRequirements.memoryTypeBits;
+        
+        CHECK_VKRESULT(vmaCreateBuffer(myAllocator, &bufferInfo, &allocInfo, &outBuffer, &outBufferMemory, nullptr));
+    }
+    
+    // persistently mapped, one slice per frame in flight, bound with a dynamic offset
+    // host visible and coherent, mapped for as long as it lives
+    unsigned char* createMappedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& outBuffer, VmaAllocation& outBufferMemory)
+    {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        
+        VmaAllocationInfo allocationInfo;
+        CHECK_VKRESULT(vmaCreateBuffer(myAllocator, &bufferInfo, &allocInfo, &outBuffer, &outBufferMemory, &allocationInfo));
+        
+        assert(allocationInfo.pMappedData != nullptr);
+        return static_cast<unsigned char*>(allocationInfo.pMappedData);
+    }
+    
+    void createUniformBuffer()
+    {
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(myMinUniformBufferOffsetAlignment, 1);
+        myUniformBufferSliceSize = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+        myUniformBufferData = createMappedBuffer(myFramesInFlight * myUniformBufferSliceSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, myUniformBuffer, myUniformBufferMemory);
+    }
+    
+    // rewritten every frame, and like the uniform buffer every frame in flight has its own slice. with gpu culling
+    // the culling pass reads it as a storage buffer, so the slices are aligned for that
+    void createInstanceBuffer()
+    {
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(myMinStorageBufferOffsetAlignment, 1);
+        myInstanceBufferSliceSize = (mySprites.size() * sizeof(SpriteInstance) + alignment - 1) / alignment * alignment;
+        myInstanceBufferData = createMappedBuffer(myFramesInFlight * myInstanceBufferSliceSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, myInstanceBuffer, myInstanceBufferMemory);
+    }
+    
+    // where the culling pass leaves the instances that are in view and the indirect draw commands that draw them, one
+    // per work group, sliced like the instance buffer. neither is ever touched by the cpu
+    void createCullingBuffers()
+    {
+        createBuffer(myFramesInFlight * myInstanceBufferSliceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, myVisibleInstanceBuffer, myVisibleInstanceBufferMemory);
+        
+        myCullingGroupCount = static_cast<uint32_t>((mySprites.size() + CullingGroupSize - 1) / CullingGroupSize);
+        const VkDeviceSize alignment = std::max<VkDeviceSize>(myMinStorageBufferOffsetAlignment, 1);
+        myDrawCommandBufferSliceSize = (myCullingGroupCount * sizeof(VkDrawIndexedIndirectCommand) + alignment - 1) / alignment * alignment;
+        createBuffer(myFramesInFlight * myDrawCommandBufferSliceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, myDrawCommandBuffer, myDrawCommandBufferMemory);
+    }
+    
+    template <typename T>
+    void createDeviceLocalBuffer(UploadBatch& batch, const T* bufferData, uint bufferElementCount, VkBufferUsageFlags usage, VkBuffer& outBuffer, VmaAllocation& outBufferMemory)
+    {
+        assert(bufferData != nullptr);
+        assert(bufferElementCount > 0);
+        size_t bufferSize = sizeof(T) * bufferElementCount;
+        
+        StagingRing::Range staging = myStagingRing.allocate(bufferSize, 4);
+        memcpy(staging.data, bufferData, bufferSize);
+        
+        createBuffer(bufferSize, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outBuffer, outBufferMemory);
+        
+        batch.copyBuffer(staging.buffer, staging.offset, outBuffer, bufferSize, usage);
+    }
+    
+    // allocationFlags can make it fail rather than go over the memory budget, see createStreamedTexture
+    VkResult createImage2D(uint width, uint height, uint mipLevels, VkFormat format, VkImageUsageFlags usage, VkMemoryPropertyFlags memoryFlags, VkImage& outImage, VmaAllocation& outImageMemory, VmaAllocationCreateFlags allocationFlags = 0)
+    {
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = static_cast<uint32_t>(width);
+        imageInfo.extent.height = static_cast<uint32_t>(height);
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = usage;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.flags = 0;
+        
+        VmaAllocationCreateInfo allocInfo = {};
+        allocInfo.flags = allocationFlags;
+        allocInfo.usage = (memoryFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_UNKNOWN;
+        allocInfo.requiredFlags = memoryFlags;
+        allocInfo.memoryTypeBits = 0;//memRequirements.memoryTypeBits;
+        
+        VmaAllocationInfo outAllocInfo = {};
+        return vmaCreateImage(myAllocator, &imageInfo, &allocInfo, &outImage, &outImageMemory, &outAllocInfo);
+    }
+    
+    // imageData holds mipLevels tightly packed levels, mipOffsets[level] is where each one starts. with generateMipmaps
+    // it only holds level 0 and the others are blitted from it in the batch, see canBlitMipmaps.
+    // texelBlockSizeBytes is the size of a pixel, or of a whole block for block compressed formats. nothing is
+    // recorded if the image can't be allocated
+    template <typename T>
+    VkResult createDeviceLocalImage2D(UploadBatch& batch, const T* imageData, uint width, uint height, uint mipLevels, const VkDeviceSize* mipOffsets, uint texelBlockSizeBytes, VkFormat format, VkImageUsageFlags usage, bool generateMipmaps, VkImage& outImage, VmaAllocation& outImageMemory, VmaAllocationCreateFlags allocationFlags = 0)
+    {
+        assert(mipLevels > 0);
+        uint dataMipLevels = generateMipmaps ? 1 : mipLevels;
+        uint lastLevel = dataMipLevels - 1;
+        VkDeviceSize imageSize = (mipOffsets ? mipOffsets[lastLevel] : 0) + getMipLevelSizeBytes(width, height, lastLevel, format, texelBlockSizeBytes);
+        
+        VkResult result = createImage2D(width, height, mipLevels, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (generateMipmaps ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outImage, outImageMemory, allocationFlags);
+        if (result != VK_SUCCESS)
+            return result;
+        
+        // buffer to image copies want offsets that are a multiple of both 4 and the texel block size
+        VkDeviceSize alignment = std::max<VkDeviceSize>(myOptimalBufferCopyOffsetAlignment, 4);
+        while (alignment % texelBlockSizeBytes != 0)
+            alignment *= 2;
+        StagingRing::Range staging = myStagingRing.allocate(imageSize, std::min<VkDeviceSize>(alignment, StagingRing::MaxAlignment));
+        memcpy(staging.data, imageData, imageSize);
+        
+        batch.transitionImageLayout(outImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+        batch.copyBufferToImage(staging.buffer, staging.offset, outImage, width, height, dataMipLevels, mipOffsets);
+        if (generateMipmaps)
+            batch.generateMipmaps(outImage, width, height, mipLevels);
+        else
+            batch.transitionImageLayout(outImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+        
+        return VK_SUCCESS;
+    }
+    
+    // assets.pack in the resources, shaders and textures that aren't in it are loaded from their own files
+    void openAssetPack()
+    {
+        std::string path;
+        if (myUseAssetPack && findResourcePath("assets", "pack", path) && !myAssetPack.open(path.c_str()))
+            std::cerr << "ignoring " << path << ", it is broken or from another version" << std::endl;
+    }
+    
+    // what loadCookedTexture would pick, and the PNG after that, from the asset pack
+    const AssetPackEntry* findPackedTexture(const char* name) const
+    {
+        std::vector<const AssetPackEntry*> candidates;
+        if (myCompressedTextures)
+        {
+            for (const char* suffix : { "bc7", "bc3", "bc1", "astc" })
+                candidates.push_back(myAssetPack.find((std::string(name) + "." + suffix).c_str(), "ktx", AssetPackEntryType::Texture2D));
+        }
+        candidates.push_back(myAssetPack.find(name, "png", AssetPackEntryType::Texture2D));
         
-        CHECK_VKRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        for (const AssetPackEntry* entry : candidates)
+        {
+            if (!entry || entry->mipLevels == 0 || getPackedTextureFormat(*entry) == VK_FORMAT_UNDEFINED)
+                continue;
+            
+            // createDeviceLocalImage2D reads up to the end of the last level
+            const uint lastLevel = entry->mipLevels - 1;
+            const VkDeviceSize lastLevelSize = getMipLevelSizeBytes(entry->width, entry->height, lastLevel, static_cast<VkFormat>(entry->format), entry->texelBlockSizeBytes);
+            if (entry->mipOffsets[lastLevel] > entry->size || lastLevelSize > entry->size - entry->mipOffsets[lastLevel])
+                continue;
+            
+            return entry;
+        }
         
-        return commandBuffer;
+        return nullptr;
     }
     
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer)
+    // what a packed texture is uploaded as, VK_FORMAT_UNDEFINED if the device can't sample it. 16 bit PNGs are packed
+    // as UNORM16 and become half floats where that can't be sampled, like loadPNGTexture decodes them
+    VkFormat getPackedTextureFormat(const AssetPackEntry& entry) const
     {
-        CHECK_VKRESULT(vkEndCommandBuffer(commandBuffer));
-        
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
+        const VkFormat format = static_cast<VkFormat>(entry.format);
+        if (isSampledImageFormatSupported(format))
+            return format;
         
-        CHECK_VKRESULT(vkQueueSubmit(myQueue, 1, &submitInfo, VK_NULL_HANDLE));
-        CHECK_VKRESULT(vkQueueWaitIdle(myQueue));
+        if (format == VK_FORMAT_R16G16B16A16_UNORM)
+            return VK_FORMAT_R16G16B16A16_SFLOAT;
         
-        vkFreeCommandBuffers(myDevice, myCommandPool, 1, &commandBuffer);
+        return VK_FORMAT_UNDEFINED;
     }
     
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+    // the first of name.bc7.ktx, name.bc3.ktx, name.bc1.ktx and name.astc.ktx that is there and in a format the device
+    // can sample, or an image without a format if there is none (or compressed textures are off)
+    KTXImage loadCookedTexture(const char* name) const
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        if (!myCompressedTextures)
+            return KTXImage();
         
-        VkBufferCopy copyRegion = {};
-        copyRegion.srcOffset = 0;
-        copyRegion.dstOffset = 0;
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+        for (const char* suffix : { "bc7", "bc3", "bc1", "astc" })
+        {
+            std::string path;
+            if (!findResourcePath((std::string(name) + "." + suffix).c_str(), "ktx", path))
+                continue;
+            
+            KTXImage image(path.c_str());
+            if (image.myFormat != VK_FORMAT_UNDEFINED && isSampledImageFormatSupported(image.myFormat))
+                return image;
+        }
         
-        endSingleTimeCommands(commandBuffer);
+        return KTXImage();
     }
     
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags, VkBuffer& outBuffer, VmaAllocation& outBufferMemory)
+    // on a loader thread. a packed or cooked copy already has all of its mip levels, and is block compressed if it
+    // is cooked. otherwise the PNG is loaded. only reads what stays as it is after initVulkan, and the texture cache is
+    // safe to use from several threads
+    void loadTexture(LoadedTexture& texture)
     {
-        VkBufferCreateInfo bufferInfo = {};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = usage;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        const char* name = texture.name.c_str();
+        if (const AssetPackEntry* packedTexture = findPackedTexture(name))
+        {
+            texture.data = myAssetPack.getData(*packedTexture);
+            texture.width = packedTexture->width;
+            texture.height = packedTexture->height;
+            texture.mipLevels = packedTexture->mipLevels;
+            texture.mipOffsets.assign(packedTexture->mipOffsets, packedTexture->mipOffsets + packedTexture->mipLevels);
+            texture.texelBlockSizeBytes = packedTexture->texelBlockSizeBytes;
+            texture.format = getPackedTextureFormat(*packedTexture);
+            if (texture.format != static_cast<VkFormat>(packedTexture->format))
+            {
+                texture.decoded.assign(texture.data, texture.data + packedTexture->size);
+                PNGImage::unorm16ToHalf(reinterpret_cast<uint16_t*>(texture.decoded.data()), texture.decoded.size() / 2);
+                texture.data = texture.decoded.data();
+            }
+            return;
+        }
         
-        VmaAllocationCreateInfo allocInfo = {};
-        allocInfo.usage = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_UNKNOWN;
-        allocInfo.requiredFlags = flags;
-        allocInfo.memoryTypeBits = 0;//memRequirements.memoryTypeBits;
+        KTXImage ktxImage = loadCookedTexture(name);
+        if (ktxImage.myFormat != VK_FORMAT_UNDEFINED)
+        {
+            texture.decoded = std::move(ktxImage.myImage);
+            texture.data = texture.decoded.data();
+            texture.width = ktxImage.myWidth;
+            texture.height = ktxImage.myHeight;
+            texture.mipLevels = static_cast<uint>(ktxImage.myMipOffsets.size());
+            texture.mipOffsets = std::move(ktxImage.myMipOffsets);
+            texture.texelBlockSizeBytes = ktxImage.myBlockSizeBytes;
+            texture.format = ktxImage.myFormat;
+            return;
+        }
         
-        CHECK_VKRESULT(vmaCreateBuffer(myAllocator, &bufferInfo, &allocInfo, &outBuffer, &outBufferMemory, nullptr));
+        loadPNGTexture(texture);
     }
     
-    template <typename T>
-    void createDeviceLocalBuffer(const T* bufferData, uint bufferElementCount, VkBufferUsageFlags usage, VkBuffer& outBuffer, VmaAllocation& outBufferMemory)
+    // mapped from the texture cache where the same PNG was decoded with the same settings before, otherwise decoded
+    // with lodepng and then cached
+    void loadPNGTexture(LoadedTexture& texture)
     {
-        assert(bufferData != nullptr);
-        assert(bufferElementCount > 0);
-        size_t bufferSize = sizeof(T) * bufferElementCount;
+        const std::string imagePathString = getResourcePath(texture.name.c_str(), "png");
+        const char* imagePath = imagePathString.c_str();
         
-        // todo: use staging buffer pool, or use scratchpad memory
-        VkBuffer stagingBuffer;
-        VmaAllocation stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        // 16 bit PNGs keep their precision, as UNORM16 where it can be sampled and as half floats otherwise (always supported)
+        const PNGImage::PixelFormat format16 = isSampledImageFormatSupported(VK_FORMAT_R16G16B16A16_UNORM) ? PNGImage::PixelFormat::RGBA16 : PNGImage::PixelFormat::RGBA16F;
         
-        void* data;
-        CHECK_VKRESULT(vmaMapMemory(myAllocator, stagingBufferMemory, &data));
-        memcpy(data, bufferData, bufferSize);
-        vmaUnmapMemory(myAllocator, stagingBufferMemory);
+        // the mip chain is blitted on the gpu in the upload batch where the upload queue and both possible formats
+        // allow it, otherwise it is built on the cpu right after decoding. streamed textures need all of it on the cpu
+        const bool blitMipmaps = !myStreamTextures && canBlitMipmaps(VK_FORMAT_R8G8B8A8_UNORM) && canBlitMipmaps(format16 == PNGImage::PixelFormat::RGBA16 ? VK_FORMAT_R16G16B16A16_UNORM : VK_FORMAT_R16G16B16A16_SFLOAT);
         
-        createBuffer(bufferSize, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outBuffer, outBufferMemory);
+        MappedFile pngFile;
+        if (!pngFile.open(imagePath))
+            throw std::runtime_error("failed to open file!");
         
-        copyBuffer(stagingBuffer, outBuffer, bufferSize);
+        const uint32_t settings[] = { blitMipmaps, static_cast<uint32_t>(format16) };
+        const uint64_t key = TextureCache::getKey(pngFile.getData(), pngFile.getSize(), settings, sizeof(settings));
         
-        vmaDestroyBuffer(myAllocator, stagingBuffer, stagingBufferMemory);
+        texture.generateMipmaps = blitMipmaps;
+        if (const TextureCache::FileHeader* cached = myTextureCache.find(key, texture.file))
+        {
+            texture.data = texture.file.getData() + sizeof(TextureCache::FileHeader);
+            texture.width = cached->width;
+            texture.height = cached->height;
+            texture.mipLevels = blitMipmaps ? getMipLevelCount(cached->width, cached->height) : cached->mipLevels;
+            texture.mipOffsets.assign(cached->mipOffsets, cached->mipOffsets + cached->mipLevels);
+            texture.texelBlockSizeBytes = cached->texelBlockSizeBytes;
+            texture.format = cached->format;
+            return;
+        }
+        
+        // textures are colour, so their mips are averaged in linear light
+        PNGImage pngImage = PNGImage(pngFile.getData(), pngFile.getSize(), !blitMipmaps, true, format16);
+#if defined(LODEPNG_COMPILE_STATS)
+        {
+            std::lock_guard<std::mutex> lock(myDecodeStatsMutex);
+            lodepng_stats_add(&myDecodeStats, &pngImage.myStats);
+        }
+#endif
+        if (pngImage.myImage.empty() || pngImage.myWidth == 0 || pngImage.myHeight == 0)
+            throw std::runtime_error("decoded image is empty!");
+        
+        texture.width = pngImage.myWidth;
+        texture.height = pngImage.myHeight;
+        texture.mipLevels = blitMipmaps ? getMipLevelCount(pngImage.myWidth, pngImage.myHeight) : static_cast<uint>(pngImage.myMipLevels.size());
+        texture.mipOffsets.resize(pngImage.myMipLevels.size());
+        for (uint level = 0; level < texture.mipOffsets.size(); level++)
+            texture.mipOffsets[level] = pngImage.myMipLevels[level].offset;
+        texture.texelBlockSizeBytes = pngImage.myPixelSizeBytes;
+        
+        texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+        if (pngImage.myFormat == PNGImage::PixelFormat::RGBA16)
+            texture.format = VK_FORMAT_R16G16B16A16_UNORM;
+        else if (pngImage.myFormat == PNGImage::PixelFormat::RGBA16F)
+            texture.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+        
+        myTextureCache.store(key, texture.format, texture.width, texture.height, static_cast<uint>(texture.mipOffsets.size()), texture.mipOffsets.data(), texture.texelBlockSizeBytes, pngImage.myImage.data(), pngImage.myImage.size());
+        
+        texture.decoded = std::move(pngImage.myImage);
+        texture.data = texture.decoded.data();
     }
     
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+#if defined(LODEPNG_COMPILE_STATS)
+    // once, after the loader threads are gone, instead of a line per file from every thread
+    void printDecodeStats(std::ostream& out)
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        static const char* stageNames[LSS_NUM_STAGES] = { "decode", "chunks", "inflate", "unfilter", "deinterlace", "convert" };
         
-        VkImageMemoryBarrier barrier = {};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = 1;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
+        std::lock_guard<std::mutex> lock(myDecodeStatsMutex);
+        if (!myDecodeStats.decodes)
+            return;
         
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+        out << "png decodes " << myDecodeStats.decodes << ":";
+        for (uint stage = 0; stage < LSS_NUM_STAGES; stage++)
+            out << " " << stageNames[stage] << " " << myDecodeStats.nanoseconds[stage] / 1000 << "us/" << myDecodeStats.bytes[stage] << "B";
+        out << " allocations " << myDecodeStats.allocations << "/" << myDecodeStats.allocated_bytes << "B";
+        out << " deflate blocks " << myDecodeStats.deflate_blocks[0] << "/" << myDecodeStats.deflate_blocks[1] << "/" << myDecodeStats.deflate_blocks[2] << std::endl;
+    }
+#endif
+    
+    // queues name on the loader threads, all textures show a placeholder until createTextures has uploaded it
+    void loadTexturesAsync(const char* name)
+    {
+        myPendingTextureLoads++;
+        std::string nameString = name;
+        myAssetLoader.enqueue([this, nameString]
         {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            std::unique_ptr<LoadedTexture> texture(new LoadedTexture);
+            texture->name = nameString;
+            try
+            {
+                loadTexture(*texture);
+            }
+            catch (const std::exception& e)
+            {
+                texture->error = e.what();
+            }
+            
+            myLoadedTextures.push(std::move(texture));
+        });
+    }
+    
+    // a grey texel for every texture, uploaded before the first frame so that there is always something to sample
+    void createPlaceholderTextures(UploadBatch& batch)
+    {
+        static const unsigned char placeholder[] = { 128, 128, 128, 255 };
+        
+        myTextures.resize(std::max(theTextureCount, 1u));
+        for (Texture& texture : myTextures)
+        {
+            CHECK_VKRESULT(createDeviceLocalImage2D(batch, placeholder, 1, 1, 1, nullptr, sizeof(placeholder), VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, false, texture.image, texture.memory));
+            texture.view = createImageView2D(texture.image, VK_FORMAT_R8G8B8A8_UNORM, 1);
         }
-        else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    }
+    
+    // on the render thread, once a loader thread is done with loaded. the other textures are copies of the first,
+    // standing in for different ones. they replace the placeholders in updateTextures once their uploads have
+    // finished, streamed textures start out with their coarsest levels. a texture that fails keeps its placeholder
+    void createTextures(UploadBatch& batch, const LoadedTexture& loaded)
+    {
+        if (!loaded.error.empty())
         {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            std::cerr << "failed to load texture " << loaded.name << ": " << loaded.error << std::endl;
+            myPendingTextureLoads--;
+            return;
         }
-        else
+        
+        if (myStreamTextures)
         {
-            assert(false); // not implemented yet
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = 0;
+            assert(!loaded.generateMipmaps);
+            createTextureSource(loaded.data, loaded.width, loaded.height, loaded.mipLevels, loaded.mipOffsets.data(), loaded.texelBlockSizeBytes, loaded.format);
         }
         
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        const size_t firstUpdate = myTextureUpdates.size();
+        for (uint32_t i = 0; i < myTextures.size(); i++)
+        {
+            TextureUpdate update = {};
+            update.texture = i;
+            
+            VkResult result;
+            if (myStreamTextures)
+            {
+                result = createStreamedTexture(batch, myTextureResidency.getCoarsestBaseLevel(), update.replacement);
+            }
+            else
+            {
+                Texture& texture = update.replacement;
+                result = createDeviceLocalImage2D(batch, loaded.data, loaded.width, loaded.height, loaded.mipLevels, loaded.mipOffsets.data(), loaded.texelBlockSizeBytes, loaded.format, VK_IMAGE_USAGE_SAMPLED_BIT, loaded.generateMipmaps, texture.image, texture.memory);
+                if (result == VK_SUCCESS)
+                    texture.view = createImageView2D(texture.image, loaded.format, loaded.mipLevels);
+            }
+            
+            if (result != VK_SUCCESS)
+            {
+                std::cerr << "failed to allocate texture " << loaded.name << ", keeping its placeholder" << std::endl;
+                continue;
+            }
+            
+            myTextureUpdates.push_back(update);
+        }
         
-        endSingleTimeCommands(commandBuffer);
+        if (myTextureUpdates.size() == firstUpdate)
+            myPendingTextureLoads--;
+        else
+            myTextureUpdates.back().finishesLoad = true;
     }
     
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint width, uint height)
+    // keeps every level on the cpu for createStreamedTexture, and works out how large the images with fewer of them are
+    void createTextureSource(const unsigned char* imageData, uint width, uint height, uint mipLevels, const VkDeviceSize* mipOffsets, uint texelBlockSizeBytes, VkFormat format)
     {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-        
-        VkBufferImageCopy region = {};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageOffset = { 0, 0, 0 };
-        region.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
-        
-        vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-        
-        endSingleTimeCommands(commandBuffer);
+        assert(mipOffsets != nullptr);
+        
+        const uint lastLevel = mipLevels - 1;
+        TextureSource& source = myTextureSource;
+        source.data.assign(imageData, imageData + mipOffsets[lastLevel] + getMipLevelSizeBytes(width, height, lastLevel, format, texelBlockSizeBytes));
+        source.mipOffsets.assign(mipOffsets, mipOffsets + mipLevels);
+        source.width = width;
+        source.height = height;
+        source.texelBlockSizeBytes = texelBlockSizeBytes;
+        source.format = format;
+        
+        uint coarsestBaseLevel = 0;
+        while (coarsestBaseLevel < lastLevel && std::max(width >> coarsestBaseLevel, height >> coarsestBaseLevel) > StreamedTextureTailSize)
+            coarsestBaseLevel++;
+        
+        std::vector<VkDeviceSize> residentSizes(coarsestBaseLevel + 1);
+        for (uint baseLevel = 0; baseLevel <= coarsestBaseLevel; baseLevel++)
+            residentSizes[baseLevel] = getImageSize2D(std::max(width >> baseLevel, 1u), std::max(height >> baseLevel, 1u), mipLevels - baseLevel, format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        
+        myTextureResidency.create(static_cast<uint32_t>(myTextures.size()), residentSizes, coarsestBaseLevel);
     }
     
-    void createImage2D(uint width, uint height, uint /*pixelSizeBytes*/, VkImageUsageFlags usage, VkMemoryPropertyFlags memoryFlags, VkImage& outImage, VmaAllocation& outImageMemory)
+    // an image with the levels of myTextureSource from baseLevel on, and its view. fails rather than go over the
+    // memory budget, and leaves outTexture as it was then
+    VkResult createStreamedTexture(UploadBatch& batch, uint baseLevel, Texture& outTexture)
+    {
+        const TextureSource& source = myTextureSource;
+        const uint mipLevels = static_cast<uint>(source.mipOffsets.size()) - baseLevel;
+        std::vector<VkDeviceSize> mipOffsets(mipLevels);
+        for (uint level = 0; level < mipLevels; level++)
+            mipOffsets[level] = source.mipOffsets[baseLevel + level] - source.mipOffsets[baseLevel];
+        
+        Texture texture;
+        VkResult result = createDeviceLocalImage2D(batch, source.data.data() + source.mipOffsets[baseLevel], std::max(source.width >> baseLevel, 1u), std::max(source.height >> baseLevel, 1u), mipLevels, mipOffsets.data(), source.texelBlockSizeBytes, source.format, VK_IMAGE_USAGE_SAMPLED_BIT, false, texture.image, texture.memory, VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT);
+        if (result != VK_SUCCESS)
+            return result;
+        
+        VmaAllocationInfo allocationInfo;
+        vmaGetAllocationInfo(myAllocator, texture.memory, &allocationInfo);
+        myTextureHeapIndex = myMemoryProperties.memoryTypes[allocationInfo.memoryType].heapIndex;
+        myTextureBytes += allocationInfo.size;
+        
+        texture.view = createImageView2D(texture.image, source.format, mipLevels);
+        texture.baseLevel = baseLevel;
+        texture.sizeBytes = allocationInfo.size;
+        outTexture = texture;
+        
+        return VK_SUCCESS;
+    }
+    
+    // what an image like that takes in memory, without allocating any
+    VkDeviceSize getImageSize2D(uint width, uint height, uint mipLevels, VkFormat format, VkImageUsageFlags usage) const
     {
         VkImageCreateInfo imageInfo = {};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.extent.width = static_cast<uint32_t>(width);
-        imageInfo.extent.height = static_cast<uint32_t>(height);
-        imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = 1;
+        imageInfo.extent = { width, height, 1 };
+        imageInfo.mipLevels = mipLevels;
         imageInfo.arrayLayers = 1;
-        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.format = format;
         imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
         imageInfo.usage = usage;
         imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.flags = 0;
         
-        VmaAllocationCreateInfo allocInfo = {};
-        allocInfo.usage = (memoryFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_UNKNOWN;
-        allocInfo.requiredFlags = memoryFlags;
-        allocInfo.memoryTypeBits = 0;//memRequirements.memoryTypeBits;
+        VkImage image;
+        CHECK_VKRESULT(vkCreateImage(myDevice, &imageInfo, nullptr, &image));
         
-        VmaAllocationInfo outAllocInfo = {};
-        CHECK_VKRESULT(vmaCreateImage(myAllocator, &imageInfo, &allocInfo, &outImage, &outImageMemory, &outAllocInfo));
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(myDevice, image, &memoryRequirements);
+        vkDestroyImage(myDevice, image, nullptr);
+        
+        return memoryRequirements.size;
     }
     
-    template <typename T>
-    void createDeviceLocalImage2D(const T* imageData, uint width, uint height, uint pixelSizeBytes, VkImageUsageFlags usage, VkImage& outImage, VmaAllocation& outImageMemory)
+    // the texture's descriptor set, or its slot in the bindless array
+    void writeTextureDescriptor(Texture& texture)
     {
-        VkDeviceSize imageSize = width * height * pixelSizeBytes;
+        if (myBindlessTextures)
+        {
+            texture.slot = addBindlessTexture(texture.view);
+            return;
+        }
         
-        VkBuffer stagingBuffer;
-        VmaAllocation stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        VkDescriptorImageInfo imageInfo = {};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = texture.view;
+        imageInfo.sampler = mySampler;
         
-        void* data;
-        CHECK_VKRESULT(vmaMapMemory(myAllocator, stagingBufferMemory, &data));
-        memcpy(data, imageData, imageSize);
-        vmaUnmapMemory(myAllocator, stagingBufferMemory);
+        texture.descriptorSet = myDescriptorSetCache.get(myTextureDescriptorLayout, &imageInfo);
+    }
+    
+    // no frame in flight may still be using it
+    void destroyTexture(Texture& texture)
+    {
+        if (texture.slot != TextureSlotAllocator::InvalidSlot)
+        {
+            removeBindlessTexture(texture.slot);
+        }
+        else if (texture.descriptorSet != VK_NULL_HANDLE)
+        {
+            VkDescriptorImageInfo imageInfo = {};
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageInfo.imageView = texture.view;
+            imageInfo.sampler = mySampler;
+            
+            myDescriptorSetCache.recycle(myTextureDescriptorLayout, &imageInfo);
+        }
         
-        createImage2D(width, height, pixelSizeBytes, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, outImage, outImageMemory);
+        vkDestroyImageView(myDevice, texture.view, nullptr);
+        vmaDestroyImage(myAllocator, texture.image, texture.memory);
+        myTextureBytes -= texture.sizeBytes;
+        texture = Texture();
+    }
+    
+    // the width and height of the blocks a format is stored in, 1 for anything that isn't block compressed
+    static uint getTexelBlockExtent(VkFormat format)
+    {
+        // BC, ETC2, EAC and ASTC 4x4 are contiguous in the enum and all use 4x4 blocks
+        return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_ASTC_4x4_SRGB_BLOCK ? 4 : 1;
+    }
+    
+    // of a level of an image that is width x height at level 0, tightly packed
+    static VkDeviceSize getMipLevelSizeBytes(uint width, uint height, uint level, VkFormat format, uint texelBlockSizeBytes)
+    {
+        const uint blockExtent = getTexelBlockExtent(format);
+        const VkDeviceSize blocks = VkDeviceSize((std::max(width >> level, 1u) + blockExtent - 1) / blockExtent) * ((std::max(height >> level, 1u) + blockExtent - 1) / blockExtent);
+        return blocks * texelBlockSizeBytes;
+    }
+    
+    bool isSampledImageFormatSupported(VkFormat format) const
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(myPhysicalDevice, format, &properties);
+        
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+        return (properties.optimalTilingFeatures & required) == required;
+    }
+    
+    // blits only run on queues with graphics, the upload queue is often a transfer only one
+    bool canBlitMipmaps(VkFormat format) const
+    {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(myPhysicalDevice, &queueFamilyCount, nullptr);
+        
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(myPhysicalDevice, &queueFamilyCount, queueFamilies.data());
         
-        transitionImageLayout(myImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        copyBufferToImage(stagingBuffer, myImage, width, height);
-        transitionImageLayout(myImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        if (!(queueFamilies[myTransferQueueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+            return false;
         
-        vmaDestroyBuffer(myAllocator, stagingBuffer, stagingBufferMemory);
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(myPhysicalDevice, format, &properties);
+        
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & required) == required;
     }
     
-    VkImageView createImageView2D(VkImage image, VkFormat format)
+    VkImageView createImageView2D(VkImage image, VkFormat format, uint mipLevels = 1)
     {
         VkImageView imageView;
         VkImageViewCreateInfo viewInfo = {};
@@ -949,7 +4528,7 @@ private:
         viewInfo.format = format;
         viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
         viewInfo.subresourceRange.baseMipLevel = 0;
-        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.levelCount = mipLevels;
         viewInfo.subresourceRange.baseArrayLayer = 0;
         viewInfo.subresourceRange.layerCount = 1;
         viewInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -980,7 +4559,7 @@ private:
         samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
         samplerInfo.mipLodBias = 0.0f;
         samplerInfo.minLod = 0.0f;
-        samplerInfo.maxLod = 0.0f;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE; // the image views decide how many levels there are
         
         CHECK_VKRESULT(vkCreateSampler(myDevice, &samplerInfo, nullptr, &mySampler));
     }
@@ -989,40 +4568,49 @@ private:
     {
         createInstance();
         createDebugCallback();
-        createSurface(window);
+        if (!myHeadless)
+            createSurface(window);
         createDevice();
         createAllocator();
+        openAssetPack();
+        myStagingRing.create(myDevice, myAllocator, StagingRingSizeBytes);
         createCommandPool();
+        createPipelineCache();
+        myTextureCache.create(getTextureCachePath(), TextureCacheMaxSizeBytes);
+        myAssetLoader.create(std::min(std::max(std::thread::hardware_concurrency(), 2u) - 1, uint(MaxAssetLoaderThreads)));
+        createUploadTimelineSemaphore();
         createSwapChain(width, height, backingScaleFactor);
         createRenderPass();
         createFramebuffers();
         
-        // todo - make all single time comands use same command buffer
-        createDeviceLocalBuffer(ourVertices, sizeof_array(ourVertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, myVertexBuffer, myVertexBufferMemory);
-        createDeviceLocalBuffer(ourIndices, sizeof_array(ourIndices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, myIndexBuffer, myIndexBufferMemory);
-        {
-            // todo: proper platform independent resource loading
-            CFBundleRef mainBundle = CFBundleGetMainBundle();
-            CFURLRef imageURL = CFBundleCopyResourceURL(mainBundle, CFSTR("fractal_tree"), CFSTR("png"), NULL);
-            const char* imagePath = CFStringGetCStringPtr(CFURLCopyFileSystemPath(imageURL, kCFURLPOSIXPathStyle), CFStringGetSystemEncoding());
-            
-            const PNGImage pngImage = PNGImage(imagePath);
-            
-            createDeviceLocalImage2D(pngImage.myImage.data(), pngImage.myWidth, pngImage.myHeight, 4, VK_IMAGE_USAGE_SAMPLED_BIT, myImage, myImageMemory);
-            myImageView = createImageView2D(myImage, VK_FORMAT_R8G8B8A8_UNORM);
-            
-        }
-        createBuffer(sizeof(UniformBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, myUniformBuffer, myUniformBufferMemory);
+        UploadBatch uploads(myDevice, myTransferCommandPool, myTransferQueueFamilyIndex, myQueueFamilyIndex);
+        createDeviceLocalBuffer(uploads, ourVertices, sizeof_array(ourVertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, myVertexBuffer, myVertexBufferMemory);
+        createDeviceLocalBuffer(uploads, ourIndices, sizeof_array(ourIndices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, myIndexBuffer, myIndexBufferMemory);
+        createPlaceholderTextures(uploads);
+        myUploadSerial = submitUploadBatch(uploads);
+        acquireUploads(myUploadSerial);
+        loadTexturesAsync("fractal_tree");
+        
+        createUniformBuffer();
+        createSprites();
+        createInstanceBuffer();
         
         createTextureSampler();
-        createDescriptorPool();
+        createDescriptorAllocators();
         createDescriptorSetLayout();
         createDescriptorSet();
+        createTextureDescriptorSets();
         createGraphicsPipeline();
-        createCommandBuffers();
+        if (myGpuCulling)
+        {
+            createCullingBuffers();
+            createCullingDescriptorSetLayout();
+            createCullingPipeline();
+        }
+        myRecorder.create(myDevice, myQueueFamilyIndex, myFramesInFlight, std::max(theRecordingThreadCount, 1u));
+        createDrawList();
         createSyncObjects();
-        
-        recordCommandBuffers();
+        createGpuProfiler();
     }
     
     void recreateSwapChain(uint width, uint height, float backingScaleFactor)
@@ -1032,48 +4620,164 @@ private:
         cleanupSwapChain();
         
         createSwapChain(width, height, backingScaleFactor);
-        createRenderPass();
-        createFramebuffers();
-        createGraphicsPipeline();
-        createCommandBuffers();
         
-        recordCommandBuffers();
+        // the pipeline only depends on the render pass, which only depends on the format
+        if (mySwapChainImageFormat != myRenderPassFormat)
+        {
+            cleanupRenderPass();
+            createRenderPass();
+            createGraphicsPipeline();
+        }
+        
+        createFramebuffers();
+    }
+    
+    // culls the frame's instances against the view into the visible instance buffer. every work group packs the ones
+    // it keeps at the start of its own range, in their original order, and writes a draw command for them, so the
+    // sprites draw in the same order as without culling. outside of the render pass, before it
+    void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame)
+    {
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos = {};
+        bufferInfos[0] = { myUniformBuffer, frame * myUniformBufferSliceSize, sizeof(UniformBufferObject) };
+        bufferInfos[1] = { myInstanceBuffer, frame * myInstanceBufferSliceSize, myInstanceBufferSliceSize };
+        bufferInfos[2] = { myVisibleInstanceBuffer, frame * myInstanceBufferSliceSize, myInstanceBufferSliceSize };
+        bufferInfos[3] = { myDrawCommandBuffer, frame * myDrawCommandBufferSliceSize, myCullingGroupCount * sizeof(VkDrawIndexedIndirectCommand) };
+        
+        VkDescriptorSet descriptorSet = myFrameDescriptorAllocators[frame].allocate(myCullingDescriptorLayout.get());
+        myCullingDescriptorLayout.update(descriptorSet, bufferInfos.data());
+        
+        const uint32_t pushConstants[] = { static_cast<uint32_t>(mySprites.size()), static_cast<uint32_t>(sizeof_array(ourIndices)) };
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, myCullingPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, myCullingPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, myCullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), pushConstants);
+        vkCmdDispatch(commandBuffer, myCullingGroupCount, 1, 1);
+        
+        // the draw commands are read by the indirect draws and the visible instances by the vertex input
+        VkMemoryBarrier cullingBarrier = {};
+        cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        cullingBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &cullingBarrier, 0, nullptr, 0, nullptr);
     }
     
-    void recordCommandBuffers()
+    // the draws go into secondary command buffers recorded on all recording threads, which also write the instances
+    // of their draws. the primary command buffer only runs them inside the render pass. each frame slot binds its own
+    // uniform and instance buffer slices. with gpu culling the instances are still written on all recording threads,
+    // but drawn with the indirect draws of the visible ones, recorded with the last slice
+    VkCommandBuffer recordFrame(uint frameIndex, uint32_t imageIndex)
     {
-        for (size_t i = 0; i < myCommandBuffers.size(); i++)
+        const uint32_t frame = static_cast<uint32_t>(myCurrentFrame);
+        const float time = frameIndex / 60.0f;
+        
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = myRenderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = mySwapChainFramebuffers[imageIndex];
+        
+        const std::vector<VkCommandBuffer>& secondaryCommandBuffers = myRecorder.record(frame, static_cast<uint32_t>(myDraws.size()), inheritanceInfo, [this, frame, time](VkCommandBuffer commandBuffer, uint32_t begin, uint32_t end)
         {
-            VkCommandBufferBeginInfo beginInfo = {};
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-            beginInfo.pInheritanceInfo = nullptr;
-            CHECK_VKRESULT(vkBeginCommandBuffer(myCommandBuffers[i], &beginInfo));
+            VkViewport viewport = {};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float)(mySwapChainExtent.width);
+            viewport.height = (float)(mySwapChainExtent.height);
+            viewport.minDepth = 0.0f;
+            viewport.maxDepth = 1.0f;
             
-            VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+            VkRect2D scissor = {};
+            scissor.offset = { 0, 0 };
+            scissor.extent = mySwapChainExtent;
             
-            VkRenderPassBeginInfo renderPassInfo = {};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = myRenderPass;
-            renderPassInfo.framebuffer = mySwapChainFramebuffers[i];
-            renderPassInfo.renderArea.offset = { 0, 0 };
-            renderPassInfo.renderArea.extent = mySwapChainExtent;
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
+            VkBuffer vertexBuffers[] = { myVertexBuffer, myGpuCulling ? myVisibleInstanceBuffer : myInstanceBuffer };
+            VkDeviceSize offsets[] = { 0, frame * myInstanceBufferSliceSize };
             
-            VkBuffer vertexBuffers[] = { myVertexBuffer };
-            VkDeviceSize offsets[] = { 0 };
+            SpriteInstance* instances = reinterpret_cast<SpriteInstance*>(myInstanceBufferData + offsets[1]);
+            
+            uint32_t uniformBufferOffset = static_cast<uint32_t>(frame * myUniformBufferSliceSize);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayout, 0, 1, &myDescriptorSet, 1, &uniformBufferOffset);
+            if (myBindlessTextures)
+                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayout, 1, 1, &myBindlessDescriptorSet, 0, nullptr);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myGraphicsPipeline);
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+            vkCmdBindIndexBuffer(commandBuffer, myIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
+            
+            // the secondaries run in order, the draws begin with the first draw's and end with the last draw's
+            if (begin == 0 && end > 0)
+                myGpuProfiler.beginScope(commandBuffer, frame, GpuScopeDraws);
+            
+            uint32_t boundTexture = ~0u;
+            for (uint32_t draw = begin; draw < end; draw++)
+            {
+                const Draw& drawInfo = myDraws[draw];
+                if (!myBindlessTextures && drawInfo.texture != boundTexture)
+                {
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayout, 1, 1, &myTextures[drawInfo.texture].descriptorSet, 0, nullptr);
+                    boundTexture = drawInfo.texture;
+                }
+                writeSpriteInstances(time, drawInfo.firstInstance, drawInfo.firstInstance + drawInfo.instanceCount, instances);
+                if (!myGpuCulling)
+                    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(sizeof_array(ourIndices)), drawInfo.instanceCount, 0, 0, drawInfo.firstInstance);
+            }
             
-            vkCmdBeginRenderPass(myCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdBindDescriptorSets(myCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayout, 0, 1, &myDescriptorSet, 0, nullptr);
-            vkCmdBindPipeline(myCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, myGraphicsPipeline);
-            vkCmdBindVertexBuffers(myCommandBuffers[i], 0, 1, vertexBuffers, offsets);
-            vkCmdBindIndexBuffer(myCommandBuffers[i], myIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
-            vkCmdDrawIndexed(myCommandBuffers[i], static_cast<uint32_t>(sizeof_array(ourIndices)), 1, 0, 0, 0);
-            vkCmdEndRenderPass(myCommandBuffers[i]);
+            // the culling work groups' draws, in order, as many to a call as the device allows
+            if (myGpuCulling && end == myDraws.size())
+            {
+                for (uint32_t group = 0; group < myCullingGroupCount; group += myMaxDrawIndirectCount)
+                {
+                    const uint32_t drawCount = std::min(myCullingGroupCount - group, myMaxDrawIndirectCount);
+                    vkCmdDrawIndexedIndirect(commandBuffer, myDrawCommandBuffer, frame * myDrawCommandBufferSliceSize + group * sizeof(VkDrawIndexedIndirectCommand), drawCount, sizeof(VkDrawIndexedIndirectCommand));
+                }
+            }
             
-            CHECK_VKRESULT(vkEndCommandBuffer(myCommandBuffers[i]));
+            if (end == myDraws.size() && begin < end)
+                myGpuProfiler.endScope(commandBuffer, frame, GpuScopeDraws);
+        });
+        
+        VkCommandBuffer commandBuffer = myRecorder.getPrimaryCommandBuffer(frame);
+        
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
+        CHECK_VKRESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        
+        VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+        
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = myRenderPass;
+        renderPassInfo.framebuffer = mySwapChainFramebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = mySwapChainExtent;
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+        
+        // the draws' timestamps are in the secondaries, inside the render pass, where they can't be reset
+        for (uint32_t scope = GpuScopeFrame; scope <= GpuScopeDraws; scope++)
+            myGpuProfiler.resetScope(commandBuffer, frame, scope);
+        myGpuProfiler.beginScope(commandBuffer, frame, GpuScopeFrame);
+        
+        if (myGpuCulling)
+        {
+            myGpuProfiler.beginScope(commandBuffer, frame, GpuScopeCulling);
+            recordCulling(commandBuffer, frame);
+            myGpuProfiler.endScope(commandBuffer, frame, GpuScopeCulling);
         }
+        
+        myGpuProfiler.beginScope(commandBuffer, frame, GpuScopeRenderPass);
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+        vkCmdEndRenderPass(commandBuffer);
+        myGpuProfiler.endScope(commandBuffer, frame, GpuScopeRenderPass);
+        
+        myGpuProfiler.endScope(commandBuffer, frame, GpuScopeFrame);
+        
+        CHECK_VKRESULT(vkEndCommandBuffer(commandBuffer));
+        
+        return commandBuffer;
     }
     
     void checkFlipOrPresentResult(VkResult result)
@@ -1086,10 +4790,16 @@ private:
             throw std::runtime_error("failed to flip swap chain image!");
     }
     
-    void updateUniformBuffer(uint frameIndex)
+    // the model matrix zooms in and out every two seconds
+    static float getModelScale(uint frameIndex)
     {
         float t = static_cast<float>(frameIndex % 120) / 120;
-        float s = smootherstep(smoothstep(clamp(ramp(t < 0.5f ? t : 1 - t, 0, 0.5f), 0, 1)));
+        return smootherstep(smoothstep(clamp(ramp(t < 0.5f ? t : 1 - t, 0, 0.5f), 0, 1)));
+    }
+    
+    void updateUniformBuffer(uint frameIndex)
+    {
+        float s = getModelScale(frameIndex);
         
         UniformBufferObject ubo = {};
         ubo.model[0] = { 1 * s, 0, 0, 0 };
@@ -1105,10 +4815,121 @@ private:
         ubo.proj[2] = { 0, 0, 1, 0 };
         ubo.proj[3] = { 0, 0, 0, 1 };
         
-        void* data;
-        CHECK_VKRESULT(vmaMapMemory(myAllocator, myUniformBufferMemory, &data));
-        memcpy(data, &ubo, sizeof(ubo));
-        vmaUnmapMemory(myAllocator, myUniformBufferMemory);
+        memcpy(myUniformBufferData + myCurrentFrame * myUniformBufferSliceSize, &ubo, sizeof(ubo));
+    }
+    
+    // between a frame's fence and its recording. the textures whose uploads have finished take over from the old ones,
+    // which are destroyed once the frames in flight are done with them. then what the loader threads have finished
+    // and, for streamed textures, the next levels to load or evict are uploaded in one batch
+    void updateTextures(uint frameIndex)
+    {
+        const size_t frame = myCurrentFrame;
+        for (Texture& texture : myRetiredTextures[frame])
+            destroyTexture(texture);
+        myRetiredTextures[frame].clear();
+        
+        // the frame recorded next is the first to use the new image, with a descriptor set or slot of its own, and
+        // takes it over from the upload queue. the frames in flight go on with the old one
+        while (!myTextureUpdates.empty() && isUploadFinished(myTextureUpdates.front().serial))
+        {
+            TextureUpdate& update = myTextureUpdates.front();
+            acquireUploads(update.serial);
+            
+            writeTextureDescriptor(update.replacement);
+            std::swap(myTextures[update.texture], update.replacement);
+            myRetiredTextures[frame].push_back(update.replacement);
+            if (update.residencyChange)
+                myTextureResidency.commit(update.texture);
+            if (update.finishesLoad)
+                myPendingTextureLoads--;
+            
+            myTextureUpdates.pop_front();
+        }
+        
+        std::unique_ptr<UploadBatch> uploads;
+        const size_t firstUpdate = myTextureUpdates.size();
+        
+        std::unique_ptr<LoadedTexture> loaded;
+        while (myLoadedTextures.pop(loaded))
+        {
+            if (!uploads)
+                uploads.reset(new UploadBatch(myDevice, myTransferCommandPool, myTransferQueueFamilyIndex, myQueueFamilyIndex));
+            createTextures(*uploads, *loaded);
+        }
+        
+        // streaming starts once there is a texture source
+        if (myStreamTextures && !myTextureSource.data.empty())
+        {
+            markVisibleTextures(frameIndex);
+            
+            vmaSetCurrentFrameIndex(myAllocator, frameIndex);
+            myTextureResidency.plan(frameIndex, getTextureBudget(), StreamingUploadBytesPerFrame, myTextureRequests);
+            if (!myTextureRequests.empty() && !uploads)
+                uploads.reset(new UploadBatch(myDevice, myTransferCommandPool, myTransferQueueFamilyIndex, myQueueFamilyIndex));
+            
+            for (const TextureResidency::Request& request : myTextureRequests)
+            {
+                TextureUpdate update = {};
+                update.texture = request.texture;
+                update.residencyChange = true;
+                if (createStreamedTexture(*uploads, request.baseLevel, update.replacement) != VK_SUCCESS)
+                {
+                    // something else in the heap took what the budget said was left, the textures stay below what
+                    // they have now from here on
+                    myTextureResidency.cancel(request.texture);
+                    myTextureBytesLimit = myTextureBytes;
+                    continue;
+                }
+                
+                myTextureUpdates.push_back(update);
+            }
+        }
+        
+        if (!uploads)
+            return;
+        
+        myUploadSerial = submitUploadBatch(*uploads);
+        for (size_t i = firstUpdate; i < myTextureUpdates.size(); i++)
+            myTextureUpdates[i].serial = myUploadSerial;
+    }
+    
+    // which textures the sprites on screen use, how much of the screen they cover, and the finest level they need
+    // for about a texel per pixel
+    void markVisibleTextures(uint frameIndex)
+    {
+        const float time = frameIndex / 60.0f;
+        const float scale = getModelScale(frameIndex);
+        const float pixelsPerUnit = 0.5f * std::max(mySwapChainExtent.width, mySwapChainExtent.height);
+        const float textureSize = static_cast<float>(std::max(myTextureSource.width, myTextureSource.height));
+        
+        for (uint32_t i = 0; i < mySprites.size(); i++)
+        {
+            const Sprite& sprite = mySprites[i];
+            
+            float offset[2];
+            getSpriteOffset(i, time, offset);
+            
+            // the quad is 2 * size across, rotated it reaches out to its corners
+            const float radius = 1.4142136f * sprite.size * scale;
+            if (radius <= 0 || std::abs(offset[0] * scale) - radius > 1 || std::abs(offset[1] * scale) - radius > 1)
+                continue;
+            
+            const float pixels = 2 * sprite.size * scale * pixelsPerUnit;
+            const float texels = textureSize * std::max(sprite.texRect[2], sprite.texRect[3]);
+            const uint baseLevel = texels > pixels ? static_cast<uint>(std::log2(texels / pixels)) : 0;
+            myTextureResidency.markUsed(sprite.texture, frameIndex, baseLevel, sprite.size * sprite.size * scale * scale);
+        }
+    }
+    
+    // vmaGetBudget's idea of what is left in the textures' heap, on top of what they have, up to the configured budget
+    VkDeviceSize getTextureBudget() const
+    {
+        VmaBudget budgets[VK_MAX_MEMORY_HEAPS] = {};
+        vmaGetBudget(myAllocator, budgets);
+        
+        const VmaBudget& budget = budgets[myTextureHeapIndex];
+        const VkDeviceSize available = myTextureBytes + (budget.budget > budget.usage ? budget.budget - budget.usage : 0);
+        return std::min({ myTextureBudgetBytes, myTextureBytesLimit, available });
     }
     
     void drawFrame(uint frameIndex)
@@ -1116,24 +4937,30 @@ private:
         CHECK_VKRESULT(vkWaitForFences(myDevice, 1, &myInFlightFences[myCurrentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max()));
         CHECK_VKRESULT(vkResetFences(myDevice, 1, &myInFlightFences[myCurrentFrame]));
         
+        collectFrameLatency(static_cast<uint>(myCurrentFrame));
+        myFrameStartTimes[myCurrentFrame] = FrameClock::now();
+        myGpuProfiler.collect(static_cast<uint32_t>(myCurrentFrame));
+        
+        releaseFrameAcquires(static_cast<uint>(myCurrentFrame));
+        
+        // the fence says the gpu is done with this frame's slice of the uniform buffer and its transient descriptor sets
+        myFrameDescriptorAllocators[myCurrentFrame].reset();
+        updateUniformBuffer(frameIndex);
+        
+        updateTextures(frameIndex);
+        
+        if (myHeadless)
+        {
+            drawFrameHeadless(frameIndex);
+            return;
+        }
+        
         uint32_t imageIndex;
         checkFlipOrPresentResult(vkAcquireNextImageKHR(myDevice, mySwapChain, std::numeric_limits<uint64_t>::max(), myImageAvailableSemaphores[myCurrentFrame], VK_NULL_HANDLE, &imageIndex));
         
-        VkSemaphore waitSemaphores[] = { myImageAvailableSemaphores[myCurrentFrame] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
         VkSemaphore signalSemaphores[] = { myRenderFinishedSemaphores[myCurrentFrame] };
         
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &myCommandBuffers[imageIndex];
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = signalSemaphores;
-        
-        CHECK_VKRESULT(vkQueueSubmit(myQueue, 1, &submitInfo, myInFlightFences[myCurrentFrame]));
+        submitFrame(recordFrame(frameIndex, imageIndex), myImageAvailableSemaphores[myCurrentFrame], VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, signalSemaphores[0]);
         
         VkSwapchainKHR swapChains[] = { mySwapChain };
         
@@ -1148,7 +4975,133 @@ private:
         
         checkFlipOrPresentResult(vkQueuePresentKHR(myQueue, &presentInfo));
         
-        myCurrentFrame = frameIndex % MaxFramesInFlight;
+        myCurrentFrame = frameIndex % myFramesInFlight;
+    }
+    
+    // the frame's fence has signalled
+    void collectFrameLatency(uint frame)
+    {
+        if (myFrameStartTimes[frame] == FrameClock::time_point())
+            return;
+        
+        myFrameLatencies.push_back(std::chrono::duration<double, std::milli>(FrameClock::now() - myFrameStartTimes[frame]).count());
+        myFrameStartTimes[frame] = FrameClock::time_point();
+    }
+    
+    // submits the frame's command buffer, after waiting for and taking ownership of whatever acquireUploads let through
+    void submitFrame(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore, VkPipelineStageFlags waitStage, VkSemaphore signalSemaphore)
+    {
+        mySubmitWaitSemaphores.clear();
+        mySubmitWaitValues.clear();
+        mySubmitWaitStages.clear();
+        mySubmitCommandBuffers.clear();
+        
+        if (waitSemaphore != VK_NULL_HANDLE)
+        {
+            mySubmitWaitSemaphores.push_back(waitSemaphore);
+            mySubmitWaitValues.push_back(0);
+            mySubmitWaitStages.push_back(waitStage);
+        }
+        
+        if (myAcquireStages != 0)
+        {
+            if (myHasTimelineSemaphores)
+            {
+                mySubmitWaitSemaphores.push_back(myUploadTimelineSemaphore);
+                mySubmitWaitValues.push_back(myAcquireTimelineValue);
+                mySubmitWaitStages.push_back(myAcquireStages);
+            }
+            
+            for (VkSemaphore semaphore : myAcquireSemaphores)
+            {
+                mySubmitWaitSemaphores.push_back(semaphore);
+                mySubmitWaitValues.push_back(0);
+                mySubmitWaitStages.push_back(myAcquireStages);
+            }
+            
+            // the acquire's source stages have to be the ones the semaphores are waited in, to chain with them
+            if (!myAcquireBufferBarriers.empty() || !myAcquireImageBarriers.empty())
+            {
+                VkCommandBufferAllocateInfo allocInfo = {};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandPool = myCommandPool;
+                allocInfo.commandBufferCount = 1;
+                
+                VkCommandBuffer acquireCommandBuffer;
+                CHECK_VKRESULT(vkAllocateCommandBuffers(myDevice, &allocInfo, &acquireCommandBuffer));
+                
+                VkCommandBufferBeginInfo beginInfo = {};
+                beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+                beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+                
+                const uint32_t frame = static_cast<uint32_t>(myCurrentFrame);
+                CHECK_VKRESULT(vkBeginCommandBuffer(acquireCommandBuffer, &beginInfo));
+                myGpuProfiler.resetScope(acquireCommandBuffer, frame, GpuScopeUploadAcquire);
+                myGpuProfiler.beginScope(acquireCommandBuffer, frame, GpuScopeUploadAcquire);
+                vkCmdPipelineBarrier(acquireCommandBuffer, myAcquireStages, myAcquireStages, 0,
+                    0, nullptr,
+                    static_cast<uint32_t>(myAcquireBufferBarriers.size()), myAcquireBufferBarriers.data(),
+                    static_cast<uint32_t>(myAcquireImageBarriers.size()), myAcquireImageBarriers.data());
+                myGpuProfiler.endScope(acquireCommandBuffer, frame, GpuScopeUploadAcquire);
+                CHECK_VKRESULT(vkEndCommandBuffer(acquireCommandBuffer));
+                
+                mySubmitCommandBuffers.push_back(acquireCommandBuffer);
+                myFrameAcquireCommandBuffers[myCurrentFrame] = acquireCommandBuffer;
+            }
+            
+            myFrameAcquireSemaphores[myCurrentFrame].swap(myAcquireSemaphores);
+            myAcquireBufferBarriers.clear();
+            myAcquireImageBarriers.clear();
+            myAcquireStages = 0;
+        }
+        
+        mySubmitCommandBuffers.push_back(commandBuffer);
+        
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(mySubmitWaitSemaphores.size());
+        submitInfo.pWaitSemaphores = mySubmitWaitSemaphores.data();
+        submitInfo.pWaitDstStageMask = mySubmitWaitStages.data();
+        submitInfo.commandBufferCount = static_cast<uint32_t>(mySubmitCommandBuffers.size());
+        submitInfo.pCommandBuffers = mySubmitCommandBuffers.data();
+        submitInfo.signalSemaphoreCount = signalSemaphore != VK_NULL_HANDLE ? 1 : 0;
+        submitInfo.pSignalSemaphores = &signalSemaphore;
+        
+#if defined(VK_KHR_timeline_semaphore)
+        VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(mySubmitWaitValues.size());
+        timelineInfo.pWaitSemaphoreValues = mySubmitWaitValues.data();
+        if (myHasTimelineSemaphores)
+            submitInfo.pNext = &timelineInfo;
+#endif
+        
+        CHECK_VKRESULT(vkQueueSubmit(myQueue, 1, &submitInfo, myInFlightFences[myCurrentFrame]));
+    }
+    
+    // once the frame's fence has signalled, so has everything its acquire waited for
+    void releaseFrameAcquires(uint frame)
+    {
+        if (myFrameAcquireCommandBuffers[frame] != VK_NULL_HANDLE)
+        {
+            vkFreeCommandBuffers(myDevice, myCommandPool, 1, &myFrameAcquireCommandBuffers[frame]);
+            myFrameAcquireCommandBuffers[frame] = VK_NULL_HANDLE;
+        }
+        
+        myFreeUploadSemaphores.insert(myFreeUploadSemaphores.end(), myFrameAcquireSemaphores[frame].begin(), myFrameAcquireSemaphores[frame].end());
+        myFrameAcquireSemaphores[frame].clear();
+    }
+    
+    // no acquire or present, each frame in flight renders into its own offscreen image
+    void drawFrameHeadless(uint frameIndex)
+    {
+        uint32_t imageIndex = static_cast<uint32_t>(myCurrentFrame);
+        
+        submitFrame(recordFrame(frameIndex, imageIndex), VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+        
+        myLastImageIndex = imageIndex;
+        myCurrentFrame = frameIndex % myFramesInFlight;
     }
     
     void cleanupSwapChain()
@@ -1156,50 +5109,128 @@ private:
         for (size_t i = 0; i < mySwapChainFramebuffers.size(); i++)
             vkDestroyFramebuffer(myDevice, mySwapChainFramebuffers[i], nullptr);
         
-        vkFreeCommandBuffers(myDevice, myCommandPool, static_cast<uint32_t>(myCommandBuffers.size()), myCommandBuffers.data());
-        vkDestroyPipeline(myDevice, myGraphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(myDevice, myPipelineLayout, nullptr);
-        vkDestroyRenderPass(myDevice, myRenderPass, nullptr);
-        
         for (size_t i = 0; i < mySwapChainImageViews.size(); i++)
             vkDestroyImageView(myDevice, mySwapChainImageViews[i], nullptr);
         
-        vkDestroySwapchainKHR(myDevice, mySwapChain, nullptr);
+        for (size_t i = 0; i < myOffscreenImageMemory.size(); i++)
+            vmaDestroyImage(myAllocator, mySwapChainImages[i], myOffscreenImageMemory[i]);
+        
+        myOffscreenImageMemory.clear();
+        
+        if (mySwapChain != VK_NULL_HANDLE)
+            vkDestroySwapchainKHR(myDevice, mySwapChain, nullptr);
+    }
+    
+    void cleanupRenderPass()
+    {
+        vkDestroyPipeline(myDevice, myGraphicsPipeline, nullptr);
+        vkDestroyPipelineLayout(myDevice, myPipelineLayout, nullptr);
+        vkDestroyRenderPass(myDevice, myRenderPass, nullptr);
     }
     
     void cleanup()
     {
+        // the loader threads read the asset pack, the texture cache and the device
+        myAssetLoader.destroy();
+        
+#if defined(LODEPNG_COMPILE_STATS)
+        printDecodeStats(std::cout);
+#endif
+        
         CHECK_VKRESULT(vkDeviceWaitIdle(myDevice));
         
         cleanupSwapChain();
+        cleanupRenderPass();
+        
+        waitForUploads(myUploadSerial);
+        assert(myUploadCommandBuffers.empty());
+        
+        // uploads nobody acquired leave their semaphores signalled, which is fine to destroy once idle
+        for (const auto& upload : myUnacquiredUploads)
+            if (upload.semaphore != VK_NULL_HANDLE)
+                myFreeUploadSemaphores.push_back(upload.semaphore);
+        myUnacquiredUploads.clear();
+        myFreeUploadSemaphores.insert(myFreeUploadSemaphores.end(), myAcquireSemaphores.begin(), myAcquireSemaphores.end());
+        myAcquireSemaphores.clear();
         
-        for (uint i = 0; i < MaxFramesInFlight; i++)
+        for (uint i = 0; i < myFramesInFlight; i++)
+            releaseFrameAcquires(i);
+        
+        for (VkSemaphore semaphore : myFreeUploadSemaphores)
+            vkDestroySemaphore(myDevice, semaphore, nullptr);
+        myFreeUploadSemaphores.clear();
+        
+        if (myUploadTimelineSemaphore != VK_NULL_HANDLE)
+            vkDestroySemaphore(myDevice, myUploadTimelineSemaphore, nullptr);
+        
+        for (uint i = 0; i < myFramesInFlight; i++)
         {
             vkDestroySemaphore(myDevice, myRenderFinishedSemaphores[i], nullptr);
             vkDestroySemaphore(myDevice, myImageAvailableSemaphores[i], nullptr);
             vkDestroyFence(myDevice, myInFlightFences[i], nullptr);
         }
         
-        vkDestroyDescriptorSetLayout(myDevice, myDescriptorSetLayout, nullptr);
-        vkDestroyDescriptorPool(myDevice, myDescriptorPool, nullptr);
+        myGpuProfiler.destroy();
+        
+        savePipelineCache();
+        vkDestroyPipelineCache(myDevice, myPipelineCache, nullptr);
+        
+        if (myGpuCulling)
+        {
+            vkDestroyPipeline(myDevice, myCullingPipeline, nullptr);
+            vkDestroyPipelineLayout(myDevice, myCullingPipelineLayout, nullptr);
+            myCullingDescriptorLayout.destroy();
+            vmaDestroyBuffer(myAllocator, myVisibleInstanceBuffer, myVisibleInstanceBufferMemory);
+            vmaDestroyBuffer(myAllocator, myDrawCommandBuffer, myDrawCommandBufferMemory);
+        }
+        
+        // before the descriptor sets they have are gone
+        for (std::vector<Texture>& textures : myRetiredTextures)
+        {
+            for (Texture& texture : textures)
+                destroyTexture(texture);
+        }
+        myRetiredTextures.clear();
+        for (TextureUpdate& update : myTextureUpdates)
+            destroyTexture(update.replacement);
+        myTextureUpdates.clear();
+        for (Texture& texture : myTextures)
+            destroyTexture(texture);
+        myTextures.clear();
+        
+        myDescriptorLayout.destroy();
+        myTextureDescriptorLayout.destroy();
+        myDescriptorSetCache.destroy();
+        myDescriptorAllocator.destroy();
+        for (DescriptorAllocator& allocator : myFrameDescriptorAllocators)
+            allocator.destroy();
+        if (myBindlessDescriptorPool != VK_NULL_HANDLE)
+            vkDestroyDescriptorPool(myDevice, myBindlessDescriptorPool, nullptr);
         
         vmaDestroyBuffer(myAllocator, myUniformBuffer, myUniformBufferMemory);
+        vmaDestroyBuffer(myAllocator, myInstanceBuffer, myInstanceBufferMemory);
         vmaDestroyBuffer(myAllocator, myVertexBuffer, myVertexBufferMemory);
         vmaDestroyBuffer(myAllocator, myIndexBuffer, myIndexBufferMemory);
-        vmaDestroyImage(myAllocator, myImage, myImageMemory);
-        vkDestroyImageView(myDevice, myImageView, nullptr);
         vkDestroySampler(myDevice, mySampler, nullptr);
         
+        myStagingRing.destroy();
         vmaDestroyAllocator(myAllocator);
         
+        myRecorder.destroy();
+        vkDestroyCommandPool(myDevice, myTransferCommandPool, nullptr);
         vkDestroyCommandPool(myDevice, myCommandPool, nullptr);
         vkDestroyDevice(myDevice, nullptr);
         
-        auto vkDestroyDebugReportCallbackEXT = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(myInstance, "vkDestroyDebugReportCallbackEXT");
-        assert(vkDestroyDebugReportCallbackEXT != nullptr);
-        vkDestroyDebugReportCallbackEXT(myInstance, myDebugCallback, nullptr);
+        if (myDebugCallback != VK_NULL_HANDLE)
+        {
+            auto vkDestroyDebugReportCallbackEXT = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(myInstance, "vkDestroyDebugReportCallbackEXT");
+            assert(vkDestroyDebugReportCallbackEXT != nullptr);
+            vkDestroyDebugReportCallbackEXT(myInstance, myDebugCallback, nullptr);
+        }
+        
+        if (mySurface != VK_NULL_HANDLE)
+            vkDestroySurfaceKHR(myInstance, mySurface, nullptr);
         
-        vkDestroySurfaceKHR(myInstance, mySurface, nullptr);
         vkDestroyInstance(myInstance, nullptr);
     }
     
@@ -1215,44 +5246,83 @@ private:
         return 0;
     }
     
-    static int isDeviceSuitable(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice device)
+    // a transfer only family (usually a dma engine) first, then any other family, then a second graphics queue and
+    // last the graphics queue itself. uploads copy whole mip levels, so any minImageTransferGranularity works
+    static void findTransferQueue(VkPhysicalDevice device, int graphicsQueueFamilyIndex, int& outQueueFamilyIndex, uint32_t& outQueueIndex)
     {
-        VkPhysicalDeviceProperties deviceProperties;
-        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
         
-        VkPhysicalDeviceFeatures deviceFeatures;
-        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-        
-        struct SwapChainInfo
-        {
-            VkSurfaceCapabilitiesKHR capabilities;
-            std::vector<VkSurfaceFormatKHR> formats;
-            std::vector<VkPresentModeKHR> presentModes;
-        } swapChainInfo;
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
         
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &swapChainInfo.capabilities);
+        const VkQueueFlags transferCapable = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
         
-        uint32_t formatCount;
-        vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
-        if (formatCount != 0)
+        outQueueIndex = 0;
+        for (bool transferOnly : { true, false })
         {
-            swapChainInfo.formats.resize(formatCount);
-            vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, swapChainInfo.formats.data());
+            for (uint32_t i = 0; i < queueFamilies.size(); i++)
+            {
+                const auto& queueFamily = queueFamilies[i];
+                if (i == static_cast<uint32_t>(graphicsQueueFamilyIndex) || queueFamily.queueCount == 0 || !(queueFamily.queueFlags & transferCapable))
+                    continue;
+                
+                if (transferOnly && (queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+                    continue;
+                
+                outQueueFamilyIndex = i;
+                return;
+            }
         }
         
-        assert(!swapChainInfo.formats.empty());
+        outQueueFamilyIndex = graphicsQueueFamilyIndex;
+        if (queueFamilies[graphicsQueueFamilyIndex].queueCount > 1)
+            outQueueIndex = 1;
+    }
+    
+    static int isDeviceSuitable(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice device)
+    {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(device, &deviceProperties);
+        
+        VkPhysicalDeviceFeatures deviceFeatures;
+        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
         
-        uint32_t presentModeCount;
-        vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
-        if (presentModeCount != 0)
+        // without a surface (headless) there is nothing to present to, and any device type will do, e.g. lavapipe
+        const bool headless = surface == VK_NULL_HANDLE;
+        if (!headless)
         {
-            swapChainInfo.presentModes.resize(presentModeCount);
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, swapChainInfo.presentModes.data());
+            struct SwapChainInfo
+            {
+                VkSurfaceCapabilitiesKHR capabilities;
+                std::vector<VkSurfaceFormatKHR> formats;
+                std::vector<VkPresentModeKHR> presentModes;
+            } swapChainInfo;
+            
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &swapChainInfo.capabilities);
+            
+            uint32_t formatCount;
+            vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+            if (formatCount != 0)
+            {
+                swapChainInfo.formats.resize(formatCount);
+                vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, swapChainInfo.formats.data());
+            }
+            
+            assert(!swapChainInfo.formats.empty());
+            
+            uint32_t presentModeCount;
+            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+            if (presentModeCount != 0)
+            {
+                swapChainInfo.presentModes.resize(presentModeCount);
+                vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, swapChainInfo.presentModes.data());
+            }
+            
+            assert(!swapChainInfo.presentModes.empty());
         }
         
-        assert(!swapChainInfo.presentModes.empty());
-        
-        if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
+        if ((deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || headless) &&
             deviceFeatures.samplerAnisotropy)
         {
             uint32_t queueFamilyCount = 0;
@@ -1265,11 +5335,14 @@ private:
             {
                 const auto& queueFamily = queueFamilies[i];
                 
-                VkBool32 presentSupport = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                VkBool32 presentSupport = headless;
+                if (!headless)
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
                 
+                // compute too, for the culling pass that runs ahead of the render pass
                 if (queueFamily.queueCount > 0 &&
                     queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT &&
+                    queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT &&
                     presentSupport)
                 {
                     return i;
@@ -1282,46 +5355,222 @@ private:
     
     enum
     {
-        MaxFramesInFlight = 2,
+        MaxFramesInFlight = 4, // what vktut2_set_frames_in_flight can ask for
+        StagingRingSizeBytes = 32 * 1024 * 1024,
+        StreamedTextureTailSize = 64, // streamed textures always have their levels from 64 x 64 on
+        StreamingUploadBytesPerFrame = 8 * 1024 * 1024, // of images with finer levels, evictions aren't held back
+        MaxAssetLoaderThreads = 4, // one fewer than there are cores, one at least
+        TextureCacheMaxSizeBytes = 256 * 1024 * 1024, // on disk, the least recently used textures go first
+        SpriteTextureCells = 4, // sprites show one of SpriteTextureCells x SpriteTextureCells cells of the texture
+        SpriteWorldExtent = 2, // sprites move within [-SpriteWorldExtent, SpriteWorldExtent], the view shows [-1, 1]
+        CullingGroupSize = 64, // local_size_x in cull.comp
+        MaxBindlessTextures = 4096, // or what the device allows, if that is less
+    };
+    
+    // what myGpuProfiler measures, see createGpuProfiler for their names
+    enum
+    {
+        GpuScopeFrame, // the frame's command buffer
+        GpuScopeCulling,
+        GpuScopeRenderPass,
+        GpuScopeDraws, // the secondaries, without the render pass' load and store
+        GpuScopeUploadAcquire, // the barriers that take over the uploads from the transfer queue, before the frame
     };
     
+    const bool myHeadless = false;
+    const std::string myResourcePath;
+    const bool myGpuCulling = theGpuCulling;
+    const bool myBindlessTextures = theBindlessTextures;
+    const bool myCompressedTextures = theCompressedTextures;
+    const bool myUseAssetPack = theAssetPack;
+    const bool myStreamTextures = theTextureBudgetMegabytes > 0;
+    const VkDeviceSize myTextureBudgetBytes = VkDeviceSize(theTextureBudgetMegabytes) * 1024 * 1024;
+    const VkPresentModeKHR myPresentMode = thePresentMode; // asked for, see choosePresentMode for what it gets
+    const uint32_t mySwapChainImageCount = theSwapChainImageCount; // zero picks one for the present mode
+    const uint myFramesInFlight = std::min(std::max(theFramesInFlight, 1u), uint(MaxFramesInFlight));
+    uint32_t myBindlessTextureCapacity = 0; // how many slots the bindless array has, zero without descriptor indexing
+    
     VkInstance myInstance = VK_NULL_HANDLE;
     VkDebugReportCallbackEXT myDebugCallback = VK_NULL_HANDLE;
     VkSurfaceKHR mySurface = VK_NULL_HANDLE;
     VkPhysicalDevice myPhysicalDevice = VK_NULL_HANDLE;
     VkDevice myDevice = VK_NULL_HANDLE;
     VmaAllocator myAllocator = VK_NULL_HANDLE;
+    bool myHasMemoryBudget = false; // VK_EXT_memory_budget, without it vmaGetBudget estimates from the heap sizes
+    VkPhysicalDeviceMemoryProperties myMemoryProperties = {};
+    AssetPack myAssetPack; // stays mapped, a new swap chain can need the shaders again
+    TextureCache myTextureCache;
+    StagingRing myStagingRing;
+    std::deque<std::pair<uint64_t, VkCommandBuffer>> myUploadCommandBuffers;
+    uint64_t myUploadSerial = 0;
+    VkDeviceSize myOptimalBufferCopyOffsetAlignment = 1;
+    VkDeviceSize myMinUniformBufferOffsetAlignment = 1;
+    VkDeviceSize myMinStorageBufferOffsetAlignment = 1;
+    uint32_t myMaxComputeWorkGroupCount = 0;
+    uint32_t myMaxDrawIndirectCount = 1; // 1 without multiDrawIndirect
+    bool myHasDrawIndirectFirstInstance = false;
+    bool myHasDescriptorUpdateTemplates = false; // core in 1.1
     int myQueueFamilyIndex = -1;
     VkQueue myQueue = VK_NULL_HANDLE;
+    int myTransferQueueFamilyIndex = -1;
+    VkQueue myTransferQueue = VK_NULL_HANDLE;
+    VkCommandPool myTransferCommandPool = VK_NULL_HANDLE;
+    bool myHasTimelineSemaphores = false;
+    VkSemaphore myUploadTimelineSemaphore = VK_NULL_HANDLE;
+    std::vector<VkSemaphore> myFreeUploadSemaphores;
+    struct PendingUpload
+    {
+        uint64_t serial = 0;
+        VkSemaphore semaphore = VK_NULL_HANDLE; // binary, without timeline semaphores
+        VkPipelineStageFlags readerStages = 0;
+        std::vector<VkBufferMemoryBarrier> acquireBufferBarriers;
+        std::vector<VkImageMemoryBarrier> acquireImageBarriers;
+    };
+    std::deque<PendingUpload> myUnacquiredUploads;
+    std::vector<VkBufferMemoryBarrier> myAcquireBufferBarriers;
+    std::vector<VkImageMemoryBarrier> myAcquireImageBarriers;
+    VkPipelineStageFlags myAcquireStages = 0;
+    uint64_t myAcquireTimelineValue = 0;
+    std::vector<VkSemaphore> myAcquireSemaphores;
+    std::vector<VkCommandBuffer> myFrameAcquireCommandBuffers;
+    std::vector<std::vector<VkSemaphore>> myFrameAcquireSemaphores;
+    std::vector<VkSemaphore> mySubmitWaitSemaphores;
+    std::vector<uint64_t> mySubmitWaitValues;
+    std::vector<VkPipelineStageFlags> mySubmitWaitStages;
+    std::vector<VkCommandBuffer> mySubmitCommandBuffers;
     VkSwapchainKHR mySwapChain = VK_NULL_HANDLE;
     VkFormat mySwapChainImageFormat = VK_FORMAT_UNDEFINED;
     VkExtent2D mySwapChainExtent = { 0, 0 };
     float myBackingScaleFactor = 1.0f;
     std::vector<VkImage> mySwapChainImages;
     std::vector<VkImageView> mySwapChainImageViews;
+    std::vector<VmaAllocation> myOffscreenImageMemory;
+    uint32_t myLastImageIndex = 0;
     std::vector<VkFramebuffer> mySwapChainFramebuffers;
     VkRenderPass myRenderPass = VK_NULL_HANDLE;
-    VkDescriptorPool myDescriptorPool = VK_NULL_HANDLE;
-    VkDescriptorSetLayout myDescriptorSetLayout = VK_NULL_HANDLE;
+    VkFormat myRenderPassFormat = VK_FORMAT_UNDEFINED;
+    DescriptorAllocator myDescriptorAllocator;
+    DescriptorSetCache myDescriptorSetCache;
+    std::vector<DescriptorAllocator> myFrameDescriptorAllocators;
+    DescriptorLayout myDescriptorLayout;
     VkDescriptorSet myDescriptorSet = VK_NULL_HANDLE;
+    DescriptorLayout myTextureDescriptorLayout;
+    VkDescriptorPool myBindlessDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet myBindlessDescriptorSet = VK_NULL_HANDLE;
+    TextureSlotAllocator myTextureSlots;
     VkPipelineLayout myPipelineLayout = VK_NULL_HANDLE;
     VkPipeline myGraphicsPipeline = VK_NULL_HANDLE;
+    VkPipelineCache myPipelineCache = VK_NULL_HANDLE;
+    std::string myPipelineCachePath;
     VkBuffer myVertexBuffer = VK_NULL_HANDLE;
     VmaAllocation myVertexBufferMemory = VK_NULL_HANDLE;
     VkBuffer myIndexBuffer = VK_NULL_HANDLE;
     VmaAllocation myIndexBufferMemory = VK_NULL_HANDLE;
-    VkImage myImage = VK_NULL_HANDLE;
-    VmaAllocation myImageMemory = VK_NULL_HANDLE;
-    VkImageView myImageView = VK_NULL_HANDLE;
+    struct Texture
+    {
+        VkImage image = VK_NULL_HANDLE;
+        VmaAllocation memory = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE; // without bindless textures
+        uint32_t slot = TextureSlotAllocator::InvalidSlot; // with them
+        uint baseLevel = 0; // streamed, the image has the levels from here on
+        VkDeviceSize sizeBytes = 0;
+    };
+    std::vector<Texture> myTextures;
+    struct TextureSource
+    {
+        std::vector<unsigned char> data;
+        std::vector<VkDeviceSize> mipOffsets;
+        uint width = 0;
+        uint height = 0;
+        uint texelBlockSizeBytes = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+    };
+    TextureSource myTextureSource; // every level of the streamed textures, which their images are made from
+    TextureResidency myTextureResidency;
+    uint32_t myTextureHeapIndex = 0;
+    VkDeviceSize myTextureBytes = 0; // of all texture images, including those that are retired or not swapped in yet
+    VkDeviceSize myTextureBytesLimit = std::numeric_limits<VkDeviceSize>::max(); // lowered when an allocation fails
+    struct LoadedTexture
+    {
+        std::string name;
+        std::string error; // nothing else is set if there is one
+        MappedFile file; // from the texture cache
+        std::vector<unsigned char> decoded;
+        const unsigned char* data = nullptr; // into file, decoded or the asset pack
+        uint width = 0;
+        uint height = 0;
+        uint mipLevels = 0;
+        std::vector<VkDeviceSize> mipOffsets; // of the levels in data, the others are generated
+        uint texelBlockSizeBytes = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        bool generateMipmaps = false;
+    };
+    AssetLoader myAssetLoader;
+    MPSCQueue<std::unique_ptr<LoadedTexture>> myLoadedTextures;
+    uint32_t myPendingTextureLoads = 0; // queued, or uploading in myTextureUpdates
+#if defined(LODEPNG_COMPILE_STATS)
+    std::mutex myDecodeStatsMutex;
+    LodePNGStats myDecodeStats = {}; // summed over the PNGs that all loader threads decoded
+#endif
+    struct TextureUpdate
+    {
+        uint32_t texture;
+        Texture replacement;
+        uint64_t serial;
+        bool residencyChange; // streamed in or out, rather than loaded
+        bool finishesLoad; // the last texture of a load
+    };
+    std::deque<TextureUpdate> myTextureUpdates; // in the order of their upload serials
+    std::vector<std::vector<Texture>> myRetiredTextures; // per frame in flight, destroyed after its fence
+    std::vector<TextureResidency::Request> myTextureRequests;
     VkSampler mySampler = VK_NULL_HANDLE;
     VkBuffer myUniformBuffer = VK_NULL_HANDLE;
     VmaAllocation myUniformBufferMemory = VK_NULL_HANDLE;
+    unsigned char* myUniformBufferData = nullptr;
+    VkDeviceSize myUniformBufferSliceSize = 0;
+    VkBuffer myInstanceBuffer = VK_NULL_HANDLE;
+    VmaAllocation myInstanceBufferMemory = VK_NULL_HANDLE;
+    unsigned char* myInstanceBufferData = nullptr;
+    VkDeviceSize myInstanceBufferSliceSize = 0;
+    VkBuffer myVisibleInstanceBuffer = VK_NULL_HANDLE;
+    VmaAllocation myVisibleInstanceBufferMemory = VK_NULL_HANDLE;
+    VkBuffer myDrawCommandBuffer = VK_NULL_HANDLE;
+    VmaAllocation myDrawCommandBufferMemory = VK_NULL_HANDLE;
+    VkDeviceSize myDrawCommandBufferSliceSize = 0;
+    uint32_t myCullingGroupCount = 0;
+    DescriptorLayout myCullingDescriptorLayout;
+    VkPipelineLayout myCullingPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline myCullingPipeline = VK_NULL_HANDLE;
+    struct Sprite
+    {
+        float position[2];
+        float velocity[2];
+        float angle;
+        float spin;
+        float size;
+        float texRect[4];
+        uint8_t tint[4];
+        uint32_t texture; // index into myTextures
+    };
+    std::vector<Sprite> mySprites;
     VkCommandPool myCommandPool = VK_NULL_HANDLE;
-    std::vector<VkCommandBuffer> myCommandBuffers;
+    ParallelRecorder myRecorder;
+    struct Draw
+    {
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+        uint32_t texture; // index into myTextures, without bindless textures
+    };
+    std::vector<Draw> myDraws;
     std::vector<VkSemaphore> myImageAvailableSemaphores;
     std::vector<VkSemaphore> myRenderFinishedSemaphores;
     std::vector<VkFence> myInFlightFences;
     size_t myCurrentFrame = 0;
+    GpuProfiler myGpuProfiler;
+    typedef std::chrono::steady_clock FrameClock;
+    std::vector<FrameClock::time_point> myFrameStartTimes; // per frame in flight, zero when it has none
+    std::vector<double> myFrameLatencies; // in milliseconds, see getLatencyStats
     
     static const Vertex ourVertices[4];
     static const uint16_t ourIndices[6];
@@ -1329,10 +5578,10 @@ private:
 
 const Vertex VulkanTutorialApp::ourVertices[] =
 {
-    {{-1.0f, -1.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
-    {{1.0f, -1.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
-    {{1.0f, 1.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}},
-    {{-1.0f, 1.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}}
+    {{-1.0f, -1.0f}, {1.0f, 0.0f}},
+    {{1.0f, -1.0f}, {0.0f, 0.0f}},
+    {{1.0f, 1.0f}, {0.0f, 1.0f}},
+    {{-1.0f, 1.0f}, {1.0f, 1.0f}}
 };
 
 const uint16_t VulkanTutorialApp::ourIndices[] =
@@ -1375,11 +5624,32 @@ int vktut2_create(void* view, int width, int height, float backingScaleFactor)
     return EXIT_SUCCESS;
 }
 
+int vktut2_create_headless(int width, int height, const char* resourcePath)
+{
+    assert(width > 0);
+    assert(height > 0);
+    assert(resourcePath != nullptr);
+    assert(theApp == nullptr);
+    
+    try
+    {
+        theApp = new VulkanTutorialApp(width, height, resourcePath);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    
+    return EXIT_SUCCESS;
+}
+
 void vktut2_destroy()
 {
     assert(theApp != nullptr);
     
     delete theApp;
+    theApp = nullptr;
 }
 
 void vktut2_drawframe(unsigned int frame)
@@ -1389,3 +5659,168 @@ void vktut2_drawframe(unsigned int frame)
     theApp->draw(frame);
 }
 
+void vktut2_finish()
+{
+    assert(theApp != nullptr);
+    
+    theApp->finish();
+}
+
+void vktut2_gpu_stats(double* totalMilliseconds, unsigned int* frameCount)
+{
+    assert(theApp != nullptr);
+    assert(totalMilliseconds != nullptr);
+    assert(frameCount != nullptr);
+    
+    theApp->getGpuStats(*totalMilliseconds, *frameCount);
+}
+
+unsigned int vktut2_pending_texture_loads(void)
+{
+    assert(theApp != nullptr);
+    
+    return theApp->getPendingTextureLoads();
+}
+
+unsigned int vktut2_gpu_scope_count(void)
+{
+    assert(theApp != nullptr);
+    
+    return theApp->getGpuScopeCount();
+}
+
+void vktut2_gpu_scope_stats(unsigned int scope, const char** name, double* minMilliseconds, double* meanMilliseconds, double* p99Milliseconds, unsigned int* frameCount)
+{
+    assert(theApp != nullptr);
+    assert(scope < theApp->getGpuScopeCount());
+    assert(name != nullptr);
+    assert(minMilliseconds != nullptr);
+    assert(meanMilliseconds != nullptr);
+    assert(p99Milliseconds != nullptr);
+    assert(frameCount != nullptr);
+    
+    const GpuProfiler::ScopeStats stats = theApp->getGpuScopeStats(scope);
+    *name = stats.name;
+    *minMilliseconds = stats.minMilliseconds;
+    *meanMilliseconds = stats.meanMilliseconds;
+    *p99Milliseconds = stats.p99Milliseconds;
+    *frameCount = stats.frameCount;
+}
+
+void vktut2_latency_stats(double* meanMilliseconds, double* p99Milliseconds, unsigned int* frameCount)
+{
+    assert(theApp != nullptr);
+    assert(meanMilliseconds != nullptr);
+    assert(p99Milliseconds != nullptr);
+    assert(frameCount != nullptr);
+    
+    theApp->getLatencyStats(*meanMilliseconds, *p99Milliseconds, *frameCount);
+}
+
+void vktut2_texture_stats(double* residentMegabytes, double* budgetMegabytes, unsigned int* loadedLevels, unsigned int* evictedLevels)
+{
+    assert(theApp != nullptr);
+    assert(residentMegabytes != nullptr);
+    assert(budgetMegabytes != nullptr);
+    assert(loadedLevels != nullptr);
+    assert(evictedLevels != nullptr);
+    
+    theApp->getTextureStats(*residentMegabytes, *budgetMegabytes, *loadedLevels, *evictedLevels);
+}
+
+void vktut2_read_frame(unsigned char* rgba)
+{
+    assert(theApp != nullptr);
+    assert(rgba != nullptr);
+    
+    theApp->readFrame(rgba);
+}
+
+void vktut2_set_pipeline_cache_path(const char* path)
+{
+    assert(path != nullptr);
+    
+    thePipelineCachePath = path;
+    theHasPipelineCachePath = true;
+}
+
+void vktut2_set_texture_cache_path(const char* path)
+{
+    assert(path != nullptr);
+    
+    theTextureCachePath = path;
+    theHasTextureCachePath = true;
+}
+
+void vktut2_set_draw_count(unsigned int drawCount)
+{
+    assert(drawCount > 0);
+    
+    theDrawCount = drawCount;
+}
+
+void vktut2_set_recording_threads(unsigned int threadCount)
+{
+    assert(threadCount > 0);
+    
+    theRecordingThreadCount = threadCount;
+}
+
+void vktut2_set_sprite_count(unsigned int spriteCount)
+{
+    assert(spriteCount > 0);
+    
+    theSpriteCount = spriteCount;
+}
+
+void vktut2_set_gpu_culling(int enabled)
+{
+    theGpuCulling = enabled != 0;
+}
+
+void vktut2_set_texture_count(unsigned int textureCount)
+{
+    assert(textureCount > 0);
+    
+    theTextureCount = textureCount;
+}
+
+void vktut2_set_bindless_textures(int enabled)
+{
+    theBindlessTextures = enabled != 0;
+}
+
+void vktut2_set_compressed_textures(int enabled)
+{
+    theCompressedTextures = enabled != 0;
+}
+
+void vktut2_set_asset_pack(int enabled)
+{
+    theAssetPack = enabled != 0;
+}
+
+void vktut2_set_texture_budget(unsigned int megabytes)
+{
+    theTextureBudgetMegabytes = megabytes;
+}
+
+void vktut2_set_present_mode(unsigned int presentMode)
+{
+    assert(presentMode <= VK_PRESENT_MODE_FIFO_RELAXED_KHR);
+    
+    thePresentMode = static_cast<VkPresentModeKHR>(presentMode);
+}
+
+void vktut2_set_swap_chain_images(unsigned int imageCount)
+{
+    theSwapChainImageCount = imageCount;
+}
+
+void vktut2_set_frames_in_flight(unsigned int frameCount)
+{
+    assert(frameCount > 0);
+    
+    theFramesInFlight = frameCount;
+}
+
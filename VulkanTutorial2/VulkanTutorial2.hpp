@@ -9,6 +9,74 @@ int vktut2_create(void* view, int width, int height, float backingScaleFactor);
 void vktut2_drawframe(unsigned int frameIndex);
 void vktut2_destroy(void);
 
+// renders into offscreen images instead of a view, with the shaders and textures loaded from resourcePath
+int vktut2_create_headless(int width, int height, const char* resourcePath);
+// waits until all submitted frames have finished rendering
+void vktut2_finish(void);
+// gpu time summed over all finished frames, zero frames if the queue has no timestamps
+void vktut2_gpu_stats(double* totalMilliseconds, unsigned int* frameCount);
+// how many named scopes of each frame the gpu time is measured for, e.g. "render pass" and "draws"
+unsigned int vktut2_gpu_scope_count(void);
+// a scope's name and its gpu time over the last 256 frames that had it, or fewer: min, mean and 99th percentile.
+// the name stays valid while the app is there
+void vktut2_gpu_scope_stats(unsigned int scope, const char** name, double* minMilliseconds, double* meanMilliseconds, double* p99Milliseconds, unsigned int* frameCount);
+// how many textures are still loading in the background, the sprites show a grey placeholder for them until they are
+// uploaded, which happens in vktut2_drawframe
+unsigned int vktut2_pending_texture_loads(void);
+// from where vktut2_drawframe reads the input until the gpu has finished the frame, mean and 99th percentile, of the
+// frames that finished since the last call. presenting and the display come on top of that
+void vktut2_latency_stats(double* meanMilliseconds, double* p99Milliseconds, unsigned int* frameCount);
+// the memory the streamed textures have and may have at most right now, and how many mip levels they have loaded and
+// evicted so far. all zero unless they are streamed, see vktut2_set_texture_budget
+void vktut2_texture_stats(double* residentMegabytes, double* budgetMegabytes, unsigned int* loadedLevels, unsigned int* evictedLevels);
+// headless only, copies the last frame into rgba, width * height * 4 bytes
+void vktut2_read_frame(unsigned char* rgba);
+// where the pipeline cache is kept instead of the user's cache directory, an empty path disables it. takes effect
+// the next time the app is created
+void vktut2_set_pipeline_cache_path(const char* path);
+// the directory decoded textures are cached in instead of the user's cache directory, an empty path disables it. takes
+// effect the next time the app is created
+void vktut2_set_texture_cache_path(const char* path);
+// how many draws each frame is split into, 1 by default. takes effect the next time the app is created
+void vktut2_set_draw_count(unsigned int drawCount);
+// how many threads record the draws, including the one calling vktut2_drawframe, 1 by default. takes effect the next
+// time the app is created
+void vktut2_set_recording_threads(unsigned int threadCount);
+// how many sprites are drawn, 1 by default, which is the quad filling the view. takes effect the next time the app
+// is created
+void vktut2_set_sprite_count(unsigned int spriteCount);
+// culls the sprites against the view in a compute pass and draws the visible ones with indirect draws, off by
+// default. takes effect the next time the app is created
+void vktut2_set_gpu_culling(int enabled);
+// how many textures the sprites are spread over, 1 by default. they are all copies of the one image. takes effect the
+// next time the app is created
+void vktut2_set_texture_count(unsigned int textureCount);
+// puts all textures in one descriptor array indexed per sprite instead of a descriptor set per texture, which needs
+// VK_EXT_descriptor_indexing, off by default. takes effect the next time the app is created
+void vktut2_set_bindless_textures(int enabled);
+// loads a cooked, block compressed copy of a texture (<name>.bc7.ktx, .bc3.ktx, .bc1.ktx or .astc.ktx, see
+// Tools/TextureCooker.cpp) instead of the PNG where there is one the device can sample, on by default. takes effect the
+// next time the app is created
+void vktut2_set_compressed_textures(int enabled);
+// maps assets.pack from the resources (see Tools/AssetPackBuilder.cpp) and takes the shaders and textures it has from
+// there instead of their own files, on by default. takes effect the next time the app is created
+void vktut2_set_asset_pack(int enabled);
+// streams the textures' mip levels in and out to stay within that many megabytes of memory, and within what
+// vmaGetBudget says is left. the levels their sprites need on screen are loaded coarse to fine, and the textures drawn
+// least recently give up theirs first. 0, the default, loads all levels up front. takes effect the next time the app is
+// created
+void vktut2_set_texture_budget(unsigned int megabytes);
+// the swap chain's present mode, as a VkPresentModeKHR: 0 immediate, 1 mailbox, 2 fifo (the default) or 3 fifo relaxed.
+// where the surface doesn't have it, mailbox and immediate fall back to each other and then to fifo, which is always
+// there. windowed only. takes effect the next time the app is created
+void vktut2_set_present_mode(unsigned int presentMode);
+// how many images the swap chain has, within what the surface allows. 0, the default, is 3 for mailbox and 2 for the
+// others. windowed only. takes effect the next time the app is created
+void vktut2_set_swap_chain_images(unsigned int imageCount);
+// how many frames the cpu may get ahead of the gpu, from 1 for the lowest latency to 4 for the most throughput, 2 by
+// default. takes effect the next time the app is created
+void vktut2_set_frames_in_flight(unsigned int frameCount);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,6 +34,20 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif /*WIN32_LEAN_AND_MEAN*/
+#ifndef NOMINMAX
+#define NOMINMAX /*keep the min and max macros out of the C++ part*/
+#endif /*NOMINMAX*/
+#include <windows.h>
+#else /*_WIN32*/
+#include <time.h>
+#endif /*_WIN32*/
+#endif /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -59,12 +73,89 @@ define them in your own project's source files without needing to change
 lodepng source code. Don't forget to remove "static" if you copypaste them
 from here.*/
 
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Stats                                                                  / */
+/* ////////////////////////////////////////////////////////////////////////// */
+
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)
+
+/*the stats of the lodepng_decode call in progress on this thread, if any. Thread local, because the allocators
+and the zlib code that record into it don't have access to the state.*/
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define LODEPNG_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define LODEPNG_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define LODEPNG_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define LODEPNG_THREAD_LOCAL __thread
+#else
+#define LODEPNG_THREAD_LOCAL /*no thread local storage: only decode with stats on one thread at a time*/
+#endif
+
+static LODEPNG_THREAD_LOCAL LodePNGStats* lodepng_current_stats = 0;
+
+/*a monotonic clock in nanoseconds. Only differences are used, so a counter that wraps still gives the right
+durations for stages shorter than its range*/
+static LodePNGStatsCounter lodepng_stats_nanoseconds(void)
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency; /*fixed at boot, a race writes the same value*/
+  LARGE_INTEGER counter;
+  if(!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  /*split to avoid overflowing the multiplication*/
+  return (LodePNGStatsCounter)(counter.QuadPart / frequency.QuadPart) * 1000000000u
+       + (LodePNGStatsCounter)((counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (LodePNGStatsCounter)ts.tv_sec * 1000000000u + (LodePNGStatsCounter)ts.tv_nsec;
+#else
+  /*C89 only has the processor time, which is the same as wall clock time for a decode that doesn't block*/
+  return (LodePNGStatsCounter)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+/*time the code between STATS_BEGIN and STATS_END as the given stage. STATS_DECLARE goes with the declarations at
+the start of the enclosing block, and has no semicolon after it, so that it expands to nothing without stats*/
+#define STATS_DECLARE(stage)\
+  LodePNGStatsCounter stats_start_##stage = 0;
+
+#define STATS_BEGIN(stage)\
+  stats_start_##stage = lodepng_current_stats ? lodepng_stats_nanoseconds() : 0
+
+#define STATS_END(stage, numbytes)\
+{\
+  if(lodepng_current_stats)\
+  {\
+    lodepng_current_stats->nanoseconds[stage] += lodepng_stats_nanoseconds() - stats_start_##stage;\
+    lodepng_current_stats->bytes[stage] += (numbytes);\
+  }\
+}
+
+#define STATS_COUNT(counter, amount)\
+{\
+  if(lodepng_current_stats) lodepng_current_stats->counter += (amount);\
+}
+
+#else /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
+
+#define STATS_DECLARE(stage)
+#define STATS_BEGIN(stage)
+#define STATS_END(stage, numbytes)
+#define STATS_COUNT(counter, amount)
+
+#endif /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
+
 #ifdef LODEPNG_COMPILE_ALLOCATORS
 static void* lodepng_malloc(size_t size)
 {
 #ifdef LODEPNG_MAX_ALLOC
   if(size > LODEPNG_MAX_ALLOC) return 0;
 #endif
+  STATS_COUNT(allocations, 1);
+  STATS_COUNT(allocated_bytes, size);
   return malloc(size);
 }
 
@@ -73,6 +164,8 @@ static void* lodepng_realloc(void* ptr, size_t new_size)
 #ifdef LODEPNG_MAX_ALLOC
   if(new_size > LODEPNG_MAX_ALLOC) return 0;
 #endif
+  STATS_COUNT(allocations, 1);
+  STATS_COUNT(allocated_bytes, new_size);
   return realloc(ptr, new_size);
 }
 
@@ -1279,7 +1372,8 @@ static unsigned lodepng_inflatev(ucvector* out,
     BTYPE += 2u * readBitFromStream(&bp, in);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
+    STATS_COUNT(deflate_blocks[BTYPE], 1);
+    if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
     else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
@@ -3502,6 +3596,56 @@ static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned s
   }
 }
 
+/*Similar to getPixelColorsRGBA8, but with 16-bit input and RGBA 16-bit (big endian, like all 16-bit raw
+images) output. One tight loop per color type instead of getPixelColorRGBA16 and rgba16ToPixel per pixel.
+mode must be a 16-bit color type.*/
+static void getPixelColorsRGBA16(unsigned char* buffer, size_t numpixels,
+                                 const unsigned char* in, const LodePNGColorMode* mode)
+{
+  size_t i;
+  if(mode->colortype == LCT_GREY)
+  {
+    for(i = 0; i != numpixels; ++i, buffer += 8, in += 2)
+    {
+      unsigned alpha = mode->key_defined && 256u * in[0] + in[1] == mode->key_r ? 0 : 255;
+      buffer[0] = buffer[2] = buffer[4] = in[0];
+      buffer[1] = buffer[3] = buffer[5] = in[1];
+      buffer[6] = buffer[7] = (unsigned char)alpha;
+    }
+  }
+  else if(mode->colortype == LCT_RGB)
+  {
+    for(i = 0; i != numpixels; ++i, buffer += 8, in += 6)
+    {
+      unsigned alpha = mode->key_defined
+                       && 256u * in[0] + in[1] == mode->key_r
+                       && 256u * in[2] + in[3] == mode->key_g
+                       && 256u * in[4] + in[5] == mode->key_b ? 0 : 255;
+      buffer[0] = in[0];
+      buffer[1] = in[1];
+      buffer[2] = in[2];
+      buffer[3] = in[3];
+      buffer[4] = in[4];
+      buffer[5] = in[5];
+      buffer[6] = buffer[7] = (unsigned char)alpha;
+    }
+  }
+  else if(mode->colortype == LCT_GREY_ALPHA)
+  {
+    for(i = 0; i != numpixels; ++i, buffer += 8, in += 4)
+    {
+      buffer[0] = buffer[2] = buffer[4] = in[0];
+      buffer[1] = buffer[3] = buffer[5] = in[1];
+      buffer[6] = in[2];
+      buffer[7] = in[3];
+    }
+  }
+  else if(mode->colortype == LCT_RGBA)
+  {
+    memcpy(buffer, in, numpixels * 8);
+  }
+}
+
 unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h)
@@ -3549,7 +3693,11 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     }
   }
 
-  if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16)
+  if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16 && mode_out->colortype == LCT_RGBA)
+  {
+    getPixelColorsRGBA16(out, numpixels, in, mode_in);
+  }
+  else if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16)
   {
     for(i = 0; i != numpixels; ++i)
     {
@@ -4115,6 +4263,9 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7) / 8;
   size_t linebytes = (w * bpp + 7) / 8;
+  STATS_DECLARE(LSS_UNFILTER)
+
+  STATS_BEGIN(LSS_UNFILTER);
 
   for(y = 0; y < h; ++y)
   {
@@ -4127,68 +4278,95 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     prevline = &out[outindex];
   }
 
+  STATS_END(LSS_UNFILTER, linebytes * h);
+
   return 0;
 }
 
+/*copies one row of a byte aligned Adam7 reduced image to its positions in the full image. The pixel size is a
+constant in every case, so each pixel becomes a single fixed size load and store instead of a byte loop.*/
+#define ADAM7_SCATTER_ROW(BYTEWIDTH)\
+  for(x = 0; x != passw; ++x, in += BYTEWIDTH, out += ostride)\
+  {\
+    for(b = 0; b != BYTEWIDTH; ++b) out[b] = in[b];\
+  }
+
+static void Adam7_scatterRow(unsigned char* out, const unsigned char* in, unsigned passw,
+                             size_t bytewidth, size_t ostride)
+{
+  unsigned x;
+  size_t b;
+  if(bytewidth == ostride)
+  {
+    /*last pass: the reduced scanline is already contiguous in the output*/
+    memcpy(out, in, passw * bytewidth);
+    return;
+  }
+  switch(bytewidth)
+  {
+    case 1: ADAM7_SCATTER_ROW(1) break;
+    case 2: ADAM7_SCATTER_ROW(2) break;
+    case 3: ADAM7_SCATTER_ROW(3) break;
+    case 4: ADAM7_SCATTER_ROW(4) break;
+    case 6: ADAM7_SCATTER_ROW(6) break;
+    case 8: ADAM7_SCATTER_ROW(8) break;
+    default: ADAM7_SCATTER_ROW(bytewidth) break;
+  }
+}
+
+#undef ADAM7_SCATTER_ROW
+
 /*
-in: Adam7 interlaced image, with no padding bits between scanlines, but between
- reduced images so that each reduced image starts at a byte.
-out: the same pixels, but re-ordered so that they're now a non-interlaced image with size w*h
+in: one Adam7 reduced image (the given pass), with no padding bits between scanlines.
+out: the full w*h non-interlaced image, the pixels of this pass get written to their final positions
 bpp: bits per pixel
 out has the following size in bits: w * h * bpp.
-in is possibly bigger due to padding bits between reduced images.
 out must be big enough AND must be 0 everywhere if bpp < 8 in the current implementation
 (because that's likely a little bit faster)
 NOTE: comments about padding bits are only relevant if bpp < 8
 */
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static void Adam7_deinterlacePass(unsigned char* out, const unsigned char* in, unsigned w,
+                                  unsigned passw, unsigned passh, unsigned bpp, unsigned pass)
 {
-  unsigned passw[7], passh[7];
-  size_t filter_passstart[8], padded_passstart[8], passstart[8];
-  unsigned i;
+  unsigned y;
+  STATS_DECLARE(LSS_DEINTERLACE)
 
-  Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+  STATS_BEGIN(LSS_DEINTERLACE);
 
   if(bpp >= 8)
   {
-    for(i = 0; i != 7; ++i)
+    size_t bytewidth = bpp / 8;
+    size_t linebytes = (size_t)w * bytewidth;
+    size_t ostride = ADAM7_DX[pass] * bytewidth;
+    unsigned char* orow = out + ADAM7_IY[pass] * linebytes + ADAM7_IX[pass] * bytewidth;
+    for(y = 0; y < passh; ++y)
     {
-      unsigned x, y, b;
-      size_t bytewidth = bpp / 8;
-      for(y = 0; y < passh[i]; ++y)
-      for(x = 0; x < passw[i]; ++x)
-      {
-        size_t pixelinstart = passstart[i] + (y * passw[i] + x) * bytewidth;
-        size_t pixeloutstart = ((ADAM7_IY[i] + y * ADAM7_DY[i]) * w + ADAM7_IX[i] + x * ADAM7_DX[i]) * bytewidth;
-        for(b = 0; b < bytewidth; ++b)
-        {
-          out[pixeloutstart + b] = in[pixelinstart + b];
-        }
-      }
+      Adam7_scatterRow(orow, in, passw, bytewidth, ostride);
+      in += passw * bytewidth;
+      orow += ADAM7_DY[pass] * linebytes;
     }
   }
   else /*bpp < 8: Adam7 with pixels < 8 bit is a bit trickier: with bit pointers*/
   {
-    for(i = 0; i != 7; ++i)
+    unsigned x, b;
+    unsigned ilinebits = bpp * passw;
+    unsigned olinebits = bpp * w;
+    size_t obp, ibp; /*bit pointers (for out and in buffer)*/
+    for(y = 0; y < passh; ++y)
+    for(x = 0; x < passw; ++x)
     {
-      unsigned x, y, b;
-      unsigned ilinebits = bpp * passw[i];
-      unsigned olinebits = bpp * w;
-      size_t obp, ibp; /*bit pointers (for out and in buffer)*/
-      for(y = 0; y < passh[i]; ++y)
-      for(x = 0; x < passw[i]; ++x)
+      ibp = y * ilinebits + x * bpp;
+      obp = (ADAM7_IY[pass] + y * ADAM7_DY[pass]) * olinebits + (ADAM7_IX[pass] + x * ADAM7_DX[pass]) * bpp;
+      for(b = 0; b < bpp; ++b)
       {
-        ibp = (8 * passstart[i]) + (y * ilinebits + x * bpp);
-        obp = (ADAM7_IY[i] + y * ADAM7_DY[i]) * olinebits + (ADAM7_IX[i] + x * ADAM7_DX[i]) * bpp;
-        for(b = 0; b < bpp; ++b)
-        {
-          unsigned char bit = readBitFromReversedStream(&ibp, in);
-          /*note that this function assumes the out buffer is completely 0, use setBitOfReversedStream otherwise*/
-          setBitOfReversedStream0(&obp, out, bit);
-        }
+        unsigned char bit = readBitFromReversedStream(&ibp, in);
+        /*note that this function assumes the out buffer is completely 0, use setBitOfReversedStream otherwise*/
+        setBitOfReversedStream0(&obp, out, bit);
       }
     }
   }
+
+  STATS_END(LSS_DEINTERLACE, ((size_t)passw * passh * bpp + 7) / 8);
 }
 
 static void removePaddingBits(unsigned char* out, const unsigned char* in,
@@ -4222,13 +4400,15 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 the IDAT chunks (with filter index bytes and possible padding bits)
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png)
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                     const LodePNGDecoderSettings* decoder)
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
   Steps:
   *) if no Adam7: 1) unfilter 2) remove padding bits (= posible extra bits per scanline if bpp < 8)
-  *) if adam7: 1) 7x unfilter 2) 7x remove padding bits 3) Adam7_deinterlace
+  *) if adam7: 7x 1) unfilter 2) remove padding bits 3) Adam7_deinterlacePass, so that each reduced image is
+     still in cache when it's scattered, and so that the output can be previewed after every pass
   NOTE: the in buffer will be overwritten with intermediate data!
   */
   unsigned bpp = lodepng_get_bpp(&info_png->color);
@@ -4263,9 +4443,12 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
         removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], passw[i] * bpp,
                           ((passw[i] * bpp + 7) / 8) * 8, passh[i]);
       }
-    }
 
-    Adam7_deinterlace(out, in, w, h, bpp);
+      /*the later passes are unfiltered at higher offsets of in, so this pass stays intact until it's used here*/
+      Adam7_deinterlacePass(out, &in[passstart[i]], w, passw[i], passh[i], bpp, i);
+
+      if(decoder->adam7_pass_callback) decoder->adam7_pass_callback(out, w, h, i, decoder->adam7_pass_context);
+    }
   }
 
   return 0;
@@ -4595,6 +4778,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  STATS_DECLARE(LSS_CHUNKS)
+  STATS_DECLARE(LSS_INFLATE)
 
   /*provide some proper output values if error will happen*/
   *out = 0;
@@ -4610,6 +4795,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
+  STATS_BEGIN(LSS_CHUNKS);
+
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
   IDAT data is put at the start of the in buffer*/
   while(!IEND && !state->error)
@@ -4744,6 +4931,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
 
+  STATS_END(LSS_CHUNKS, insize);
+
   ucvector_init(&scanlines);
   /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
   If the decompressed size does not match the prediction, the image must be corrupt.*/
@@ -4767,8 +4956,10 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
   if(!state->error)
   {
+    STATS_BEGIN(LSS_INFLATE);
     state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
                                    idat.size, &state->decoder.zlibsettings);
+    STATS_END(LSS_INFLATE, scanlines.size);
     if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
   }
   ucvector_cleanup(&idat);
@@ -4781,18 +4972,30 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   }
   if(!state->error)
   {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    /*the bit level paths only set bits and a progressive preview must not show uninitialized memory, every other
+    path writes each output byte*/
+    if(lodepng_get_bpp(&state->info_png.color) < 8
+       || (state->info_png.interlace_method != 0 && state->decoder.adam7_pass_callback))
+    {
+      for(i = 0; i < outsize; i++) (*out)[i] = 0;
+    }
+    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png, &state->decoder);
   }
   ucvector_cleanup(&scanlines);
 }
 
-unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
-                        LodePNGState* state,
-                        const unsigned char* in, size_t insize)
+/*lodepng_decode without the stats bookkeeping*/
+static unsigned decodeAndConvert(unsigned char** out, unsigned* w, unsigned* h,
+                                 LodePNGState* state,
+                                 const unsigned char* in, size_t insize)
 {
+  STATS_DECLARE(LSS_DECODE)
+  STATS_DECLARE(LSS_CONVERT)
   *out = 0;
+  /*timed here so that the early returns of decodeGeneric on errors are included*/
+  STATS_BEGIN(LSS_DECODE);
   decodeGeneric(out, w, h, state, in, insize);
+  STATS_END(LSS_DECODE, *out ? lodepng_get_raw_size(*w, *h, &state->info_png.color) : 0);
   if(state->error) return state->error;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
   {
@@ -4825,13 +5028,36 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     {
       state->error = 83; /*alloc fail*/
     }
-    else state->error = lodepng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
+    else
+    {
+      STATS_BEGIN(LSS_CONVERT);
+      state->error = lodepng_convert(*out, data, &state->info_raw,
+                                     &state->info_png.color, *w, *h);
+      STATS_END(LSS_CONVERT, outsize);
+    }
     lodepng_free(data);
   }
   return state->error;
 }
 
+unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
+                        LodePNGState* state,
+                        const unsigned char* in, size_t insize)
+{
+#ifdef LODEPNG_COMPILE_STATS
+  /*restored afterwards, in case a custom zlib or allocator decodes another PNG from within this one*/
+  LodePNGStats* previous_stats = lodepng_current_stats;
+  unsigned error;
+  lodepng_current_stats = state->stats;
+  STATS_COUNT(decodes, 1);
+  error = decodeAndConvert(out, w, h, state, in, insize);
+  lodepng_current_stats = previous_stats;
+  return error;
+#else /*LODEPNG_COMPILE_STATS*/
+  return decodeAndConvert(out, w, h, state, in, insize);
+#endif /*LODEPNG_COMPILE_STATS*/
+}
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -4879,9 +5105,36 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 }
 #endif /*LODEPNG_COMPILE_DISK*/
 
+#ifdef LODEPNG_COMPILE_STATS
+void lodepng_stats_init(LodePNGStats* stats)
+{
+  unsigned i;
+  for(i = 0; i != LSS_NUM_STAGES; ++i) stats->nanoseconds[i] = stats->bytes[i] = 0;
+  for(i = 0; i != 3; ++i) stats->deflate_blocks[i] = 0;
+  stats->allocations = stats->allocated_bytes = 0;
+  stats->decodes = 0;
+}
+
+void lodepng_stats_add(LodePNGStats* total, const LodePNGStats* stats)
+{
+  unsigned i;
+  for(i = 0; i != LSS_NUM_STAGES; ++i)
+  {
+    total->nanoseconds[i] += stats->nanoseconds[i];
+    total->bytes[i] += stats->bytes[i];
+  }
+  for(i = 0; i != 3; ++i) total->deflate_blocks[i] += stats->deflate_blocks[i];
+  total->allocations += stats->allocations;
+  total->allocated_bytes += stats->allocated_bytes;
+  total->decodes += stats->decodes;
+}
+#endif /*LODEPNG_COMPILE_STATS*/
+
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->adam7_pass_callback = 0;
+  settings->adam7_pass_context = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -4907,6 +5160,9 @@ void lodepng_state_init(LodePNGState* state)
   lodepng_color_mode_init(&state->info_raw);
   lodepng_info_init(&state->info_png);
   state->error = 1;
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)
+  state->stats = 0;
+#endif /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
 }
 
 void lodepng_state_cleanup(LodePNGState* state)
@@ -74,6 +74,8 @@ source files with custom allocators.*/
 #ifndef LODEPNG_NO_COMPILE_ALLOCATORS
 #define LODEPNG_COMPILE_ALLOCATORS
 #endif
+/*Per stage timings and counters of the decoder (LodePNGStats). Unlike the sections above this one is off
+by default, pass -DLODEPNG_COMPILE_STATS to the compiler to enable it.*/
 /*compile the C++ version (you can disable the C++ wrapper here even when compiling for C++)*/
 #ifdef __cplusplus
 #ifndef LODEPNG_NO_COMPILE_CPP
@@ -528,6 +530,13 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*called after each of the 7 passes of an Adam7 interlaced image has been placed in the output buffer, for
+  progressive preview. image has the color type of the PNG (info_png.color), not the requested info_raw type,
+  and pixels of passes that did not arrive yet are 0. pass is 0..6. Not called for non-interlaced images.
+  Default: null*/
+  void (*adam7_pass_callback)(const unsigned char* image, unsigned w, unsigned h, unsigned pass, void* context);
+  void* adam7_pass_context; /*passed as context to adam7_pass_callback*/
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -621,6 +630,45 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)
+/*The type of the stats counters: 64 bit where the compiler has it, C89 only guarantees 32 bits in unsigned long.*/
+#if defined(__cplusplus) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+typedef unsigned long long LodePNGStatsCounter;
+#elif defined(_MSC_VER)
+typedef unsigned __int64 LodePNGStatsCounter;
+#else
+typedef unsigned long LodePNGStatsCounter;
+#endif
+
+/*The stages of decoding that LodePNGStats keeps track of.*/
+typedef enum LodePNGStatsStage
+{
+  LSS_DECODE, /*all of decodeGeneric including failed decodes, so the stages below except LSS_CONVERT. bytes: raw image*/
+  LSS_CHUNKS, /*walking the chunks and gathering the IDAT data. bytes: PNG file*/
+  LSS_INFLATE, /*zlib_decompress of the IDAT data. bytes: filtered scanlines*/
+  LSS_UNFILTER, /*unfilter, once per Adam7 pass. bytes: unfiltered scanlines*/
+  LSS_DEINTERLACE, /*Adam7 deinterlacing. bytes: deinterlaced image*/
+  LSS_CONVERT, /*lodepng_convert to the info_raw color type. bytes: converted image*/
+  LSS_NUM_STAGES
+} LodePNGStatsStage;
+
+/*Timings and counters of a decode, accumulated over every lodepng_decode call with the same stats, so that a
+loader can sum them over many files. Initialize with lodepng_stats_init.*/
+typedef struct LodePNGStats
+{
+  LodePNGStatsCounter nanoseconds[LSS_NUM_STAGES]; /*wall clock time spent per stage*/
+  LodePNGStatsCounter bytes[LSS_NUM_STAGES]; /*bytes produced (or consumed, for LSS_CHUNKS) per stage*/
+  LodePNGStatsCounter allocations; /*lodepng_malloc and lodepng_realloc calls (built in allocators only)*/
+  LodePNGStatsCounter allocated_bytes; /*bytes requested by those calls*/
+  LodePNGStatsCounter deflate_blocks[3]; /*inflated deflate blocks per BTYPE: 0 stored, 1 fixed, 2 dynamic Huffman*/
+  LodePNGStatsCounter decodes; /*number of lodepng_decode calls*/
+} LodePNGStats;
+
+void lodepng_stats_init(LodePNGStats* stats);
+/*adds every counter of stats to total, e.g. to sum the stats of files decoded on different threads*/
+void lodepng_stats_add(LodePNGStats* total, const LodePNGStats* stats);
+#endif /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
+
 #if defined(LODEPNG_COMPILE_DECODER) || defined(LODEPNG_COMPILE_ENCODER)
 /*The settings, state and information for extended encoding and decoding.*/
 typedef struct LodePNGState
@@ -634,6 +682,11 @@ typedef struct LodePNGState
   LodePNGColorMode info_raw; /*specifies the format in which you would like to get the raw pixel buffer*/
   LodePNGInfo info_png; /*info of the PNG image obtained after decoding*/
   unsigned error;
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)
+  /*if not null, lodepng_decode adds its timings and counters to this. Not owned by the state, lodepng_state_copy
+  copies the pointer. Default: null*/
+  LodePNGStats* stats;
+#endif /*defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_STATS)*/
 #ifdef LODEPNG_COMPILE_CPP
   /* For the lodepng::State subclass. */
   virtual ~LodePNGState(){}
@@ -14,15 +14,24 @@ out gl_PerVertex
 };
 
 layout(location = 0) in vec2 inPosition;
-layout(location = 1) in vec3 inColor;
-layout(location = 2) in vec2 inTexCoord;
+layout(location = 1) in vec2 inTexCoord;
 
-layout(location = 0) out vec3 fragColor;
+// per instance
+layout(location = 2) in vec4 inTransform; // 2x2 matrix, column major
+layout(location = 3) in vec2 inOffset;
+layout(location = 4) in vec4 inTexRect; // offset and size in texture coordinates
+layout(location = 5) in vec4 inTint;
+layout(location = 6) in uint inTextureIndex; // slot in the bindless texture array
+
+layout(location = 0) out vec4 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTextureIndex;
 
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    vec2 position = mat2(inTransform.xy, inTransform.zw) * inPosition + inOffset;
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 0.0, 1.0);
+    fragColor = inTint;
+    fragTexCoord = inTexRect.xy + inTexCoord * inTexRect.zw;
+    fragTextureIndex = inTextureIndex;
 }